@@ -8,6 +8,7 @@
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -17,13 +18,52 @@
 #include <cstdlib>
 #include <cstdint>
 #include <cmath>
+#include <cctype>
 #include <unordered_set>
+#include <unordered_map>
 #include <map>
+#include <deque>
 #include <algorithm>
 #include <limits>
 #include <filesystem>
 #include <fstream>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <bit>
+#include <numbers>
+
+// x86-64 builds carry SSE paths and pick AVX2 at run time, everything else gets scalar code
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define VKSAMPLE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define VKSAMPLE_X86_SIMD 0
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VKSAMPLE_HAS_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define VKSAMPLE_HAS_MMAP 0
+#endif
+
+// shaderc compiles the GLSL sources at run time, without it the prebuilt .spv files next to them are loaded.
+// CMake sets it from whether it found the library. Other builds (the Xcode project) do not link shaderc, so they
+// have to opt in by defining it themselves.
+#if !defined(VKSAMPLE_SHADERC)
+#define VKSAMPLE_SHADERC 0
+#endif
+#if VKSAMPLE_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
@@ -31,23 +71,80 @@ const char* WINDOW_TITLE = "Vulkan Test";
 const char* APP_NAME = "Hello Triangle";
 const char* ENGINE_NAME = "No Engine";
 const int MAX_FRAMES_IN_FLIGHT = 2;
+const VkDeviceSize STAGING_RING_SIZE = 64ull * 1024ull * 1024ull;
+const VkDeviceSize STAGING_ALIGNMENT = 16u;
+const VkDeviceSize STAGING_CHUNK_SIZE = STAGING_RING_SIZE / 2u; // largest piece of a buffer upload, always fits once the ring is flushed
+// stages and accesses that read uploaded buffers, the culling pass reads instances from a compute shader
+const VkPipelineStageFlags UPLOAD_CONSUMER_STAGES = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+const VkAccessFlags UPLOAD_CONSUMER_ACCESS = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+const float INSTANCE_SPACING = 1.5f;
+const uint32_t BINDLESS_TEXTURE_CAPACITY = 4096u; // size of the texture array, lowered to the device limits
+const uint32_t CULL_GROUP_SIZE = 64u; // local_size_x of shaders/cull.comp
+const std::chrono::milliseconds SHADER_POLL_INTERVAL(250); // how often the shader watcher looks at the source files
+
+enum class VertexFormat {
+    Float,  // Vertex, 32 bytes
+    Packed  // PackedVertex, 16 bytes
+};
+
+struct AppOptions {
+    bool headless = false;
+    uint32_t width = WIDTH;
+    uint32_t height = HEIGHT;
+    uint64_t frame_count = 0u; // 0 - run until the window is closed
+    std::string dump_frames_dir;
+    uint64_t benchmark_frames = 0u; // 0 - benchmark disabled
+    uint64_t warmup_frames = 100u;
+    std::string report_path = "benchmark.json";
+    std::string pipeline_cache_path = "pipeline_cache.bin"; // empty - no cache file
+    uint32_t record_threads = 0u; // 0 - record draws on the main thread
+    uint32_t draw_count = 1u; // copies of the mesh draw, to load the recording path
+    uint32_t instance_count = 1u; // copies of the mesh drawn by every draw
+    bool gpu_cull = false; // cull instances in a compute pass and draw them with vkCmdDrawIndexedIndirectCount
+    bool cpu_cull = false; // cull instances on the CPU before recording, also the fallback when gpu_cull is unsupported
+    uint32_t worker_threads = std::max(2u, std::thread::hardware_concurrency()) - 1u; // helpers of the main thread in mesh parsing and CPU culling
+    std::string mesh_path; // OBJ file, empty - the built-in quads
+    std::vector<std::string> texture_paths; // empty - textures/texture.jpg, KTX2 and DDS files keep their block compression and mip levels
+    std::string cook_input;  // set - cook this image into cook_output and exit without starting Vulkan
+    std::string cook_output;
+    VertexFormat vertex_format = VertexFormat::Float;
+    bool optimize_mesh = true; // reorder loaded meshes for the vertex cache, overdraw and vertex fetch
+    bool bindless = true; // index a texture array by material when the device has descriptor indexing
+    bool dynamic_rendering = true; // render without VkRenderPass and VkFramebuffer objects when the device supports it
+    double target_frame_ms = 0.0; // > 0 - scale the render resolution and MSAA to keep the GPU frame time within it
+    float min_render_scale = 0.5f;
+    std::string shader_cache_dir = "shader_cache"; // compiled SPIR-V keyed by the source hash, empty - no cache
+    bool watch_shaders = false; // recompile edited shaders and swap their pipelines in while running
+};
+
+// Per-instance vertex stream, read at VK_VERTEX_INPUT_RATE_INSTANCE from binding 1.
+// The culling shader reads the same records from a storage buffer, hence the std430 padding.
+struct InstanceData {
+    glm::mat4 model;
+    uint32_t material_index;
+    uint32_t padding[3];
+};
 
 struct Vertex {
     glm::vec3 pos;
     glm::vec3 color;
     glm::vec2 tex_coord;
     
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription binding_desc{};
-        binding_desc.binding = 0u;
-        binding_desc.stride = sizeof(Vertex);
-        binding_desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    static std::array<VkVertexInputBindingDescription, 2> getBindingDescriptions() {
+        std::array<VkVertexInputBindingDescription, 2> binding_desc{};
+        binding_desc[0].binding = 0u;
+        binding_desc[0].stride = sizeof(Vertex);
+        binding_desc[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        
+        binding_desc[1].binding = 1u;
+        binding_desc[1].stride = sizeof(InstanceData);
+        binding_desc[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
         
         return binding_desc;
     }
     
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescritpions() {
-        std::array<VkVertexInputAttributeDescription, 3> attribute_desc{};
+    static std::array<VkVertexInputAttributeDescription, 8> getAttributeDescritpions() {
+        std::array<VkVertexInputAttributeDescription, 8> attribute_desc{};
         attribute_desc[0].binding = 0;
         attribute_desc[0].location = 0;
         attribute_desc[0].format = VK_FORMAT_R32G32B32_SFLOAT;
@@ -63,6 +160,48 @@ struct Vertex {
         attribute_desc[2].format = VK_FORMAT_R32G32_SFLOAT;
         attribute_desc[2].offset = offsetof(Vertex, tex_coord);
         
+        // a mat4 attribute takes four consecutive locations, one per column
+        for(uint32_t column = 0u; column < 4u; ++column) {
+            attribute_desc[3u + column].binding = 1;
+            attribute_desc[3u + column].location = 3u + column;
+            attribute_desc[3u + column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+            attribute_desc[3u + column].offset = offsetof(InstanceData, model) + column * sizeof(glm::vec4);
+        }
+        
+        attribute_desc[7].binding = 1;
+        attribute_desc[7].location = 7;
+        attribute_desc[7].format = VK_FORMAT_R32_UINT;
+        attribute_desc[7].offset = offsetof(InstanceData, material_index);
+        
+        return attribute_desc;
+    }
+};
+
+// Quantized Vertex: position as 16-bit unorm inside the mesh bounding box, RGBA8 color and half float
+// texture coordinates. shader.vert scales the position back with FrameUniforms::position_offset/scale.
+struct PackedVertex {
+    uint16_t pos[4]; // w is padding, three component 16-bit formats are rarely supported for vertex input
+    uint8_t color[4];
+    uint16_t tex_coord[2];
+    
+    // same instance stream as Vertex, only binding 0 changes
+    static std::array<VkVertexInputBindingDescription, 2> getBindingDescriptions() {
+        std::array<VkVertexInputBindingDescription, 2> binding_desc = Vertex::getBindingDescriptions();
+        binding_desc[0].stride = sizeof(PackedVertex);
+        return binding_desc;
+    }
+    
+    static std::array<VkVertexInputAttributeDescription, 8> getAttributeDescritpions() {
+        std::array<VkVertexInputAttributeDescription, 8> attribute_desc = Vertex::getAttributeDescritpions();
+        attribute_desc[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+        attribute_desc[0].offset = offsetof(PackedVertex, pos);
+        
+        attribute_desc[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+        attribute_desc[1].offset = offsetof(PackedVertex, color);
+        
+        attribute_desc[2].format = VK_FORMAT_R16G16_SFLOAT;
+        attribute_desc[2].offset = offsetof(PackedVertex, tex_coord);
+        
         return attribute_desc;
     }
 };
@@ -86,6 +225,70 @@ const std::vector<uint16_t> g_indices = {
     6, 7, 4
 };
 
+// Matches the push constant block of shaders/cull.comp.
+struct CullPushConstants {
+    glm::vec4 frustum_planes[6];
+    glm::vec4 mesh_sphere;
+    uint32_t object_count;
+    uint32_t index_count;
+};
+
+// Planes of the clip matrix for Vulkan clip space (depth in [0, 1]). They point inwards and are
+// normalized, so dot(plane.xyz, p) + plane.w is the signed distance of p from the plane.
+static std::array<glm::vec4, 6> extractFrustumPlanes(const glm::mat4& clip) {
+    glm::vec4 row0(clip[0][0], clip[1][0], clip[2][0], clip[3][0]);
+    glm::vec4 row1(clip[0][1], clip[1][1], clip[2][1], clip[3][1]);
+    glm::vec4 row2(clip[0][2], clip[1][2], clip[2][2], clip[3][2]);
+    glm::vec4 row3(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+    std::array<glm::vec4, 6> planes = {
+        row3 + row0, // left
+        row3 - row0, // right
+        row3 + row1,
+        row3 - row1,
+        row2,        // near
+        row3 - row2  // far
+    };
+    for(glm::vec4& plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return planes;
+}
+
+struct BoundingBox {
+    glm::vec3 min_pos;
+    glm::vec3 max_pos;
+};
+
+static BoundingBox computeBoundingBox(const std::vector<Vertex>& vertices) {
+    BoundingBox box{glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest())};
+    for(const Vertex& vertex : vertices) {
+        box.min_pos = glm::min(box.min_pos, vertex.pos);
+        box.max_pos = glm::max(box.max_pos, vertex.pos);
+    }
+    return box;
+}
+
+// Positions are quantized relative to box, which has to contain the vertex.
+static PackedVertex packVertex(const Vertex& vertex, const BoundingBox& box) {
+    PackedVertex packed{};
+    glm::vec3 size = box.max_pos - box.min_pos;
+    for(glm::length_t i = 0; i < 3; ++i) {
+        float normalized = size[i] > 0.0f ? (vertex.pos[i] - box.min_pos[i]) / size[i] : 0.0f;
+        packed.pos[i] = static_cast<uint16_t>(std::lround(std::clamp(normalized, 0.0f, 1.0f) * 65535.0f));
+        packed.color[i] = static_cast<uint8_t>(std::lround(std::clamp(vertex.color[i], 0.0f, 1.0f) * 255.0f));
+    }
+    packed.color[3] = 255u;
+    packed.tex_coord[0] = static_cast<uint16_t>(glm::packHalf1x16(vertex.tex_coord.x));
+    packed.tex_coord[1] = static_cast<uint16_t>(glm::packHalf1x16(vertex.tex_coord.y));
+    return packed;
+}
+
+// Sphere through the corners of the box, xyz - centre, w - radius.
+static glm::vec4 computeBoundingSphere(const BoundingBox& box) {
+    glm::vec3 center = 0.5f * (box.min_pos + box.max_pos);
+    return glm::vec4(center, glm::length(box.max_pos - center));
+}
+
 class InputFileStramGuard final {
 public:
     InputFileStramGuard(std::ifstream&& stream) : m_stream(std::move(stream)) {}
@@ -181,16 +384,15 @@ struct QueueFamilyIndices {
     std::optional<uint32_t> graphics_family;
     std::optional<uint32_t> present_family;
     std::optional<uint32_t> transfer_family;
+    bool present_required = true; // false when rendering without a surface
     
     bool isComplete() {
-        return graphics_family.has_value() && present_family.has_value() && transfer_family.has_value();
+        return graphics_family.has_value() && (present_family.has_value() || !present_required) && transfer_family.has_value();
     }
     
-    VkSharingMode getBufferSharingMode() {
-        if (graphics_family.has_value() && transfer_family.has_value() && graphics_family.value() != transfer_family.value()) {
-            return VK_SHARING_MODE_CONCURRENT;
-        }
-        return VK_SHARING_MODE_EXCLUSIVE;
+    // resources written on a separate transfer family need an ownership transfer before graphics can use them
+    bool hasSeparateTransfer() {
+        return transfer_family.has_value() && graphics_family.has_value() && transfer_family.value() != graphics_family.value();
     }
     
     std::unordered_set<uint32_t> getFamilies() {
@@ -226,217 +428,4657 @@ struct SwapchainParams {
     VkExtent2D extent;
 };
 
-struct UniformBufferObject {
-    glm::mat4 model;
-    glm::mat4 view;
-    glm::mat4 proj;
+// Finished offscreen frame handed to the consumer in headless mode.
+// pixels are only valid for the duration of the callback.
+struct HeadlessFrame {
+    uint64_t frame_number;
+    uint32_t width;
+    uint32_t height;
+    VkFormat format;
+    VkDeviceSize row_pitch;
+    const void* pixels;
 };
 
-class HelloTriangleApplication {
-public:
+using FrameConsumer = std::function<void(const HeadlessFrame&)>;
+
+// CPU time spent in each part of drawFrame, in milliseconds, and what the CPU culling stage let through.
+struct FrameTimings {
+    double frame_ms = 0.0;
+    double wait_fence_ms = 0.0;
+    double acquire_ms = 0.0;
+    double cull_ms = 0.0;
+    double visible_instances = 0.0;
+    double culled_instances = 0.0;
+    double record_ms = 0.0;
+    double submit_ms = 0.0;
+    double present_ms = 0.0;
+};
+
+// GPU time of each named zone of one frame, in milliseconds.
+struct GpuFrameTimings {
+    uint64_t frame_number = 0u;
+    std::vector<std::pair<std::string, double>> zones_ms;
+};
+
+struct TimingSummary {
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+static double elapsedMs(std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end) {
+    return std::chrono::duration<double, std::chrono::milliseconds::period>(end - start).count();
+}
+
+static TimingSummary summarizeTimings(std::vector<double> samples) {
+    TimingSummary summary{};
+    if(samples.empty()) {
+        return summary;
+    }
     
-    void run() {
-        initMainWindow();
-        initVulkan();
-        mainLoop();
-        cleanup();
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        // nearest-rank
+        size_t rank = static_cast<size_t>(std::ceil(p * static_cast<double>(samples.size())));
+        return samples[std::clamp<size_t>(rank, 1u, samples.size()) - 1u];
+    };
+    
+    double sum = 0.0;
+    for(double sample : samples) {
+        sum += sample;
     }
+    summary.mean = sum / static_cast<double>(samples.size());
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    summary.max = samples.back();
+    return summary;
+}
 
+class BenchmarkRecorder final {
+public:
+    void addFrame(const FrameTimings& timings) {
+        m_frames.push_back(timings);
+    }
+    
+    size_t frameCount() const {
+        return m_frames.size();
+    }
+    
+    TimingSummary summarize(double FrameTimings::* field) const {
+        std::vector<double> samples;
+        samples.reserve(m_frames.size());
+        for(const FrameTimings& frame : m_frames) {
+            samples.push_back(frame.*field);
+        }
+        return summarizeTimings(std::move(samples));
+    }
+    
+    void addGpuFrame(const GpuFrameTimings& timings) {
+        ++m_gpu_frames;
+        for(const auto& [name, ms] : timings.zones_ms) {
+            auto zone = std::find_if(m_gpu_zones.begin(), m_gpu_zones.end(), [&name](const auto& entry) { return entry.first == name; });
+            if(zone == m_gpu_zones.end()) {
+                zone = m_gpu_zones.emplace(m_gpu_zones.end(), name, std::vector<double>{});
+            }
+            zone->second.push_back(ms);
+        }
+    }
+    
+    size_t gpuFrameCount() const {
+        return m_gpu_frames;
+    }
+    
+    // zones in the order they were first recorded
+    std::vector<std::pair<std::string, TimingSummary>> summarizeGpuZones() const {
+        std::vector<std::pair<std::string, TimingSummary>> result;
+        for(const auto& [name, samples] : m_gpu_zones) {
+            result.emplace_back(name, summarizeTimings(samples));
+        }
+        return result;
+    }
+    
 private:
-    GLFWwindow* m_window = nullptr;
-    VkInstance m_vk_instance = VK_NULL_HANDLE;;
-    std::unordered_set<std::string> m_available_instance_ext;
-    std::unordered_set<std::string> m_available_device_ext;
-    std::unordered_set<std::string> m_validation_layers;
-    VkDebugUtilsMessengerEXT m_debug_messenger = VK_NULL_HANDLE;;
-    VkPhysicalDevice m_physical_device = VK_NULL_HANDLE;
-    VkDevice m_device = VK_NULL_HANDLE;
-    VkQueue m_graphics_queue = VK_NULL_HANDLE;
-    VkQueue m_transfer_queue = VK_NULL_HANDLE;
-    VkQueue m_present_queue = VK_NULL_HANDLE;
-    VkSurfaceKHR m_surface = VK_NULL_HANDLE;
-    VkSwapchainKHR m_swapchain = VK_NULL_HANDLE;
-    std::vector<VkImage> m_swapchain_images;
-    std::vector<VkImageView> m_swapchain_views;
-    std::vector<VkFramebuffer> m_swapchain_framebuffers;
-    SwapchainParams m_swapchain_params;
-    SwapchainSupportDetails m_swapchain_support_details;
-    VkDescriptorSetLayout m_desc_set_layout = VK_NULL_HANDLE;
-    VkPipelineLayout m_pipeline_layout = VK_NULL_HANDLE;
-    VkRenderPass m_render_pass = VK_NULL_HANDLE;
-    VkShaderModule m_vert_shader_modeule = VK_NULL_HANDLE;
-    VkShaderModule m_frag_shader_modeule = VK_NULL_HANDLE;
-    VkPipeline m_graphics_pipeline = VK_NULL_HANDLE;
-    VkCommandPool m_grapics_cmd_pool = VK_NULL_HANDLE;
-    VkCommandPool m_transfer_cmd_pool = VK_NULL_HANDLE;
-    VkDescriptorPool m_desc_pool = VK_NULL_HANDLE;
-    std::vector<VkDescriptorSet> m_desc_sets;
-    std::vector<VkCommandBuffer> m_command_buffers;
-    std::vector<VkSemaphore> m_image_available; // signaled when the presentation engine is finished using the image.
-    std::vector<VkSemaphore> m_render_finished;
-    std::vector<VkFence> m_in_flight_frame; // will be signaled when the command buffers finish
-    uint32_t m_current_frame = 0u;
-    bool m_framebuffer_resized = false;
-    VkBuffer m_vertex_buffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_vertex_memory = VK_NULL_HANDLE;
-    VkBuffer m_index_buffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_index_memory = VK_NULL_HANDLE;
-    std::vector<VkBuffer> m_uniform_buffers;
-    std::vector<VkDeviceMemory> m_uniform_memory;
-    std::vector<void*> m_uniform_mapped;
-    VkImage m_texture_image = VK_NULL_HANDLE;
-    VkDeviceMemory m_texture_memory = VK_NULL_HANDLE;
-    VkImageView m_texture_view = VK_NULL_HANDLE;
-    VkSampler m_texture_sampler = VK_NULL_HANDLE;
-    uint32_t m_mip_levels = 1u;
-    VkImage m_depth_image = VK_NULL_HANDLE;
-    VkDeviceMemory m_depth_memory = VK_NULL_HANDLE;
-    VkImageView m_depth_view = VK_NULL_HANDLE;
-    VkSampleCountFlagBits m_msaa_samples = VK_SAMPLE_COUNT_1_BIT;
-    VkImage m_color_image;
-    VkDeviceMemory m_color_image_memory;
-    VkImageView m_color_image_view;
-    PFN_vkDebugMarkerSetObjectNameEXT m_pfnDebugMarkerSetObjectNameEXT;
+    std::vector<FrameTimings> m_frames;
+    std::vector<std::pair<std::string, std::vector<double>>> m_gpu_zones;
+    size_t m_gpu_frames = 0u;
+};
+
+static std::string jsonEscape(std::string_view text) {
+    std::string result;
+    result.reserve(text.size());
+    for(char c : text) {
+        if(c == '"' || c == '\\') {
+            result.push_back('\\');
+            result.push_back(c);
+        }
+        else if(static_cast<unsigned char>(c) < 0x20u) {
+            result.push_back(' ');
+        }
+        else {
+            result.push_back(c);
+        }
+    }
+    return result;
+}
+
+static void writeJsonSummary(std::ostream& out, const TimingSummary& summary) {
+    out << "{\"mean\": " << summary.mean
+        << ", \"p50\": " << summary.p50
+        << ", \"p95\": " << summary.p95
+        << ", \"p99\": " << summary.p99
+        << ", \"max\": " << summary.max << "}";
+}
+
+// Timestamp queries written into the per-frame command buffers. Every frame in flight owns
+// its own range of the query pool, results are read back after that frame's fence has
+// signaled so vkGetQueryPoolResults never waits on the GPU.
+class GpuProfiler final {
+public:
+    static constexpr uint32_t MAX_QUERIES_PER_FRAME = 64u;
     
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& memory) {
-        QueueFamilyIndices queue_family_indices = findQueueFamilies(m_physical_device, m_surface);
+    void init(VkDevice device, VkPhysicalDevice physical_device, uint32_t queue_family_index, uint32_t frames_count) {
+        VkPhysicalDeviceProperties device_props{};
+        vkGetPhysicalDeviceProperties(physical_device, &device_props);
         
-        VkBufferCreateInfo buffer_info{};
-        buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        buffer_info.size = size;
-        buffer_info.usage = usage;
-        buffer_info.sharingMode = queue_family_indices.getBufferSharingMode();
+        uint32_t queue_family_count = 0u;
+        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+        std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families.data());
         
-        VkResult result = vkCreateBuffer(m_device, &buffer_info, nullptr, &buffer);
-        if (result != VK_SUCCESS) {
-            throw std::runtime_error("failed to create buffer!");
+        uint32_t valid_bits = queue_families[queue_family_index].timestampValidBits;
+        if(valid_bits == 0u || device_props.limits.timestampPeriod == 0.0f) {
+            std::cout << "GPU profiler: timestamps are not supported by the graphics queue" << std::endl;
+            return;
         }
+        m_timestamp_mask = valid_bits >= 64u ? std::numeric_limits<uint64_t>::max() : ((1ull << valid_bits) - 1ull);
+        m_timestamp_period = static_cast<double>(device_props.limits.timestampPeriod);
         
-        VkMemoryRequirements mem_req;
-        vkGetBufferMemoryRequirements(m_device, buffer, &mem_req);
-        uint32_t mem_type_idx = findMemoryType(mem_req.memoryTypeBits, properties);
-        
-        VkMemoryAllocateInfo alloc_info{};
-        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        alloc_info.allocationSize = mem_req.size;
-        alloc_info.memoryTypeIndex = mem_type_idx;
+        VkQueryPoolCreateInfo query_pool_info{};
+        query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_pool_info.queryCount = MAX_QUERIES_PER_FRAME * frames_count;
         
-        result = vkAllocateMemory(m_device, &alloc_info, nullptr, &memory);
+        VkResult result = vkCreateQueryPool(device, &query_pool_info, nullptr, &m_query_pool);
         if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate buffer memory!");
+            throw std::runtime_error("failed to create timestamp query pool!");
         }
-        
-        vkBindBufferMemory(m_device, buffer, memory, 0u);
+        m_frames.resize(frames_count);
     }
     
+    void destroy(VkDevice device) {
+        if(m_query_pool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(device, m_query_pool, nullptr);
+            m_query_pool = VK_NULL_HANDLE;
+        }
+    }
     
+    bool isEnabled() const {
+        return m_query_pool != VK_NULL_HANDLE;
+    }
     
-    static void framebuffer_resize_callback(GLFWwindow* window, int width, int height) {
-        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
-        app->m_framebuffer_resized = true;
+    // Must be recorded outside of a render pass, before any zone of the frame.
+    void beginFrame(VkCommandBuffer command_buffer, uint32_t frame, uint64_t frame_number) {
+        if(!isEnabled()) return;
+        
+        FrameQueries& frame_queries = m_frames[frame];
+        frame_queries.frame_number = frame_number;
+        frame_queries.zones.clear();
+        frame_queries.open_zones.clear();
+        frame_queries.used_queries = 0u;
+        frame_queries.recorded = true;
+        vkCmdResetQueryPool(command_buffer, m_query_pool, frame * MAX_QUERIES_PER_FRAME, MAX_QUERIES_PER_FRAME);
     }
+    
+    void beginZone(VkCommandBuffer command_buffer, uint32_t frame, std::string_view name) {
+        if(!isEnabled()) return;
         
-    void initMainWindow() {
-        glfwInit();
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        //glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-        m_window = glfwCreateWindow(WIDTH, HEIGHT, WINDOW_TITLE, nullptr, nullptr);
-        glfwSetWindowUserPointer(m_window, this);
-        glfwSetFramebufferSizeCallback(m_window, framebuffer_resize_callback);
+        FrameQueries& frame_queries = m_frames[frame];
+        if(frame_queries.used_queries + 2u > MAX_QUERIES_PER_FRAME) {
+            frame_queries.open_zones.push_back(std::numeric_limits<size_t>::max());
+            return;
+        }
+        
+        Zone zone{};
+        zone.name = std::string(name);
+        zone.begin_query = frame * MAX_QUERIES_PER_FRAME + frame_queries.used_queries++;
+        zone.end_query = frame * MAX_QUERIES_PER_FRAME + frame_queries.used_queries++;
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_query_pool, zone.begin_query);
+        
+        frame_queries.open_zones.push_back(frame_queries.zones.size());
+        frame_queries.zones.push_back(std::move(zone));
     }
     
-    uint32_t getVkApiVersion() {
-        uint32_t api_version = VK_API_VERSION_1_0;
-        VkResult result = vkEnumerateInstanceVersion(&api_version);
-        if (result != VK_SUCCESS) {
-            throw std::runtime_error("failed to get Vulkan API version!");
+    void endZone(VkCommandBuffer command_buffer, uint32_t frame) {
+        if(!isEnabled()) return;
+        
+        FrameQueries& frame_queries = m_frames[frame];
+        if(frame_queries.open_zones.empty()) {
+            throw std::logic_error("GPU profiler zone end without begin!");
         }
-        return api_version;
+        size_t zone_index = frame_queries.open_zones.back();
+        frame_queries.open_zones.pop_back();
+        if(zone_index == std::numeric_limits<size_t>::max()) {
+            return;
+        }
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_query_pool, frame_queries.zones[zone_index].end_query);
     }
     
-    std::vector<const char*> getRequiredInstanceExtensions() {
-		uint32_t glfw_extension_count = 0;
-		const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-		std::vector<const char*> extensions(glfw_extensions, glfw_extensions + glfw_extension_count);
-		if (ENABLE_VALIDATION_LAYERS) {
-			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-		}
-#ifdef __APPLE__
-        extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
-#endif
-#ifndef NDEBUG
-        extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-#endif
-		return extensions;
-	}
- 
-    std::vector<const char*> getRequiredValidationLayers() {
-		std::vector<const char*> layers;
-		if (ENABLE_VALIDATION_LAYERS) {
-			layers.insert(layers.begin(), VALIDATION_LAYERS.cbegin(), VALIDATION_LAYERS.cend());
-		}
-		return layers;
-	}
- 
-    std::unordered_set<std::string> getAvailableInstanceExtensions() {
-        uint32_t ext_count = 0u;
-        VkResult result = vkEnumerateInstanceExtensionProperties(nullptr, &ext_count, nullptr);
-        if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to read instance properties!");
+    // Call only once the fence of the frame slot has signaled.
+    std::optional<GpuFrameTimings> collect(VkDevice device, uint32_t frame) {
+        if(!isEnabled()) return std::nullopt;
+        
+        FrameQueries& frame_queries = m_frames[frame];
+        if(!frame_queries.recorded || frame_queries.used_queries == 0u) {
+            return std::nullopt;
         }
-        std::vector<VkExtensionProperties> ext_props(ext_count);
-        result = vkEnumerateInstanceExtensionProperties(nullptr, &ext_count, ext_props.data());
+        frame_queries.recorded = false;
+        
+        std::array<uint64_t, MAX_QUERIES_PER_FRAME> timestamps{};
+        VkResult result = vkGetQueryPoolResults(
+            device,
+            m_query_pool,
+            frame * MAX_QUERIES_PER_FRAME,
+            frame_queries.used_queries,
+            sizeof(uint64_t) * frame_queries.used_queries,
+            timestamps.data(),
+            sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT
+        );
         if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to read instance properties!");
-        }
-        std::unordered_set<std::string> available_ext;
-        available_ext.reserve(ext_count);
-        for(const VkExtensionProperties& prop : ext_props) {
-            available_ext.insert(std::string(prop.extensionName));
+            return std::nullopt;
         }
         
-        return available_ext;
+        GpuFrameTimings timings{};
+        timings.frame_number = frame_queries.frame_number;
+        uint32_t first_query = frame * MAX_QUERIES_PER_FRAME;
+        for(const Zone& zone : frame_queries.zones) {
+            uint64_t begin = timestamps[zone.begin_query - first_query] & m_timestamp_mask;
+            uint64_t end = timestamps[zone.end_query - first_query] & m_timestamp_mask;
+            uint64_t ticks = (end - begin) & m_timestamp_mask;
+            timings.zones_ms.emplace_back(zone.name, static_cast<double>(ticks) * m_timestamp_period / 1000000.0);
+        }
+        return timings;
     }
     
-    std::vector<const char*> getRequiredDeviceExtensions() {
-        std::vector<const char*> extensions {"VK_KHR_portability_subset"};
-        extensions.insert(extensions.begin(), DEVICE_EXTENSIONS.cbegin(), DEVICE_EXTENSIONS.cend());
-        return extensions;
+private:
+    struct Zone {
+        std::string name;
+        uint32_t begin_query = 0u;
+        uint32_t end_query = 0u;
+    };
+    
+    struct FrameQueries {
+        uint64_t frame_number = 0u;
+        std::vector<Zone> zones;
+        std::vector<size_t> open_zones;
+        uint32_t used_queries = 0u;
+        bool recorded = false;
+    };
+    
+    VkQueryPool m_query_pool = VK_NULL_HANDLE;
+    double m_timestamp_period = 1.0; // nanoseconds per tick
+    uint64_t m_timestamp_mask = std::numeric_limits<uint64_t>::max();
+    std::vector<FrameQueries> m_frames;
+};
+
+// Picks the render scale and MSAA level that keep the GPU frame time within a budget. Over budget the samples
+// step down first and then the scale, under budget the scale comes back first and then the samples. Pixel cost
+// grows with the square of the scale, so the scale moves by the square root of the budget ratio. A change
+// reallocates the attachments and the timings trail by the frames in flight, so the controller holds still for
+// HOLD_FRAMES frames after each one.
+class ResolutionController final {
+public:
+    static constexpr uint32_t HOLD_FRAMES = 30u;
+    static constexpr uint32_t SAMPLE_RETRY_FRAMES = 600u; // a sample level that went over budget is not retried sooner
+    static constexpr float SCALE_STEP = 0.05f;
+    static constexpr double OVER_BUDGET = 1.05;
+    static constexpr double UNDER_BUDGET = 0.8;
+    static constexpr double SMOOTHING = 0.1;
+    
+    // sample_levels - ascending usable sample counts, the controller starts at the last one and full scale
+    void init(double target_ms, float min_scale, std::vector<uint32_t> sample_levels) {
+        m_target_ms = target_ms;
+        m_min_scale = std::clamp(min_scale, SCALE_STEP, 1.0f);
+        m_sample_levels = std::move(sample_levels);
+        m_level = m_sample_levels.size() - 1u;
+        m_level_ceiling = m_level;
+        m_scale = 1.0f;
+        m_average_ms = 0.0;
+        m_has_average = false;
+        m_hold = HOLD_FRAMES;
+        m_change_count = 0u;
     }
     
-    std::unordered_set<std::string> getAvailableValidationLayers() {
-        uint32_t layers_count = 0u;
-        VkResult result = vkEnumerateInstanceLayerProperties(&layers_count, nullptr);
-        if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to read validation layer properties!");
+    // Takes the GPU time of one frame, true when the scale or the samples changed.
+    bool update(double gpu_ms) {
+        m_average_ms = m_has_average ? m_average_ms + SMOOTHING * (gpu_ms - m_average_ms) : gpu_ms;
+        m_has_average = true;
+        if(m_retry > 0u && --m_retry == 0u) {
+            m_level_ceiling = m_sample_levels.size() - 1u;
         }
-        std::vector<VkLayerProperties> layer_props(layers_count);
-        result = vkEnumerateInstanceLayerProperties(&layers_count, layer_props.data());
-        if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to read validation layer properties!");
+        if(m_hold > 0u) {
+            --m_hold;
+            return false;
         }
-        std::unordered_set<std::string> validation_layers; 
-        validation_layers.reserve(layers_count);
-        for(const VkLayerProperties& prop : layer_props) {
-            validation_layers.insert(std::string(prop.layerName));
+        
+        float scale = m_scale;
+        size_t level = m_level;
+        float budget_scale = static_cast<float>(std::sqrt(m_target_ms / std::max(m_average_ms, 0.001)));
+        if(m_average_ms > m_target_ms * OVER_BUDGET) {
+            if(level > 0u) {
+                --level;
+                m_level_ceiling = level;
+                m_retry = SAMPLE_RETRY_FRAMES;
+            }
+            else {
+                scale = quantize(std::min(scale * budget_scale, scale - SCALE_STEP));
+            }
+        }
+        else if(m_average_ms < m_target_ms * UNDER_BUDGET) {
+            if(scale < 1.0f) {
+                scale = quantize(std::max(scale * budget_scale, scale + SCALE_STEP));
+            }
+            else if(level < m_level_ceiling) {
+                ++level;
+            }
         }
         
-        return validation_layers;
+        if(scale == m_scale && level == m_level) {
+            return false;
+        }
+        m_scale = scale;
+        m_level = level;
+        m_hold = HOLD_FRAMES;
+        ++m_change_count;
+        return true;
     }
     
-    void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& messanger_info) {
-        messanger_info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-        messanger_info.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-        messanger_info.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-        messanger_info.pfnUserCallback = debugCallback;
-        messanger_info.pUserData = (void*)this;
+    float getScale() const {
+        return m_scale;
     }
     
-     VkDebugUtilsMessengerEXT setupDebugMessanger() {
-        if(!ENABLE_VALIDATION_LAYERS) return VK_NULL_HANDLE;
-        
-        VkDebugUtilsMessengerCreateInfoEXT messanger_info{};
-        populateDebugMessengerCreateInfo(messanger_info);
+    uint32_t getSamples() const {
+        return m_sample_levels[m_level];
+    }
+    
+    const std::vector<uint32_t>& getSampleLevels() const {
+        return m_sample_levels;
+    }
+    
+    double getAverageMs() const {
+        return m_average_ms;
+    }
+    
+    uint32_t getChangeCount() const {
+        return m_change_count;
+    }
+    
+private:
+    float quantize(float scale) const {
+        return std::clamp(std::round(scale / SCALE_STEP) * SCALE_STEP, m_min_scale, 1.0f);
+    }
+    
+    double m_target_ms = 16.0;
+    float m_min_scale = 0.5f;
+    float m_scale = 1.0f;
+    std::vector<uint32_t> m_sample_levels = {1u};
+    size_t m_level = 0u;
+    size_t m_level_ceiling = 0u;
+    uint32_t m_retry = 0u;
+    double m_average_ms = 0.0;
+    bool m_has_average = false;
+    uint32_t m_hold = HOLD_FRAMES;
+    uint32_t m_change_count = 0u;
+};
+
+enum class AllocationKind {
+    Linear,  // buffers and linear-tiled images
+    Optimal  // optimal-tiled images
+};
+
+class DeviceMemoryAllocator;
+
+// Sub-range of a VkDeviceMemory block handed out by DeviceMemoryAllocator.
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0u;
+    VkDeviceSize size = 0u;
+    void* mapped = nullptr; // non-null for host visible memory, already offset
+    
+private:
+    friend class DeviceMemoryAllocator;
+    void* block = nullptr;
+};
+
+struct MemoryHeapStats {
+    uint32_t heap_index = 0u;
+    uint32_t block_count = 0u;
+    uint32_t allocation_count = 0u;
+    VkDeviceSize block_bytes = 0u;
+    VkDeviceSize used_bytes = 0u;
+    VkDeviceSize free_bytes = 0u;
+    VkDeviceSize largest_free_range = 0u;
+    
+    // 0 - free space is a single range, approaching 1 - free space is scattered in small holes
+    double fragmentation() const {
+        return free_bytes ? 1.0 - static_cast<double>(largest_free_range) / static_cast<double>(free_bytes) : 0.0;
+    }
+};
+
+struct MemoryStats {
+    uint32_t device_memory_count = 0u;
+    uint32_t allocation_count = 0u;
+    std::vector<MemoryHeapStats> heaps;
+};
+
+// Grabs large VkDeviceMemory blocks per memory type and hands out aligned sub-ranges from a
+// per-block free list. Buffers and optimal images never share a block, so no two neighbouring
+// resources can alias a bufferImageGranularity page.
+class DeviceMemoryAllocator final {
+public:
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024ull * 1024ull;
+    
+    void init(VkDevice device, VkPhysicalDevice physical_device, VkDeviceSize preferred_block_size = DEFAULT_BLOCK_SIZE) {
+        m_device = device;
+        m_preferred_block_size = preferred_block_size;
+        vkGetPhysicalDeviceMemoryProperties(physical_device, &m_memory_props);
+        
+        VkPhysicalDeviceProperties device_props{};
+        vkGetPhysicalDeviceProperties(physical_device, &device_props);
+        m_max_allocation_count = device_props.limits.maxMemoryAllocationCount;
+    }
+    
+    void destroy() {
+        for(const std::unique_ptr<MemoryBlock>& block : m_blocks) {
+            vkFreeMemory(m_device, block->memory, nullptr);
+        }
+        m_blocks.clear();
+    }
+    
+    MemoryAllocation allocate(const VkMemoryRequirements& mem_req, uint32_t memory_type, AllocationKind kind) {
+        VkDeviceSize block_size = getBlockSize(memory_type);
+        
+        // large resources get a block of their own instead of fragmenting the shared ones
+        if(mem_req.size > block_size / 2u) {
+            MemoryBlock& block = createBlock(memory_type, kind, mem_req.size, true);
+            return allocateFromBlock(block, mem_req).value();
+        }
+        
+        for(const std::unique_ptr<MemoryBlock>& block : m_blocks) {
+            if(block->dedicated || block->memory_type != memory_type || block->kind != kind) {
+                continue;
+            }
+            std::optional<MemoryAllocation> allocation = allocateFromBlock(*block, mem_req);
+            if(allocation.has_value()) {
+                return allocation.value();
+            }
+        }
+        
+        MemoryBlock& block = createBlock(memory_type, kind, block_size, false);
+        return allocateFromBlock(block, mem_req).value();
+    }
+    
+    void free(MemoryAllocation& allocation) {
+        if(!allocation.block) {
+            return;
+        }
+        MemoryBlock* block = static_cast<MemoryBlock*>(allocation.block);
+        releaseRange(*block, allocation.offset, allocation.size);
+        --block->allocation_count;
+        allocation = MemoryAllocation{};
+        
+        if(block->allocation_count == 0u && (block->dedicated || hasOtherBlock(*block))) {
+            destroyBlock(block);
+        }
+    }
+    
+    MemoryStats getStats() const {
+        MemoryStats stats{};
+        stats.device_memory_count = static_cast<uint32_t>(m_blocks.size());
+        stats.heaps.resize(m_memory_props.memoryHeapCount);
+        for(uint32_t i = 0u; i < m_memory_props.memoryHeapCount; ++i) {
+            stats.heaps[i].heap_index = i;
+        }
+        
+        for(const std::unique_ptr<MemoryBlock>& block : m_blocks) {
+            MemoryHeapStats& heap = stats.heaps[m_memory_props.memoryTypes[block->memory_type].heapIndex];
+            ++heap.block_count;
+            heap.allocation_count += block->allocation_count;
+            heap.block_bytes += block->size;
+            for(const auto& [offset, size] : block->free_ranges) {
+                heap.free_bytes += size;
+                heap.largest_free_range = std::max(heap.largest_free_range, size);
+            }
+            stats.allocation_count += block->allocation_count;
+        }
+        for(MemoryHeapStats& heap : stats.heaps) {
+            heap.used_bytes = heap.block_bytes - heap.free_bytes;
+        }
+        
+        return stats;
+    }
+    
+    void printStats(std::ostream& out) const {
+        MemoryStats stats = getStats();
+        out << "device memory: " << stats.device_memory_count << " blocks, " << stats.allocation_count << " live allocations" << std::endl;
+        for(const MemoryHeapStats& heap : stats.heaps) {
+            if(!heap.block_count) continue;
+            out << "\t - heap " << heap.heap_index << ": " << heap.used_bytes << " / " << heap.block_bytes << " bytes used in "
+                << heap.block_count << " blocks, " << heap.allocation_count << " allocations, fragmentation " << heap.fragmentation() << std::endl;
+        }
+    }
+    
+private:
+    struct MemoryBlock {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0u;
+        uint32_t memory_type = 0u;
+        AllocationKind kind = AllocationKind::Linear;
+        bool dedicated = false;
+        void* mapped = nullptr;
+        uint32_t allocation_count = 0u;
+        std::map<VkDeviceSize, VkDeviceSize> free_ranges; // offset -> size, never adjacent
+    };
+    
+    static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return alignment > 1u ? (value + alignment - 1u) / alignment * alignment : value;
+    }
+    
+    VkDeviceSize getBlockSize(uint32_t memory_type) const {
+        VkDeviceSize heap_size = m_memory_props.memoryHeaps[m_memory_props.memoryTypes[memory_type].heapIndex].size;
+        return std::min(m_preferred_block_size, std::max<VkDeviceSize>(heap_size / 8u, 1u));
+    }
+    
+    MemoryBlock& createBlock(uint32_t memory_type, AllocationKind kind, VkDeviceSize size, bool dedicated) {
+        if(m_blocks.size() >= m_max_allocation_count) {
+            throw std::runtime_error("maxMemoryAllocationCount reached!");
+        }
+        
+        VkMemoryAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.allocationSize = size;
+        alloc_info.memoryTypeIndex = memory_type;
+        
+        auto block = std::make_unique<MemoryBlock>();
+        VkResult result = vkAllocateMemory(m_device, &alloc_info, nullptr, &block->memory);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate device memory block!");
+        }
+        block->size = size;
+        block->memory_type = memory_type;
+        block->kind = kind;
+        block->dedicated = dedicated;
+        block->free_ranges.emplace(0u, size);
+        
+        // host visible blocks stay mapped for their whole lifetime, a VkDeviceMemory can only be mapped once
+        if(m_memory_props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            result = vkMapMemory(m_device, block->memory, 0u, VK_WHOLE_SIZE, 0u, &block->mapped);
+            if(result != VK_SUCCESS) {
+                vkFreeMemory(m_device, block->memory, nullptr);
+                throw std::runtime_error("failed to map device memory block!");
+            }
+        }
+        
+        m_blocks.push_back(std::move(block));
+        return *m_blocks.back();
+    }
+    
+    void destroyBlock(MemoryBlock* block) {
+        auto it = std::find_if(m_blocks.begin(), m_blocks.end(), [block](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; });
+        vkFreeMemory(m_device, block->memory, nullptr);
+        m_blocks.erase(it);
+    }
+    
+    bool hasOtherBlock(const MemoryBlock& block) const {
+        return std::any_of(m_blocks.cbegin(), m_blocks.cend(), [&block](const std::unique_ptr<MemoryBlock>& b) {
+            return b.get() != &block && !b->dedicated && b->memory_type == block.memory_type && b->kind == block.kind;
+        });
+    }
+    
+    std::optional<MemoryAllocation> allocateFromBlock(MemoryBlock& block, const VkMemoryRequirements& mem_req) {
+        // best fit over the free list
+        auto best = block.free_ranges.end();
+        VkDeviceSize best_leftover = std::numeric_limits<VkDeviceSize>::max();
+        for(auto it = block.free_ranges.begin(); it != block.free_ranges.end(); ++it) {
+            VkDeviceSize aligned_offset = alignUp(it->first, mem_req.alignment);
+            VkDeviceSize range_end = it->first + it->second;
+            if(aligned_offset + mem_req.size > range_end) {
+                continue;
+            }
+            VkDeviceSize leftover = it->second - mem_req.size;
+            if(leftover < best_leftover) {
+                best = it;
+                best_leftover = leftover;
+            }
+        }
+        if(best == block.free_ranges.end()) {
+            return std::nullopt;
+        }
+        
+        VkDeviceSize range_offset = best->first;
+        VkDeviceSize range_end = best->first + best->second;
+        VkDeviceSize aligned_offset = alignUp(range_offset, mem_req.alignment);
+        block.free_ranges.erase(best);
+        if(aligned_offset > range_offset) {
+            block.free_ranges.emplace(range_offset, aligned_offset - range_offset);
+        }
+        if(aligned_offset + mem_req.size < range_end) {
+            block.free_ranges.emplace(aligned_offset + mem_req.size, range_end - aligned_offset - mem_req.size);
+        }
+        ++block.allocation_count;
+        
+        MemoryAllocation allocation{};
+        allocation.memory = block.memory;
+        allocation.offset = aligned_offset;
+        allocation.size = mem_req.size;
+        allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + aligned_offset : nullptr;
+        allocation.block = &block;
+        return allocation;
+    }
+    
+    void releaseRange(MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size) {
+        auto it = block.free_ranges.emplace(offset, size).first;
+        
+        auto next = std::next(it);
+        if(next != block.free_ranges.end() && it->first + it->second == next->first) {
+            it->second += next->second;
+            block.free_ranges.erase(next);
+        }
+        if(it != block.free_ranges.begin()) {
+            auto prev = std::prev(it);
+            if(prev->first + prev->second == it->first) {
+                prev->second += it->second;
+                block.free_ranges.erase(it);
+            }
+        }
+    }
+    
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties m_memory_props{};
+    VkDeviceSize m_preferred_block_size = DEFAULT_BLOCK_SIZE;
+    uint32_t m_max_allocation_count = std::numeric_limits<uint32_t>::max();
+    std::vector<std::unique_ptr<MemoryBlock>> m_blocks;
+};
+
+// How a render graph pass uses an image. The usage decides the stages, access and layout of its barriers.
+enum class RenderGraphUsage {
+    ColorAttachment,
+    DepthAttachment,
+    Sampled,
+    TransferSrc,
+    TransferDst,
+    Present
+};
+
+struct RenderGraphImageDesc {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent{};
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    VkImageUsageFlags usage = 0u;
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+};
+
+// Transient images of a compiled graph, taken out of it when frames in flight may still use them.
+struct RenderGraphTransients {
+    std::vector<VkImage> images;
+    std::vector<VkImageView> views;
+    std::vector<MemoryAllocation> memory;
+    
+    void destroy(VkDevice device, DeviceMemoryAllocator& allocator) {
+        for(VkImageView view : views) {
+            vkDestroyImageView(device, view, nullptr);
+        }
+        for(VkImage image : images) {
+            vkDestroyImage(device, image, nullptr);
+        }
+        for(MemoryAllocation& allocation : memory) {
+            allocator.free(allocation);
+        }
+        views.clear();
+        images.clear();
+        memory.clear();
+    }
+};
+
+// Passes declare the images they use and execute() records the barriers between them, one batch in front of a
+// pass at most and none between reads in the same layout. Transient images are created by compile(), the ones
+// used by disjoint ranges of passes share memory. Imported images (the swapchain) are bound before every execute().
+// Only images are tracked, buffers are still synchronized by hand.
+class RenderGraph final {
+public:
+    using ResourceId = uint32_t;
+    using RecordFunc = std::function<void(VkCommandBuffer)>;
+    static constexpr ResourceId INVALID_RESOURCE = std::numeric_limits<ResourceId>::max();
+    
+    struct Stats {
+        uint32_t transient_count = 0u;
+        uint32_t alias_slot_count = 0u;
+        VkDeviceSize transient_bytes = 0u; // peak transient memory of a frame, what the alias slots take
+        VkDeviceSize unaliased_bytes = 0u; // what a dedicated allocation per image would take
+        uint32_t barrier_batches = 0u;     // recorded by the last execute()
+        uint32_t barrier_count = 0u;
+    };
+    
+    // barrier2 - vkCmdPipelineBarrier2, null records the same barriers through vkCmdPipelineBarrier
+    void init(VkDevice device, DeviceMemoryAllocator& allocator, PFN_vkCmdPipelineBarrier2 barrier2) {
+        m_device = device;
+        m_allocator = &allocator;
+        m_pfnCmdPipelineBarrier2 = barrier2;
+    }
+    
+    // The transients have to be taken out or destroyed first.
+    void reset() {
+        m_resources.clear();
+        m_passes.clear();
+        m_slots.clear();
+        m_stats = Stats{};
+    }
+    
+    ResourceId addTransient(std::string name, const RenderGraphImageDesc& desc) {
+        Resource resource{};
+        resource.name = std::move(name);
+        resource.desc = desc;
+        m_resources.push_back(std::move(resource));
+        return static_cast<ResourceId>(m_resources.size() - 1u);
+    }
+    
+    // wait_stages - where the image becomes available in a frame, final_usage - what it is left in after the last pass
+    ResourceId addImported(std::string name, VkImageAspectFlags aspect, VkPipelineStageFlags2 wait_stages, std::optional<RenderGraphUsage> final_usage) {
+        Resource resource{};
+        resource.name = std::move(name);
+        resource.imported = true;
+        resource.desc.aspect = aspect;
+        resource.wait_stages = wait_stages;
+        resource.final_usage = final_usage;
+        m_resources.push_back(std::move(resource));
+        return static_cast<ResourceId>(m_resources.size() - 1u);
+    }
+    
+    // Passes run in the order they are added, every resource may appear once per pass.
+    void addPass(std::string name, std::vector<std::pair<ResourceId, RenderGraphUsage>> uses, RecordFunc record) {
+        m_passes.push_back({std::move(name), std::move(uses), std::move(record)});
+    }
+    
+    // find_memory_type - device local memory type index out of the type bits of an alias slot
+    void compile(const std::function<uint32_t(uint32_t)>& find_memory_type) {
+        for(uint32_t pass_index = 0u; pass_index < m_passes.size(); ++pass_index) {
+            for(const auto& [id, usage] : m_passes[pass_index].uses) {
+                Resource& resource = m_resources[id];
+                resource.first_pass = std::min(resource.first_pass, pass_index);
+                resource.last_pass = std::max(resource.last_pass, pass_index);
+            }
+        }
+        
+        std::vector<ResourceId> transients;
+        for(ResourceId id = 0u; id < m_resources.size(); ++id) {
+            Resource& resource = m_resources[id];
+            if(resource.imported) {
+                continue;
+            }
+            // an image no pass uses is still handed out, it lives for the whole frame
+            if(resource.first_pass == INVALID_RESOURCE) {
+                resource.first_pass = 0u;
+                resource.last_pass = static_cast<uint32_t>(m_passes.size());
+            }
+            createImage(resource);
+            transients.push_back(id);
+            m_stats.unaliased_bytes += resource.mem_req.size;
+        }
+        
+        // largest first, every image goes into the first slot of compatible memory it is not alive together with
+        std::stable_sort(transients.begin(), transients.end(), [this](ResourceId a, ResourceId b) {
+            return m_resources[a].mem_req.size > m_resources[b].mem_req.size;
+        });
+        for(ResourceId id : transients) {
+            Resource& resource = m_resources[id];
+            auto slot = std::find_if(m_slots.begin(), m_slots.end(), [this, &resource](const AliasSlot& s) {
+                return (s.memory_type_bits & resource.mem_req.memoryTypeBits) != 0u
+                    && std::none_of(s.resources.cbegin(), s.resources.cend(), [this, &resource](ResourceId other) { return overlaps(resource, m_resources[other]); });
+            });
+            if(slot == m_slots.end()) {
+                m_slots.emplace_back();
+                slot = std::prev(m_slots.end());
+                slot->memory_type_bits = resource.mem_req.memoryTypeBits;
+            }
+            slot->size = std::max(slot->size, resource.mem_req.size);
+            slot->alignment = std::max(slot->alignment, resource.mem_req.alignment);
+            slot->memory_type_bits &= resource.mem_req.memoryTypeBits;
+            slot->resources.push_back(id);
+            resource.slot = static_cast<uint32_t>(std::distance(m_slots.begin(), slot));
+        }
+        
+        for(AliasSlot& slot : m_slots) {
+            VkMemoryRequirements mem_req{};
+            mem_req.size = slot.size;
+            mem_req.alignment = slot.alignment;
+            mem_req.memoryTypeBits = slot.memory_type_bits;
+            slot.memory = m_allocator->allocate(mem_req, find_memory_type(slot.memory_type_bits), AllocationKind::Optimal);
+            for(ResourceId id : slot.resources) {
+                Resource& resource = m_resources[id];
+                vkBindImageMemory(m_device, resource.image, slot.memory.memory, slot.memory.offset);
+                createView(resource);
+            }
+            m_stats.transient_bytes += slot.size;
+        }
+        m_stats.transient_count = static_cast<uint32_t>(transients.size());
+        m_stats.alias_slot_count = static_cast<uint32_t>(m_slots.size());
+    }
+    
+    void setImported(ResourceId id, VkImage image, VkImageView view) {
+        m_resources[id].image = image;
+        m_resources[id].view = view;
+    }
+    
+    VkImage getImage(ResourceId id) const {
+        return m_resources[id].image;
+    }
+    
+    VkImageView getView(ResourceId id) const {
+        return m_resources[id].view;
+    }
+    
+    void execute(VkCommandBuffer command_buffer) {
+        m_stats.barrier_batches = 0u;
+        m_stats.barrier_count = 0u;
+        for(Resource& resource : m_resources) {
+            if(resource.imported) {
+                resource.state = ImageState{VK_IMAGE_LAYOUT_UNDEFINED, resource.wait_stages, VK_ACCESS_2_NONE, false};
+            }
+        }
+        
+        std::vector<VkImageMemoryBarrier2> barriers;
+        for(uint32_t pass_index = 0u; pass_index < m_passes.size(); ++pass_index) {
+            const Pass& pass = m_passes[pass_index];
+            barriers.clear();
+            for(const auto& [id, usage] : pass.uses) {
+                Resource& resource = m_resources[id];
+                if(!resource.imported && resource.first_pass == pass_index) {
+                    // contents are discarded, the wait is for whatever used the memory last, this frame or the previous one
+                    resource.state = m_slots[resource.slot].tail;
+                    resource.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                }
+                transition(barriers, resource, usage);
+            }
+            recordBarriers(command_buffer, barriers);
+            
+            pass.record(command_buffer);
+            
+            for(const auto& [id, usage] : pass.uses) {
+                const Resource& resource = m_resources[id];
+                if(!resource.imported) {
+                    m_slots[resource.slot].tail = resource.state;
+                }
+            }
+        }
+        
+        barriers.clear();
+        for(Resource& resource : m_resources) {
+            if(resource.imported && resource.final_usage.has_value()) {
+                transition(barriers, resource, resource.final_usage.value());
+            }
+        }
+        recordBarriers(command_buffer, barriers);
+    }
+    
+    RenderGraphTransients takeTransients() {
+        RenderGraphTransients transients;
+        for(Resource& resource : m_resources) {
+            if(resource.imported) {
+                continue;
+            }
+            transients.images.push_back(resource.image);
+            transients.views.push_back(resource.view);
+            resource.image = VK_NULL_HANDLE;
+            resource.view = VK_NULL_HANDLE;
+        }
+        for(AliasSlot& slot : m_slots) {
+            transients.memory.push_back(slot.memory);
+            slot.memory = MemoryAllocation{};
+        }
+        return transients;
+    }
+    
+    void destroy() {
+        takeTransients().destroy(m_device, *m_allocator);
+        reset();
+    }
+    
+    const Stats& getStats() const {
+        return m_stats;
+    }
+    
+private:
+    struct ImageState {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 access = VK_ACCESS_2_NONE;
+        bool write = false;
+    };
+    
+    struct Resource {
+        std::string name;
+        bool imported = false;
+        RenderGraphImageDesc desc{};
+        VkPipelineStageFlags2 wait_stages = VK_PIPELINE_STAGE_2_NONE;
+        std::optional<RenderGraphUsage> final_usage;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkMemoryRequirements mem_req{};
+        uint32_t slot = INVALID_RESOURCE;
+        uint32_t first_pass = INVALID_RESOURCE;
+        uint32_t last_pass = 0u;
+        ImageState state{};
+    };
+    
+    struct Pass {
+        std::string name;
+        std::vector<std::pair<ResourceId, RenderGraphUsage>> uses;
+        RecordFunc record;
+    };
+    
+    // Memory shared by transients that are never alive at once, tail is the state its last user left behind.
+    struct AliasSlot {
+        VkDeviceSize size = 0u;
+        VkDeviceSize alignment = 1u;
+        uint32_t memory_type_bits = 0u;
+        std::vector<ResourceId> resources;
+        MemoryAllocation memory;
+        ImageState tail{};
+    };
+    
+    static bool overlaps(const Resource& a, const Resource& b) {
+        return a.first_pass <= b.last_pass && b.first_pass <= a.last_pass;
+    }
+    
+    static ImageState getUsageState(RenderGraphUsage usage) {
+        switch(usage) {
+            case RenderGraphUsage::ColorAttachment:
+                return {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                        VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, true};
+            case RenderGraphUsage::DepthAttachment:
+                return {VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, true};
+            case RenderGraphUsage::Sampled:
+                return {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, false};
+            case RenderGraphUsage::TransferSrc:
+                return {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, false};
+            case RenderGraphUsage::TransferDst:
+                return {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, true};
+            case RenderGraphUsage::Present:
+                return {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, false};
+        }
+        return {};
+    }
+    
+    // Reads in the layout the image is already in only add their stages, later writes wait for all of them.
+    // Anything else gets a barrier, only writes have to be made available.
+    static void transition(std::vector<VkImageMemoryBarrier2>& barriers, Resource& resource, RenderGraphUsage usage) {
+        ImageState next = getUsageState(usage);
+        ImageState& state = resource.state;
+        if(state.layout == next.layout && !state.write && !next.write) {
+            state.stages |= next.stages;
+            state.access |= next.access;
+            return;
+        }
+        
+        VkImageMemoryBarrier2 barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        barrier.srcStageMask = state.stages;
+        barrier.srcAccessMask = state.write ? state.access : VK_ACCESS_2_NONE;
+        barrier.dstStageMask = next.stages;
+        barrier.dstAccessMask = next.access;
+        barrier.oldLayout = state.layout;
+        barrier.newLayout = next.layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = resource.image;
+        barrier.subresourceRange.aspectMask = resource.desc.aspect;
+        barrier.subresourceRange.baseMipLevel = 0u;
+        barrier.subresourceRange.levelCount = 1u;
+        barrier.subresourceRange.baseArrayLayer = 0u;
+        barrier.subresourceRange.layerCount = 1u;
+        barriers.push_back(barrier);
+        state = next;
+    }
+    
+    void recordBarriers(VkCommandBuffer command_buffer, const std::vector<VkImageMemoryBarrier2>& barriers) {
+        if(barriers.empty()) {
+            return;
+        }
+        ++m_stats.barrier_batches;
+        m_stats.barrier_count += static_cast<uint32_t>(barriers.size());
+        
+        if(m_pfnCmdPipelineBarrier2) {
+            VkDependencyInfo dependency_info{};
+            dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+            dependency_info.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+            dependency_info.pImageMemoryBarriers = barriers.data();
+            m_pfnCmdPipelineBarrier2(command_buffer, &dependency_info);
+            return;
+        }
+        
+        // the stage and access bits used by the graph have the same values in both flag types
+        VkPipelineStageFlags src_stages = 0u;
+        VkPipelineStageFlags dst_stages = 0u;
+        std::vector<VkImageMemoryBarrier> legacy_barriers(barriers.size());
+        for(size_t i = 0u; i < barriers.size(); ++i) {
+            src_stages |= static_cast<VkPipelineStageFlags>(barriers[i].srcStageMask);
+            dst_stages |= static_cast<VkPipelineStageFlags>(barriers[i].dstStageMask);
+            legacy_barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            legacy_barriers[i].srcAccessMask = static_cast<VkAccessFlags>(barriers[i].srcAccessMask);
+            legacy_barriers[i].dstAccessMask = static_cast<VkAccessFlags>(barriers[i].dstAccessMask);
+            legacy_barriers[i].oldLayout = barriers[i].oldLayout;
+            legacy_barriers[i].newLayout = barriers[i].newLayout;
+            legacy_barriers[i].srcQueueFamilyIndex = barriers[i].srcQueueFamilyIndex;
+            legacy_barriers[i].dstQueueFamilyIndex = barriers[i].dstQueueFamilyIndex;
+            legacy_barriers[i].image = barriers[i].image;
+            legacy_barriers[i].subresourceRange = barriers[i].subresourceRange;
+        }
+        vkCmdPipelineBarrier(
+            command_buffer,
+            src_stages ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            dst_stages ? dst_stages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0u, 0u, nullptr, 0u, nullptr, static_cast<uint32_t>(legacy_barriers.size()), legacy_barriers.data()
+        );
+    }
+    
+    void createImage(Resource& resource) {
+        VkImageCreateInfo image_info{};
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.extent.width = resource.desc.extent.width;
+        image_info.extent.height = resource.desc.extent.height;
+        image_info.extent.depth = 1u;
+        image_info.mipLevels = 1u;
+        image_info.arrayLayers = 1u;
+        image_info.format = resource.desc.format;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_info.usage = resource.desc.usage;
+        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_info.samples = resource.desc.samples;
+        image_info.flags = 0u;
+        VkResult result = vkCreateImage(m_device, &image_info, nullptr, &resource.image);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create render graph image " + resource.name + "!");
+        }
+        vkGetImageMemoryRequirements(m_device, resource.image, &resource.mem_req);
+    }
+    
+    void createView(Resource& resource) {
+        VkImageViewCreateInfo view_info{};
+        view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_info.image = resource.image;
+        view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format = resource.desc.format;
+        // barriers cover depth and stencil, the attachment view only the depth aspect
+        view_info.subresourceRange.aspectMask = (resource.desc.aspect & VK_IMAGE_ASPECT_DEPTH_BIT) ? static_cast<VkImageAspectFlags>(VK_IMAGE_ASPECT_DEPTH_BIT) : resource.desc.aspect;
+        view_info.subresourceRange.baseMipLevel = 0u;
+        view_info.subresourceRange.levelCount = 1u;
+        view_info.subresourceRange.baseArrayLayer = 0u;
+        view_info.subresourceRange.layerCount = 1u;
+        VkResult result = vkCreateImageView(m_device, &view_info, nullptr, &resource.view);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create render graph image view " + resource.name + "!");
+        }
+    }
+    
+    VkDevice m_device = VK_NULL_HANDLE;
+    DeviceMemoryAllocator* m_allocator = nullptr;
+    PFN_vkCmdPipelineBarrier2 m_pfnCmdPipelineBarrier2 = nullptr;
+    std::vector<Resource> m_resources;
+    std::vector<Pass> m_passes;
+    std::vector<AliasSlot> m_slots;
+    Stats m_stats{};
+};
+
+// Offset bookkeeping for a circular staging buffer. Head and tail are running byte counts, the
+// physical offset is their value modulo the capacity. Space handed out before markSubmitted(slot)
+// is reclaimed by release(slot) once the GPU work of that frame slot has finished.
+class RingAllocator final {
+public:
+    void init(VkDeviceSize capacity, uint32_t slots_count) {
+        m_capacity = capacity;
+        m_head = 0u;
+        m_tail = 0u;
+        m_slot_marks.assign(slots_count, std::nullopt);
+    }
+    
+    std::optional<VkDeviceSize> allocate(VkDeviceSize size, VkDeviceSize alignment) {
+        if(size > m_capacity) {
+            return std::nullopt;
+        }
+        
+        VkDeviceSize head_offset = m_head % m_capacity;
+        VkDeviceSize offset = alignment > 1u ? (head_offset + alignment - 1u) / alignment * alignment : head_offset;
+        VkDeviceSize padding = offset - head_offset;
+        if(offset + size > m_capacity) {
+            // does not fit before the end of the buffer, skip the remainder and start over at zero
+            padding = m_capacity - head_offset;
+            offset = 0u;
+        }
+        if(m_head + padding + size - m_tail > m_capacity) {
+            return std::nullopt;
+        }
+        
+        m_head += padding + size;
+        return offset;
+    }
+    
+    void markSubmitted(uint32_t slot) {
+        m_slot_marks[slot] = m_head;
+    }
+    
+    void release(uint32_t slot) {
+        if(m_slot_marks[slot].has_value()) {
+            m_tail = std::max(m_tail, m_slot_marks[slot].value());
+            m_slot_marks[slot].reset();
+        }
+    }
+    
+    // Only valid once the device is idle.
+    void reset() {
+        m_tail = m_head;
+        std::fill(m_slot_marks.begin(), m_slot_marks.end(), std::nullopt);
+    }
+    
+    VkDeviceSize usedBytes() const {
+        return m_head - m_tail;
+    }
+    
+private:
+    VkDeviceSize m_capacity = 0u;
+    VkDeviceSize m_head = 0u;
+    VkDeviceSize m_tail = 0u;
+    std::vector<std::optional<VkDeviceSize>> m_slot_marks;
+};
+
+// Linear allocator over a persistently mapped uniform buffer with one region per frame slot. Blocks are
+// aligned to minUniformBufferOffsetAlignment so their offsets can be passed as dynamic offsets, a region
+// is rewound by beginFrame once the fence of its slot has signaled.
+class UniformArena final {
+public:
+    void init(void* mapped, VkDeviceSize region_size, VkDeviceSize alignment, uint32_t slots_count) {
+        m_mapped = static_cast<uint8_t*>(mapped);
+        m_alignment = std::max<VkDeviceSize>(alignment, 1u);
+        m_region_size = alignUp(region_size);
+        m_slots_count = slots_count;
+        beginFrame(0u);
+    }
+    
+    // Space a block takes in a region, region sizes are sums of these.
+    static VkDeviceSize alignedSize(VkDeviceSize size, VkDeviceSize alignment) {
+        alignment = std::max<VkDeviceSize>(alignment, 1u);
+        return (size + alignment - 1u) / alignment * alignment;
+    }
+    
+    VkDeviceSize regionSize() const {
+        return m_region_size;
+    }
+    
+    void beginFrame(uint32_t slot) {
+        m_head = m_region_size * slot;
+        m_end = m_head + m_region_size;
+    }
+    
+    // Copies the block into the region of the current frame and returns its offset in the buffer.
+    uint32_t push(const void* data, VkDeviceSize size) {
+        if(m_head + size > m_end) {
+            throw std::runtime_error("uniform arena region is full!");
+        }
+        uint32_t offset = static_cast<uint32_t>(m_head);
+        memcpy(m_mapped + m_head, data, size);
+        m_head = alignUp(m_head + size);
+        return offset;
+    }
+    
+    template<typename T>
+    uint32_t push(const T& block) {
+        return push(&block, sizeof(T));
+    }
+    
+    VkDeviceSize usedBytes() const {
+        return m_head - (m_end - m_region_size);
+    }
+    
+private:
+    VkDeviceSize alignUp(VkDeviceSize value) const {
+        return alignedSize(value, m_alignment);
+    }
+    
+    uint8_t* m_mapped = nullptr;
+    VkDeviceSize m_alignment = 1u;
+    VkDeviceSize m_region_size = 0u;
+    uint32_t m_slots_count = 0u;
+    VkDeviceSize m_head = 0u;
+    VkDeviceSize m_end = 0u;
+};
+
+// Descriptor set layouts keyed by flags and bindings. Equal descriptions share one layout, the layouts
+// live until the cache is destroyed. Immutable samplers are not part of the key and are rejected.
+class DescriptorLayoutCache final {
+public:
+    VkDescriptorSetLayout get(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding>& bindings, const std::vector<VkDescriptorBindingFlags>& binding_flags, VkDescriptorSetLayoutCreateFlags flags) {
+        if(!binding_flags.empty() && binding_flags.size() != bindings.size()) {
+            throw std::invalid_argument("descriptor binding flags do not match the bindings");
+        }
+        
+        LayoutKey key;
+        key.flags = flags;
+        key.bindings.reserve(bindings.size());
+        for(size_t i = 0u; i < bindings.size(); ++i) {
+            if(bindings[i].pImmutableSamplers != nullptr) {
+                throw std::invalid_argument("immutable samplers can not be cached");
+            }
+            key.bindings.push_back({bindings[i].binding, bindings[i].descriptorType, bindings[i].descriptorCount, bindings[i].stageFlags, binding_flags.empty() ? 0u : binding_flags[i]});
+        }
+        // binding order does not change the layout
+        std::sort(key.bindings.begin(), key.bindings.end(), [](const BindingKey& a, const BindingKey& b) { return a.binding < b.binding; });
+        
+        std::vector<std::pair<LayoutKey, VkDescriptorSetLayout>>& bucket = m_layouts[hash(key)];
+        for(const auto& [cached_key, layout] : bucket) {
+            if(cached_key == key) {
+                return layout;
+            }
+        }
+        
+        VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info{};
+        binding_flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        binding_flags_info.bindingCount = static_cast<uint32_t>(binding_flags.size());
+        binding_flags_info.pBindingFlags = binding_flags.data();
+        
+        VkDescriptorSetLayoutCreateInfo layout_info{};
+        layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layout_info.pNext = binding_flags.empty() ? nullptr : &binding_flags_info;
+        layout_info.flags = flags;
+        layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+        layout_info.pBindings = bindings.data();
+        
+        VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+        VkResult result = vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &layout);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor set layout!");
+        }
+        bucket.emplace_back(std::move(key), layout);
+        ++m_size;
+        return layout;
+    }
+    
+    size_t size() const {
+        return m_size;
+    }
+    
+    void destroy(VkDevice device) {
+        for(const auto& [key_hash, bucket] : m_layouts) {
+            for(const auto& [key, layout] : bucket) {
+                vkDestroyDescriptorSetLayout(device, layout, nullptr);
+            }
+        }
+        m_layouts.clear();
+        m_size = 0u;
+    }
+    
+private:
+    struct BindingKey {
+        uint32_t binding;
+        VkDescriptorType type;
+        uint32_t count;
+        VkShaderStageFlags stages;
+        VkDescriptorBindingFlags flags;
+        
+        bool operator==(const BindingKey&) const = default;
+    };
+    
+    struct LayoutKey {
+        VkDescriptorSetLayoutCreateFlags flags = 0u;
+        std::vector<BindingKey> bindings;
+        
+        bool operator==(const LayoutKey&) const = default;
+    };
+    
+    static uint64_t hash(const LayoutKey& key) {
+        // FNV-1a over the fields, the bucket still compares the full keys
+        uint64_t value = 0xcbf29ce484222325ull;
+        auto mix = [&value](uint64_t field) {
+            value ^= field;
+            value *= 0x100000001b3ull;
+        };
+        mix(key.flags);
+        for(const BindingKey& binding : key.bindings) {
+            mix(binding.binding);
+            mix(static_cast<uint64_t>(binding.type));
+            mix(binding.count);
+            mix(binding.stages);
+            mix(binding.flags);
+        }
+        return value;
+    }
+    
+    std::unordered_map<uint64_t, std::vector<std::pair<LayoutKey, VkDescriptorSetLayout>>> m_layouts;
+    size_t m_size = 0u;
+};
+
+// Hands out descriptor sets that live for one frame slot. A slot keeps the pools it allocated from and
+// returns them to the shared free list in resetFrame, which may only be called once the fence of that
+// slot has signaled. When no free pool is left a new one is created, each twice the size of the last.
+class DescriptorAllocator final {
+public:
+    static constexpr uint32_t INITIAL_POOL_SETS = 8u;
+    static constexpr uint32_t MAX_POOL_SETS = 512u;
+    
+    // sizes_per_set is the descriptor mix of an average set, pools hold it times their set count
+    void init(VkDevice device, uint32_t slots_count, std::vector<VkDescriptorPoolSize> sizes_per_set, VkDescriptorPoolCreateFlags flags) {
+        m_device = device;
+        m_sizes_per_set = std::move(sizes_per_set);
+        m_flags = flags;
+        m_next_pool_sets = INITIAL_POOL_SETS;
+        m_slots.assign(slots_count, Slot{});
+    }
+    
+    void resetFrame(uint32_t slot) {
+        Slot& frame = m_slots[slot];
+        for(VkDescriptorPool pool : frame.pools) {
+            vkResetDescriptorPool(m_device, pool, 0u);
+            m_free_pools.push_back(pool);
+        }
+        frame.pools.clear();
+        frame.sets_count = 0u;
+    }
+    
+    VkDescriptorSet allocate(uint32_t slot, VkDescriptorSetLayout layout) {
+        Slot& frame = m_slots[slot];
+        VkDescriptorSetAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        alloc_info.descriptorSetCount = 1u;
+        alloc_info.pSetLayouts = &layout;
+        
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        VkResult result = VK_ERROR_OUT_OF_POOL_MEMORY;
+        if(!frame.pools.empty()) {
+            alloc_info.descriptorPool = frame.pools.back();
+            result = vkAllocateDescriptorSets(m_device, &alloc_info, &set);
+        }
+        if(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+            // the current pool stays with the slot until its reset, the next one is fresh
+            frame.pools.push_back(takePool());
+            alloc_info.descriptorPool = frame.pools.back();
+            result = vkAllocateDescriptorSets(m_device, &alloc_info, &set);
+        }
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor set!");
+        }
+        ++frame.sets_count;
+        return set;
+    }
+    
+    uint32_t poolCount() const {
+        return m_pool_count;
+    }
+    
+    void destroy() {
+        for(Slot& frame : m_slots) {
+            m_free_pools.insert(m_free_pools.end(), frame.pools.begin(), frame.pools.end());
+            frame.pools.clear();
+        }
+        for(VkDescriptorPool pool : m_free_pools) {
+            vkDestroyDescriptorPool(m_device, pool, nullptr);
+        }
+        m_free_pools.clear();
+        m_pool_count = 0u;
+    }
+    
+private:
+    struct Slot {
+        std::vector<VkDescriptorPool> pools;
+        uint32_t sets_count = 0u;
+    };
+    
+    VkDescriptorPool takePool() {
+        if(!m_free_pools.empty()) {
+            VkDescriptorPool pool = m_free_pools.back();
+            m_free_pools.pop_back();
+            return pool;
+        }
+        
+        std::vector<VkDescriptorPoolSize> pool_sizes = m_sizes_per_set;
+        for(VkDescriptorPoolSize& pool_size : pool_sizes) {
+            pool_size.descriptorCount *= m_next_pool_sets;
+        }
+        VkDescriptorPoolCreateInfo pool_info{};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.flags = m_flags;
+        pool_info.maxSets = m_next_pool_sets;
+        pool_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
+        pool_info.pPoolSizes = pool_sizes.data();
+        
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        VkResult result = vkCreateDescriptorPool(m_device, &pool_info, nullptr, &pool);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
+        }
+        m_next_pool_sets = std::min(m_next_pool_sets * 2u, MAX_POOL_SETS);
+        ++m_pool_count;
+        return pool;
+    }
+    
+    VkDevice m_device = VK_NULL_HANDLE;
+    std::vector<VkDescriptorPoolSize> m_sizes_per_set;
+    VkDescriptorPoolCreateFlags m_flags = 0u;
+    uint32_t m_next_pool_sets = INITIAL_POOL_SETS;
+    uint32_t m_pool_count = 0u;
+    std::vector<Slot> m_slots;
+    std::vector<VkDescriptorPool> m_free_pools;
+};
+
+// Core 1.1 or VK_KHR_descriptor_update_template entry points, all null when neither is available.
+struct DescriptorTemplateFunctions {
+    PFN_vkCreateDescriptorUpdateTemplate create = nullptr;
+    PFN_vkDestroyDescriptorUpdateTemplate destroy = nullptr;
+    PFN_vkUpdateDescriptorSetWithTemplate update = nullptr;
+};
+
+// Writes sets of one layout from a block of VkDescriptorBufferInfo and VkDescriptorImageInfo described by
+// the entries. With an update template the driver reads the block directly, without one the entries are
+// expanded into VkWriteDescriptorSet's pointing into the block.
+class DescriptorWriter final {
+public:
+    void init(VkDevice device, const DescriptorTemplateFunctions& functions, VkDescriptorSetLayout layout, std::vector<VkDescriptorUpdateTemplateEntry> entries) {
+        m_functions = functions;
+        m_entries = std::move(entries);
+        if(m_functions.update == nullptr) {
+            return;
+        }
+        
+        VkDescriptorUpdateTemplateCreateInfo template_info{};
+        template_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+        template_info.descriptorUpdateEntryCount = static_cast<uint32_t>(m_entries.size());
+        template_info.pDescriptorUpdateEntries = m_entries.data();
+        template_info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+        template_info.descriptorSetLayout = layout;
+        VkResult result = m_functions.create(device, &template_info, nullptr, &m_template);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor update template!");
+        }
+    }
+    
+    void update(VkDevice device, VkDescriptorSet set, const void* data) {
+        if(m_template != VK_NULL_HANDLE) {
+            m_functions.update(device, set, m_template, data);
+            return;
+        }
+        
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        m_writes.clear();
+        for(const VkDescriptorUpdateTemplateEntry& entry : m_entries) {
+            bool is_image = entry.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER || entry.descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+                         || entry.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE || entry.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                         || entry.descriptorType == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            size_t info_size = is_image ? sizeof(VkDescriptorImageInfo) : sizeof(VkDescriptorBufferInfo);
+            // a tightly packed array is one write, anything else one write per element
+            uint32_t elements_per_write = entry.stride == info_size ? entry.descriptorCount : 1u;
+            for(uint32_t element = 0u; element < entry.descriptorCount; element += elements_per_write) {
+                const uint8_t* info = bytes + entry.offset + element * entry.stride;
+                VkWriteDescriptorSet write{};
+                write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                write.dstSet = set;
+                write.dstBinding = entry.dstBinding;
+                write.dstArrayElement = entry.dstArrayElement + element;
+                write.descriptorType = entry.descriptorType;
+                write.descriptorCount = elements_per_write;
+                write.pImageInfo = is_image ? reinterpret_cast<const VkDescriptorImageInfo*>(info) : nullptr;
+                write.pBufferInfo = is_image ? nullptr : reinterpret_cast<const VkDescriptorBufferInfo*>(info);
+                m_writes.push_back(write);
+            }
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(m_writes.size()), m_writes.data(), 0u, nullptr);
+    }
+    
+    bool usesTemplate() const {
+        return m_template != VK_NULL_HANDLE;
+    }
+    
+    void destroy(VkDevice device) {
+        if(m_template != VK_NULL_HANDLE) {
+            m_functions.destroy(device, m_template, nullptr);
+            m_template = VK_NULL_HANDLE;
+        }
+        m_entries.clear();
+    }
+    
+private:
+    DescriptorTemplateFunctions m_functions;
+    std::vector<VkDescriptorUpdateTemplateEntry> m_entries;
+    VkDescriptorUpdateTemplate m_template = VK_NULL_HANDLE;
+    std::vector<VkWriteDescriptorSet> m_writes;
+};
+
+struct PipelineCacheStats {
+    uint32_t hits = 0u;
+    uint32_t misses = 0u;
+    uint32_t unclassified = 0u; // created without creation feedback
+    double hit_ms = 0.0;
+    double miss_ms = 0.0;
+    double unclassified_ms = 0.0;
+};
+
+// VkPipelineCache backed by a file. The file is only used when its header matches the
+// current device, and is replaced atomically (write to a temporary, then rename) on save().
+class PipelineCache final {
+public:
+    void init(VkDevice device, VkPhysicalDevice physical_device, const std::string& path) {
+        m_path = path;
+        
+        VkPhysicalDeviceProperties device_props{};
+        vkGetPhysicalDeviceProperties(physical_device, &device_props);
+        
+        std::vector<char> data;
+        if(!m_path.empty() && std::filesystem::exists(m_path)) {
+            data = readFile(m_path);
+            std::string reason = validate(data, device_props);
+            if(!reason.empty()) {
+                std::cout << "pipeline cache: ignoring " << m_path << " (" << reason << ")" << std::endl;
+                data.clear();
+            }
+        }
+        m_loaded_bytes = data.size();
+        
+        VkPipelineCacheCreateInfo cache_info{};
+        cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cache_info.initialDataSize = data.size();
+        cache_info.pInitialData = data.empty() ? nullptr : data.data();
+        
+        VkResult result = vkCreatePipelineCache(device, &cache_info, nullptr, &m_cache);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+        std::cout << "pipeline cache: " << (m_loaded_bytes ? "loaded " + std::to_string(m_loaded_bytes) + " bytes from " + m_path : std::string("starting empty")) << std::endl;
+    }
+    
+    void save(VkDevice device) {
+        if(m_cache == VK_NULL_HANDLE || m_path.empty()) {
+            return;
+        }
+        size_t data_size = 0u;
+        VkResult result = vkGetPipelineCacheData(device, m_cache, &data_size, nullptr);
+        if(result != VK_SUCCESS || data_size == 0u) {
+            return;
+        }
+        std::vector<char> data(data_size);
+        result = vkGetPipelineCacheData(device, m_cache, &data_size, data.data());
+        if(result != VK_SUCCESS) {
+            return;
+        }
+        
+        std::string tmp_path = m_path + ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+            if(!file.is_open()) {
+                std::cout << "pipeline cache: failed to write " << tmp_path << std::endl;
+                return;
+            }
+            file.write(data.data(), static_cast<std::streamsize>(data_size));
+            if(!file) {
+                std::cout << "pipeline cache: failed to write " << tmp_path << std::endl;
+                return;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(tmp_path, m_path, error);
+        if(error) {
+            std::cout << "pipeline cache: failed to replace " << m_path << ": " << error.message() << std::endl;
+            std::filesystem::remove(tmp_path, error);
+        }
+    }
+    
+    void destroy(VkDevice device) {
+        if(m_cache != VK_NULL_HANDLE) {
+            vkDestroyPipelineCache(device, m_cache, nullptr);
+            m_cache = VK_NULL_HANDLE;
+        }
+    }
+    
+    VkPipelineCache get() const {
+        return m_cache;
+    }
+    
+    size_t loadedBytes() const {
+        return m_loaded_bytes;
+    }
+    
+    // hit is empty when the driver gave no creation feedback for the pipeline
+    void recordCreation(double ms, std::optional<bool> hit) {
+        if(!hit.has_value()) {
+            ++m_stats.unclassified;
+            m_stats.unclassified_ms += ms;
+        }
+        else if(hit.value()) {
+            ++m_stats.hits;
+            m_stats.hit_ms += ms;
+        }
+        else {
+            ++m_stats.misses;
+            m_stats.miss_ms += ms;
+        }
+    }
+    
+    const PipelineCacheStats& getStats() const {
+        return m_stats;
+    }
+    
+private:
+    static std::string validate(const std::vector<char>& data, const VkPhysicalDeviceProperties& device_props) {
+        VkPipelineCacheHeaderVersionOne header{};
+        if(data.size() < sizeof(header)) {
+            return "file too small";
+        }
+        memcpy(&header, data.data(), sizeof(header));
+        if(header.headerSize < sizeof(header) || header.headerSize > data.size()) {
+            return "bad header size";
+        }
+        if(header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+            return "unknown header version";
+        }
+        if(header.vendorID != device_props.vendorID || header.deviceID != device_props.deviceID) {
+            return "different device";
+        }
+        if(memcmp(header.pipelineCacheUUID, device_props.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            return "different driver";
+        }
+        return std::string();
+    }
+    
+    std::string m_path;
+    VkPipelineCache m_cache = VK_NULL_HANDLE;
+    size_t m_loaded_bytes = 0u;
+    PipelineCacheStats m_stats;
+};
+
+// A pipeline created away from the thread that owns the stats, recorded into PipelineCache once it is handed over.
+struct PipelineCreation {
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    double ms = 0.0;
+    std::optional<bool> cache_hit; // empty without creation feedback
+};
+
+struct ShaderBinary {
+    std::vector<uint32_t> code; // empty - nothing usable, see error
+    const char* origin = "none"; // "compiled", "cache" or "prebuilt"
+    double ms = 0.0;
+    std::string error; // compiler messages, also kept when the prebuilt binary stood in
+};
+
+// Compiles GLSL to SPIR-V through shaderc. Results are stored in the cache directory under a hash of the source
+// text, the stage and the compiler version, so an unchanged shader is compiled once across runs and an edited one
+// never picks up a stale binary. compile() only reads members and may run on any thread.
+class ShaderCompiler final {
+public:
+    void init(const std::string& cache_dir) {
+        m_cache_dir = cache_dir;
+        if(!m_cache_dir.empty()) {
+            std::error_code error;
+            std::filesystem::create_directories(m_cache_dir, error);
+            if(error) {
+                std::cout << "shader cache: failed to create " << cache_dir << ": " << error.message() << std::endl;
+                m_cache_dir.clear();
+            }
+        }
+    }
+    
+    static bool isAvailable() {
+        return VKSAMPLE_SHADERC != 0;
+    }
+    
+    // The prebuilt spv_path stands in when there is no compiler or glsl_path does not compile.
+    ShaderBinary load(const std::string& glsl_path, const std::string& spv_path) const {
+        ShaderBinary binary;
+        if(isAvailable() && std::filesystem::exists(glsl_path)) {
+            binary = compile(glsl_path);
+            if(!binary.code.empty()) {
+                return binary;
+            }
+            if(!std::filesystem::exists(spv_path)) {
+                throw std::runtime_error("failed to compile " + glsl_path + ":\n" + binary.error);
+            }
+        }
+        
+        auto load_start = std::chrono::high_resolution_clock::now();
+        std::vector<char> bytes = readFile(spv_path);
+        if(!isSpirv(bytes)) {
+            throw std::runtime_error("not a SPIR-V binary: " + spv_path + "\n");
+        }
+        binary.code.resize(bytes.size() / sizeof(uint32_t));
+        memcpy(binary.code.data(), bytes.data(), bytes.size());
+        binary.origin = "prebuilt";
+        binary.ms = elapsedMs(load_start, std::chrono::high_resolution_clock::now());
+        return binary;
+    }
+    
+    ShaderBinary compile(const std::string& glsl_path) const {
+        ShaderBinary binary;
+#if VKSAMPLE_SHADERC
+        auto compile_start = std::chrono::high_resolution_clock::now();
+        std::optional<shaderc_shader_kind> kind = getShaderKind(glsl_path);
+        if(!kind.has_value()) {
+            binary.error = "unknown shader stage: " + glsl_path + "\n";
+            return binary;
+        }
+        std::vector<char> source;
+        try {
+            source = readFile(glsl_path);
+        }
+        catch(const std::exception& e) {
+            binary.error = e.what();
+            return binary;
+        }
+        
+        std::filesystem::path cache_file;
+        if(!m_cache_dir.empty()) {
+            uint64_t key = hashSource(source, kind.value());
+            std::string key_hex(16u, '0');
+            for(size_t i = 0u; i < key_hex.size(); ++i) {
+                key_hex[key_hex.size() - 1u - i] = "0123456789abcdef"[(key >> (4u * i)) & 0xfu];
+            }
+            cache_file = m_cache_dir / (std::filesystem::path(glsl_path).filename().string() + "." + key_hex + ".spv");
+            if(readCache(cache_file, binary.code)) {
+                binary.origin = "cache";
+                binary.ms = elapsedMs(compile_start, std::chrono::high_resolution_clock::now());
+                return binary;
+            }
+        }
+        
+        shaderc::Compiler compiler;
+        shaderc::CompileOptions options;
+        options.SetSourceLanguage(shaderc_source_language_glsl);
+        shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source.data(), source.size(), kind.value(), glsl_path.c_str(), "main", options);
+        if(result.GetCompilationStatus() != shaderc_compilation_status_success) {
+            binary.error = result.GetErrorMessage();
+            return binary;
+        }
+        binary.code.assign(result.cbegin(), result.cend());
+        binary.origin = "compiled";
+        binary.ms = elapsedMs(compile_start, std::chrono::high_resolution_clock::now());
+        if(!cache_file.empty()) {
+            writeCache(cache_file, binary.code);
+        }
+#else
+        binary.error = "built without shaderc, cannot compile " + glsl_path + "\n";
+#endif
+        return binary;
+    }
+    
+private:
+    static bool isSpirv(const std::vector<char>& bytes) {
+        const uint32_t SPIRV_MAGIC = 0x07230203u;
+        const size_t SPIRV_HEADER_SIZE = 5u * sizeof(uint32_t);
+        uint32_t magic = 0u;
+        if(bytes.size() < SPIRV_HEADER_SIZE || bytes.size() % sizeof(uint32_t) != 0u) {
+            return false;
+        }
+        memcpy(&magic, bytes.data(), sizeof(magic));
+        return magic == SPIRV_MAGIC;
+    }
+    
+    // false - no entry or not a usable one, the source is compiled again
+    static bool readCache(const std::filesystem::path& cache_file, std::vector<uint32_t>& code) {
+        std::ifstream file(cache_file, std::ios::ate | std::ios::binary);
+        if(!file.is_open()) {
+            return false;
+        }
+        std::vector<char> bytes(static_cast<size_t>(file.tellg()));
+        file.seekg(0u);
+        file.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if(!file || !isSpirv(bytes)) {
+            return false;
+        }
+        code.resize(bytes.size() / sizeof(uint32_t));
+        memcpy(code.data(), bytes.data(), bytes.size());
+        return true;
+    }
+    
+    // written aside and renamed, so a reader never sees half a binary
+    static void writeCache(const std::filesystem::path& cache_file, const std::vector<uint32_t>& code) {
+        std::filesystem::path tmp_path = cache_file;
+        tmp_path += ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(code.data()), static_cast<std::streamsize>(code.size() * sizeof(uint32_t)));
+            if(!file) {
+                std::cout << "shader cache: failed to write " << tmp_path.string() << std::endl;
+                return;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(tmp_path, cache_file, error);
+        if(error) {
+            std::cout << "shader cache: failed to replace " << cache_file.string() << ": " << error.message() << std::endl;
+            std::filesystem::remove(tmp_path, error);
+        }
+    }
+    
+#if VKSAMPLE_SHADERC
+    static std::optional<shaderc_shader_kind> getShaderKind(const std::string& glsl_path) {
+        std::string extension = std::filesystem::path(glsl_path).extension().string();
+        if(extension == ".vert") {
+            return shaderc_vertex_shader;
+        }
+        if(extension == ".frag") {
+            return shaderc_fragment_shader;
+        }
+        if(extension == ".comp") {
+            return shaderc_compute_shader;
+        }
+        return std::nullopt;
+    }
+    
+    static uint64_t hashSource(const std::vector<char>& source, shaderc_shader_kind kind) {
+        // bumped when the compile options change, binaries cached with the old ones are not looked up again
+        const uint64_t OPTIONS_REVISION = 1u;
+        unsigned int spv_version = 0u;
+        unsigned int spv_revision = 0u;
+        shaderc_get_spv_version(&spv_version, &spv_revision);
+        
+        // FNV-1a over the source bytes and everything else that changes the output
+        uint64_t value = 0xcbf29ce484222325ull;
+        auto mix = [&value](uint64_t field) {
+            value ^= field;
+            value *= 0x100000001b3ull;
+        };
+        for(char c : source) {
+            mix(static_cast<uint8_t>(c));
+        }
+        mix(static_cast<uint64_t>(kind));
+        mix(spv_version);
+        mix(spv_revision);
+        mix(OPTIONS_REVISION);
+        return value;
+    }
+#endif
+    
+    std::filesystem::path m_cache_dir;
+};
+
+// What the shader watcher hands back for one changed source: the new module and the pipelines built from it.
+struct ShaderReload {
+    size_t file_index = 0u;
+    uint64_t scene_generation = 0u; // scene pipeline description the pipelines were built against
+    ShaderBinary binary;
+    VkShaderModule module = VK_NULL_HANDLE; // null - the reload failed, see error
+    std::vector<PipelineCreation> pipelines;
+    double build_ms = 0.0; // compile and pipeline creation
+    std::string error;
+};
+
+// Polls the modification times of the shader sources on a thread of its own and runs the rebuild job of each
+// file that changed there, so neither the compile nor the pipeline creation holds up the frame loop. Finished
+// rebuilds come back from takeFinished(), which never blocks.
+class ShaderWatcher final {
+public:
+    using RebuildFunc = std::function<ShaderReload(size_t file_index)>;
+    
+    void init(std::vector<std::string> file_names, RebuildFunc rebuild) {
+        m_file_names = std::move(file_names);
+        m_rebuild = std::move(rebuild);
+        for(const std::string& file_name : m_file_names) {
+            m_write_times.push_back(getWriteTime(file_name));
+        }
+        m_thread = std::thread(&ShaderWatcher::watchLoop, this);
+    }
+    
+    // A rebuild that is running is finished first.
+    void destroy() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        if(m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+    
+    bool isRunning() const {
+        return m_thread.joinable();
+    }
+    
+    // Waits for the running rebuild and keeps new ones from starting while the lock is held. Whatever the rebuild
+    // job reads from its owner may only change under it.
+    std::unique_lock<std::mutex> pause() {
+        return std::unique_lock<std::mutex>(m_rebuild_mutex);
+    }
+    
+    // Rebuilds the file again on the next poll even though it has not changed.
+    void requeue(size_t file_index) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_requeued.push_back(file_index);
+        }
+        m_wake.notify_one();
+    }
+    
+    std::vector<ShaderReload> takeFinished() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<ShaderReload> finished = std::move(m_finished);
+        m_finished.clear();
+        return finished;
+    }
+    
+private:
+    // min - the file is missing, as it may be for a moment while an editor replaces it
+    static std::filesystem::file_time_type getWriteTime(const std::string& file_name) {
+        std::error_code error;
+        std::filesystem::file_time_type time = std::filesystem::last_write_time(file_name, error);
+        return error ? std::filesystem::file_time_type::min() : time;
+    }
+    
+    void watchLoop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(true) {
+            m_wake.wait_for(lock, SHADER_POLL_INTERVAL, [this]() { return m_stop || !m_requeued.empty(); });
+            if(m_stop) {
+                return;
+            }
+            std::vector<size_t> changed = std::move(m_requeued);
+            m_requeued.clear();
+            lock.unlock();
+            
+            for(size_t i = 0u; i < m_file_names.size(); ++i) {
+                std::filesystem::file_time_type time = getWriteTime(m_file_names[i]);
+                if(time != m_write_times[i] && time != std::filesystem::file_time_type::min()) {
+                    m_write_times[i] = time;
+                    if(std::find(changed.begin(), changed.end(), i) == changed.end()) {
+                        changed.push_back(i);
+                    }
+                }
+            }
+            for(size_t file_index : changed) {
+                ShaderReload reload;
+                {
+                    std::lock_guard<std::mutex> rebuild_lock(m_rebuild_mutex);
+                    reload = m_rebuild(file_index);
+                }
+                std::lock_guard<std::mutex> finished_lock(m_mutex);
+                m_finished.push_back(std::move(reload));
+            }
+            
+            lock.lock();
+        }
+    }
+    
+    std::vector<std::string> m_file_names;
+    std::vector<std::filesystem::file_time_type> m_write_times; // only touched by the watcher thread
+    RebuildFunc m_rebuild;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::mutex m_rebuild_mutex; // held while a rebuild job runs
+    std::condition_variable m_wake;
+    std::vector<size_t> m_requeued;
+    std::vector<ShaderReload> m_finished;
+    bool m_stop = false;
+};
+
+// Worker threads that record secondary command buffers for the current frame. Each worker owns one
+// command pool per frame in flight, so a pool is only reset after the fence of its frame has signaled.
+class RecordWorkers final {
+public:
+    using Job = std::function<void(uint32_t thread_index, VkCommandBuffer command_buffer)>;
+    
+    void init(VkDevice device, uint32_t queue_family_index, uint32_t threads_count, uint32_t frames_count) {
+        m_device = device;
+        m_workers.resize(threads_count);
+        for(Worker& worker : m_workers) {
+            worker.command_pools.resize(frames_count);
+            worker.command_buffers.resize(frames_count);
+            for(uint32_t frame = 0u; frame < frames_count; ++frame) {
+                VkCommandPoolCreateInfo pool_info{};
+                pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+                pool_info.queueFamilyIndex = queue_family_index;
+                VkResult result = vkCreateCommandPool(device, &pool_info, nullptr, &worker.command_pools[frame]);
+                if(result != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create worker command pool!");
+                }
+                
+                VkCommandBufferAllocateInfo alloc_info{};
+                alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                alloc_info.commandPool = worker.command_pools[frame];
+                alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                alloc_info.commandBufferCount = 1u;
+                result = vkAllocateCommandBuffers(device, &alloc_info, &worker.command_buffers[frame]);
+                if(result != VK_SUCCESS) {
+                    throw std::runtime_error("failed to allocate secondary command buffer!");
+                }
+            }
+        }
+        m_recorded.resize(threads_count);
+        for(uint32_t i = 0u; i < threads_count; ++i) {
+            m_workers[i].thread = std::thread(&RecordWorkers::workerLoop, this, i);
+        }
+    }
+    
+    void destroy() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_job_ready.notify_all();
+        for(Worker& worker : m_workers) {
+            if(worker.thread.joinable()) {
+                worker.thread.join();
+            }
+            for(VkCommandPool command_pool : worker.command_pools) {
+                vkDestroyCommandPool(m_device, command_pool, nullptr);
+            }
+        }
+        m_workers.clear();
+    }
+    
+    uint32_t threadCount() const {
+        return static_cast<uint32_t>(m_workers.size());
+    }
+    
+    // Every worker resets its pool for the frame, begins its secondary buffer with the given inheritance,
+    // runs the job and ends the buffer. Blocks until all workers are done and returns the buffers in thread order.
+    const std::vector<VkCommandBuffer>& record(uint32_t frame, const VkCommandBufferInheritanceInfo& inheritance, const Job& job) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = &job;
+            m_inheritance = &inheritance;
+            m_frame = frame;
+            m_remaining = threadCount();
+            m_error = nullptr;
+            ++m_generation;
+        }
+        m_job_ready.notify_all();
+        
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_job_done.wait(lock, [this]() { return m_remaining == 0u; });
+        m_job = nullptr;
+        if(m_error) {
+            std::rethrow_exception(m_error);
+        }
+        return m_recorded;
+    }
+    
+private:
+    struct Worker {
+        std::thread thread;
+        std::vector<VkCommandPool> command_pools;
+        std::vector<VkCommandBuffer> command_buffers;
+    };
+    
+    void workerLoop(uint32_t thread_index) {
+        uint64_t seen_generation = 0u;
+        while(true) {
+            const Job* job = nullptr;
+            const VkCommandBufferInheritanceInfo* inheritance = nullptr;
+            uint32_t frame = 0u;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_job_ready.wait(lock, [&]() { return m_stop || m_generation != seen_generation; });
+                if(m_stop) {
+                    return;
+                }
+                seen_generation = m_generation;
+                job = m_job;
+                inheritance = m_inheritance;
+                frame = m_frame;
+            }
+            
+            std::exception_ptr error;
+            try {
+                Worker& worker = m_workers[thread_index];
+                vkResetCommandPool(m_device, worker.command_pools[frame], 0u);
+                VkCommandBuffer command_buffer = worker.command_buffers[frame];
+                
+                VkCommandBufferBeginInfo begin_info{};
+                begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+                begin_info.pInheritanceInfo = inheritance;
+                if(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to begin recording secondary command buffer!");
+                }
+                (*job)(thread_index, command_buffer);
+                if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to record secondary command buffer!");
+                }
+                m_recorded[thread_index] = command_buffer;
+            }
+            catch(...) {
+                error = std::current_exception();
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if(error && !m_error) {
+                    m_error = error;
+                }
+                --m_remaining;
+            }
+            m_job_done.notify_one();
+        }
+    }
+    
+    VkDevice m_device = VK_NULL_HANDLE;
+    std::vector<Worker> m_workers;
+    std::vector<VkCommandBuffer> m_recorded;
+    std::mutex m_mutex;
+    std::condition_variable m_job_ready;
+    std::condition_variable m_job_done;
+    const Job* m_job = nullptr;
+    const VkCommandBufferInheritanceInfo* m_inheritance = nullptr;
+    uint32_t m_frame = 0u;
+    uint32_t m_remaining = 0u;
+    uint64_t m_generation = 0u;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+};
+
+// Runs the ranges of a parallel loop on persistent threads. The calling thread takes ranges as well,
+// so a pool of N threads splits the work N + 1 ways and a pool without threads runs the loop inline.
+class WorkerPool final {
+public:
+    using RangeJob = std::function<void(size_t begin, size_t end)>;
+    
+    void init(uint32_t threads_count) {
+        m_threads.reserve(threads_count);
+        for(uint32_t i = 0u; i < threads_count; ++i) {
+            m_threads.emplace_back(&WorkerPool::workerLoop, this);
+        }
+    }
+    
+    void destroy() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_job_ready.notify_all();
+        for(std::thread& thread : m_threads) {
+            if(thread.joinable()) {
+                thread.join();
+            }
+        }
+        m_threads.clear();
+    }
+    
+    uint32_t threadCount() const {
+        return static_cast<uint32_t>(m_threads.size());
+    }
+    
+    // Splits [0, count) into ranges of at least min_range elements and blocks until all of them have run.
+    void parallelFor(size_t count, size_t min_range, const RangeJob& job) {
+        if(count == 0u) {
+            return;
+        }
+        size_t ways = m_threads.size() + 1u;
+        size_t range_size = std::max(std::max<size_t>(min_range, 1u), (count + ways - 1u) / ways);
+        size_t ranges = (count + range_size - 1u) / range_size;
+        if(ranges == 1u) {
+            job(0u, count);
+            return;
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = &job;
+            m_count = count;
+            m_range_size = range_size;
+            m_ranges = ranges;
+            m_next_range.store(0u, std::memory_order_relaxed);
+            m_remaining = threadCount();
+            m_error = nullptr;
+            ++m_generation;
+        }
+        m_job_ready.notify_all();
+        runRanges();
+        
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_job_done.wait(lock, [this]() { return m_remaining == 0u; });
+        m_job = nullptr;
+        if(m_error) {
+            std::rethrow_exception(m_error);
+        }
+    }
+    
+private:
+    void runRanges() {
+        std::exception_ptr error;
+        while(true) {
+            size_t range = m_next_range.fetch_add(1u, std::memory_order_relaxed);
+            if(range >= m_ranges) {
+                break;
+            }
+            size_t begin = range * m_range_size;
+            try {
+                (*m_job)(begin, std::min(m_count, begin + m_range_size));
+            }
+            catch(...) {
+                if(!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if(error) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(!m_error) {
+                m_error = error;
+            }
+        }
+    }
+    
+    void workerLoop() {
+        uint64_t seen_generation = 0u;
+        while(true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_job_ready.wait(lock, [&]() { return m_stop || m_generation != seen_generation; });
+                if(m_stop) {
+                    return;
+                }
+                seen_generation = m_generation;
+            }
+            
+            runRanges();
+            
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_remaining;
+            }
+            m_job_done.notify_one();
+        }
+    }
+    
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_job_ready;
+    std::condition_variable m_job_done;
+    const RangeJob* m_job = nullptr;
+    size_t m_count = 0u;
+    size_t m_range_size = 0u;
+    size_t m_ranges = 0u;
+    std::atomic<size_t> m_next_range = 0u;
+    uint32_t m_remaining = 0u;
+    uint64_t m_generation = 0u;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+};
+
+// World space boxes in structure-of-arrays form, one SIMD load fetches the same coordinate of 8 (AVX2)
+// or 4 (SSE) boxes. The arrays are padded to a multiple of CULL_LANES, the padding is never reported visible.
+struct CullBounds {
+    static constexpr size_t CULL_LANES = 8u;
+    
+    size_t count = 0u;
+    std::vector<float> center_x;
+    std::vector<float> center_y;
+    std::vector<float> center_z;
+    std::vector<float> extent_x;
+    std::vector<float> extent_y;
+    std::vector<float> extent_z;
+    
+    size_t paddedCount() const {
+        return center_x.size();
+    }
+};
+
+// Frustum planes split by component, abs_* are the absolute normals that project a box extent onto the plane.
+struct CullPlanes {
+    std::array<float, 6> normal_x;
+    std::array<float, 6> normal_y;
+    std::array<float, 6> normal_z;
+    std::array<float, 6> distance;
+    std::array<float, 6> abs_x;
+    std::array<float, 6> abs_y;
+    std::array<float, 6> abs_z;
+    
+    explicit CullPlanes(const std::array<glm::vec4, 6>& planes) {
+        for(size_t p = 0u; p < planes.size(); ++p) {
+            normal_x[p] = planes[p].x;
+            normal_y[p] = planes[p].y;
+            normal_z[p] = planes[p].z;
+            distance[p] = planes[p].w;
+            abs_x[p] = std::abs(planes[p].x);
+            abs_y[p] = std::abs(planes[p].y);
+            abs_z[p] = std::abs(planes[p].z);
+        }
+    }
+};
+
+// Tests boxes [first, last) and writes the indices of the ones touching the frustum to visible, returns how many.
+// A box is outside when its centre is further behind some plane than the extent reaches: dot(n, c) + w + dot(|n|, e) < 0.
+using CullKernel = size_t (*)(const CullBounds& bounds, const CullPlanes& planes, size_t first, size_t last, uint32_t* visible);
+
+static size_t cullBoundsScalar(const CullBounds& bounds, const CullPlanes& planes, size_t first, size_t last, uint32_t* visible) {
+    size_t visible_count = 0u;
+    last = std::min(last, bounds.count);
+    for(size_t i = first; i < last; ++i) {
+        bool inside = true;
+        for(size_t p = 0u; p < 6u && inside; ++p) {
+            float dist = bounds.center_x[i] * planes.normal_x[p] + bounds.center_y[i] * planes.normal_y[p] + bounds.center_z[i] * planes.normal_z[p] + planes.distance[p]
+                       + bounds.extent_x[i] * planes.abs_x[p] + bounds.extent_y[i] * planes.abs_y[p] + bounds.extent_z[i] * planes.abs_z[p];
+            inside = dist >= 0.0f;
+        }
+        if(inside) {
+            visible[visible_count++] = static_cast<uint32_t>(i);
+        }
+    }
+    return visible_count;
+}
+
+#if VKSAMPLE_X86_SIMD
+static inline size_t appendVisibleLanes(uint32_t lane_mask, size_t first_index, size_t count, uint32_t* visible, size_t visible_count) {
+    while(lane_mask != 0u) {
+        size_t index = first_index + static_cast<size_t>(std::countr_zero(lane_mask));
+        if(index < count) {
+            visible[visible_count++] = static_cast<uint32_t>(index);
+        }
+        lane_mask &= lane_mask - 1u;
+    }
+    return visible_count;
+}
+
+static size_t cullBoundsSse(const CullBounds& bounds, const CullPlanes& planes, size_t first, size_t last, uint32_t* visible) {
+    size_t visible_count = 0u;
+    const __m128 zero = _mm_setzero_ps();
+    for(size_t i = first; i < last; i += 4u) {
+        __m128 center_x = _mm_loadu_ps(bounds.center_x.data() + i);
+        __m128 center_y = _mm_loadu_ps(bounds.center_y.data() + i);
+        __m128 center_z = _mm_loadu_ps(bounds.center_z.data() + i);
+        __m128 extent_x = _mm_loadu_ps(bounds.extent_x.data() + i);
+        __m128 extent_y = _mm_loadu_ps(bounds.extent_y.data() + i);
+        __m128 extent_z = _mm_loadu_ps(bounds.extent_z.data() + i);
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for(size_t p = 0u; p < 6u; ++p) {
+            __m128 dist = _mm_add_ps(_mm_mul_ps(center_x, _mm_set1_ps(planes.normal_x[p])), _mm_set1_ps(planes.distance[p]));
+            dist = _mm_add_ps(dist, _mm_mul_ps(center_y, _mm_set1_ps(planes.normal_y[p])));
+            dist = _mm_add_ps(dist, _mm_mul_ps(center_z, _mm_set1_ps(planes.normal_z[p])));
+            dist = _mm_add_ps(dist, _mm_mul_ps(extent_x, _mm_set1_ps(planes.abs_x[p])));
+            dist = _mm_add_ps(dist, _mm_mul_ps(extent_y, _mm_set1_ps(planes.abs_y[p])));
+            dist = _mm_add_ps(dist, _mm_mul_ps(extent_z, _mm_set1_ps(planes.abs_z[p])));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, zero));
+        }
+        visible_count = appendVisibleLanes(static_cast<uint32_t>(_mm_movemask_ps(inside)), i, bounds.count, visible, visible_count);
+    }
+    return visible_count;
+}
+
+__attribute__((target("avx2,fma")))
+static size_t cullBoundsAvx2(const CullBounds& bounds, const CullPlanes& planes, size_t first, size_t last, uint32_t* visible) {
+    size_t visible_count = 0u;
+    const __m256 zero = _mm256_setzero_ps();
+    for(size_t i = first; i < last; i += 8u) {
+        __m256 center_x = _mm256_loadu_ps(bounds.center_x.data() + i);
+        __m256 center_y = _mm256_loadu_ps(bounds.center_y.data() + i);
+        __m256 center_z = _mm256_loadu_ps(bounds.center_z.data() + i);
+        __m256 extent_x = _mm256_loadu_ps(bounds.extent_x.data() + i);
+        __m256 extent_y = _mm256_loadu_ps(bounds.extent_y.data() + i);
+        __m256 extent_z = _mm256_loadu_ps(bounds.extent_z.data() + i);
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for(size_t p = 0u; p < 6u; ++p) {
+            __m256 dist = _mm256_fmadd_ps(center_x, _mm256_set1_ps(planes.normal_x[p]), _mm256_set1_ps(planes.distance[p]));
+            dist = _mm256_fmadd_ps(center_y, _mm256_set1_ps(planes.normal_y[p]), dist);
+            dist = _mm256_fmadd_ps(center_z, _mm256_set1_ps(planes.normal_z[p]), dist);
+            dist = _mm256_fmadd_ps(extent_x, _mm256_set1_ps(planes.abs_x[p]), dist);
+            dist = _mm256_fmadd_ps(extent_y, _mm256_set1_ps(planes.abs_y[p]), dist);
+            dist = _mm256_fmadd_ps(extent_z, _mm256_set1_ps(planes.abs_z[p]), dist);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, zero, _CMP_GE_OQ));
+        }
+        visible_count = appendVisibleLanes(static_cast<uint32_t>(_mm256_movemask_ps(inside)), i, bounds.count, visible, visible_count);
+    }
+    return visible_count;
+}
+#endif
+
+// Frustum culling of the instances on the CPU, for devices that can not cull in a compute pass.
+// Each frame the boxes are split into slices that the worker pool tests in parallel, then the
+// survivors are compacted into the instance stream of the frame.
+class CpuCuller final {
+public:
+    void init(const std::vector<InstanceData>& instances, const BoundingBox& mesh_box) {
+        glm::vec3 mesh_center = 0.5f * (mesh_box.min_pos + mesh_box.max_pos);
+        glm::vec3 mesh_extent = 0.5f * (mesh_box.max_pos - mesh_box.min_pos);
+        
+        size_t padded_count = (instances.size() + CullBounds::CULL_LANES - 1u) / CullBounds::CULL_LANES * CullBounds::CULL_LANES;
+        m_bounds.count = instances.size();
+        for(std::vector<float>* column : {&m_bounds.center_x, &m_bounds.center_y, &m_bounds.center_z, &m_bounds.extent_x, &m_bounds.extent_y, &m_bounds.extent_z}) {
+            column->assign(padded_count, 0.0f);
+        }
+        for(size_t i = 0u; i < instances.size(); ++i) {
+            // the box of the transformed box: centre moves with the matrix, extent goes through its absolute 3x3 part
+            const glm::mat4& model = instances[i].model;
+            glm::vec3 center = glm::vec3(model * glm::vec4(mesh_center, 1.0f));
+            glm::mat3 abs_basis(glm::abs(glm::vec3(model[0])), glm::abs(glm::vec3(model[1])), glm::abs(glm::vec3(model[2])));
+            glm::vec3 extent = abs_basis * mesh_extent;
+            m_bounds.center_x[i] = center.x;
+            m_bounds.center_y[i] = center.y;
+            m_bounds.center_z[i] = center.z;
+            m_bounds.extent_x[i] = extent.x;
+            m_bounds.extent_y[i] = extent.y;
+            m_bounds.extent_z[i] = extent.z;
+        }
+        m_visible_indices.resize(padded_count);
+        
+        m_kernel = cullBoundsScalar;
+        m_kernel_name = "scalar";
+#if VKSAMPLE_X86_SIMD
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            m_kernel = cullBoundsAvx2;
+            m_kernel_name = "avx2";
+        }
+        else {
+            m_kernel = cullBoundsSse;
+            m_kernel_name = "sse";
+        }
+#endif
+    }
+    
+    const char* kernelName() const {
+        return m_kernel_name;
+    }
+    
+    // Copies the instances inside the frustum to dst in their original order and returns how many there are.
+    // frustum_planes must be in the space of the instance matrices, as extractFrustumPlanes gives them.
+    uint32_t cull(WorkerPool& pool, const std::array<glm::vec4, 6>& frustum_planes, const std::vector<InstanceData>& instances, InstanceData* dst) {
+        CullPlanes planes(frustum_planes);
+        
+        // a few slices per thread evens out slices that end up with more survivors to copy
+        size_t blocks = m_bounds.paddedCount() / CullBounds::CULL_LANES;
+        size_t slices = std::min<size_t>(blocks, (pool.threadCount() + 1u) * 4u);
+        if(slices == 0u) {
+            return 0u;
+        }
+        size_t slice_size = (blocks + slices - 1u) / slices * CullBounds::CULL_LANES;
+        m_slice_counts.assign(slices, 0u);
+        m_slice_offsets.assign(slices, 0u);
+        
+        pool.parallelFor(slices, 1u, [&](size_t begin, size_t end) {
+            for(size_t slice = begin; slice < end; ++slice) {
+                size_t first = std::min(m_bounds.paddedCount(), slice * slice_size);
+                size_t last = std::min(m_bounds.paddedCount(), first + slice_size);
+                m_slice_counts[slice] = m_kernel(m_bounds, planes, first, last, m_visible_indices.data() + first);
+            }
+        });
+        
+        size_t visible_count = 0u;
+        for(size_t slice = 0u; slice < slices; ++slice) {
+            m_slice_offsets[slice] = visible_count;
+            visible_count += m_slice_counts[slice];
+        }
+        
+        pool.parallelFor(slices, 1u, [&](size_t begin, size_t end) {
+            for(size_t slice = begin; slice < end; ++slice) {
+                const uint32_t* indices = m_visible_indices.data() + std::min(m_bounds.paddedCount(), slice * slice_size);
+                InstanceData* slice_dst = dst + m_slice_offsets[slice];
+                for(size_t i = 0u; i < m_slice_counts[slice]; ++i) {
+                    slice_dst[i] = instances[indices[i]];
+                }
+            }
+        });
+        return static_cast<uint32_t>(visible_count);
+    }
+    
+private:
+    CullBounds m_bounds;
+    CullKernel m_kernel = cullBoundsScalar;
+    const char* m_kernel_name = "scalar";
+    std::vector<uint32_t> m_visible_indices; // each slice writes its survivors at its own first box
+    std::vector<size_t> m_slice_counts;
+    std::vector<size_t> m_slice_offsets;
+};
+
+// Read-only view of a whole file, memory mapped where the platform has mmap and read into memory otherwise.
+class MappedFile final {
+public:
+    explicit MappedFile(const std::string& file_name) {
+#if VKSAMPLE_HAS_MMAP
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if(fd < 0) {
+            throw std::runtime_error("failed to open file: " + file_name + "\n");
+        }
+        struct stat file_stat{};
+        if(fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+            close(fd);
+            throw std::runtime_error("failed to map empty file: " + file_name + "\n");
+        }
+        m_size = static_cast<size_t>(file_stat.st_size);
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // the mapping keeps the file open
+        if(data == MAP_FAILED) {
+            throw std::runtime_error("failed to map file: " + file_name + "\n");
+        }
+        // all of it is read right away by several threads at once
+        madvise(data, m_size, MADV_WILLNEED);
+        m_data = static_cast<const char*>(data);
+#else
+        m_fallback = readFile(file_name);
+        m_data = m_fallback.data();
+        m_size = m_fallback.size();
+#endif
+    }
+    
+    ~MappedFile() {
+#if VKSAMPLE_HAS_MMAP
+        munmap(const_cast<char*>(m_data), m_size);
+#endif
+    }
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    const char* data() const {
+        return m_data;
+    }
+    
+    size_t size() const {
+        return m_size;
+    }
+    
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0u;
+#if !VKSAMPLE_HAS_MMAP
+    std::vector<char> m_fallback;
+#endif
+};
+
+// Number parsing for OBJ text. Every read is bounded by end, a mapped file has no terminating zero.
+static const char* skipObjSpaces(const char* p, const char* end) {
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        ++p;
+    }
+    return p;
+}
+
+static const char* parseObjInt(const char* p, const char* end, int64_t& value) {
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    const char* digits_begin = p;
+    int64_t result = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; ++p) {
+        if(result > (std::numeric_limits<int64_t>::max() - (*p - '0')) / 10) {
+            return nullptr;
+        }
+        result = result * 10 + (*p - '0');
+    }
+    if(p == digits_begin) {
+        return nullptr;
+    }
+    value = negative ? -result : result;
+    return p;
+}
+
+static const char* parseObjFloat(const char* p, const char* end, float& value) {
+    // powers of ten that are exact doubles, so a single multiply or divide rounds correctly
+    static constexpr double POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    constexpr uint64_t MANTISSA_LIMIT = 100000000000000000ull; // 17 digits, more do not change a float
+    
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    uint64_t mantissa = 0u;
+    int exponent = 0;
+    int digits = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+        if(mantissa < MANTISSA_LIMIT) {
+            mantissa = mantissa * 10u + static_cast<uint64_t>(*p - '0');
+        }
+        else {
+            ++exponent;
+        }
+    }
+    if(p < end && *p == '.') {
+        for(++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+            if(mantissa < MANTISSA_LIMIT) {
+                mantissa = mantissa * 10u + static_cast<uint64_t>(*p - '0');
+                --exponent;
+            }
+        }
+    }
+    if(digits == 0) {
+        return nullptr;
+    }
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        int64_t exponent_value = 0;
+        const char* exponent_end = parseObjInt(p + 1, end, exponent_value);
+        if(exponent_end) {
+            exponent += static_cast<int>(std::clamp<int64_t>(exponent_value, -1000, 1000));
+            p = exponent_end;
+        }
+    }
+    
+    double result = static_cast<double>(mantissa);
+    if(exponent > 0) {
+        result = exponent <= 22 ? result * POWERS_OF_TEN[exponent] : result * std::pow(10.0, exponent);
+    }
+    else if(exponent < 0) {
+        result = exponent >= -22 ? result / POWERS_OF_TEN[-exponent] : result * std::pow(10.0, exponent);
+    }
+    value = static_cast<float>(negative ? -result : result);
+    return p;
+}
+
+// Open addressing map from an OBJ corner key to the index of its vertex, linear probing in a power of two table.
+class VertexDedupMap final {
+public:
+    static constexpr uint64_t EMPTY_KEY = std::numeric_limits<uint64_t>::max();
+    
+    void reserve(size_t count) {
+        rehash(std::bit_ceil(std::max<size_t>(16u, count * 2u)));
+    }
+    
+    // Returns the vertex of key, a new key becomes the next vertex.
+    uint32_t findOrInsert(uint64_t key) {
+        if((m_size + 1u) * 2u > m_keys.size()) {
+            rehash(std::max<size_t>(16u, m_keys.size() * 2u));
+        }
+        size_t mask = m_keys.size() - 1u;
+        for(size_t slot = hash(key) & mask;; slot = (slot + 1u) & mask) {
+            if(m_keys[slot] == key) {
+                return m_values[slot];
+            }
+            if(m_keys[slot] == EMPTY_KEY) {
+                m_keys[slot] = key;
+                m_values[slot] = static_cast<uint32_t>(m_size);
+                return static_cast<uint32_t>(m_size++);
+            }
+        }
+    }
+    
+    size_t size() const {
+        return m_size;
+    }
+    
+    // slots can be walked in parallel, empty ones hold EMPTY_KEY
+    size_t slotCount() const {
+        return m_keys.size();
+    }
+    
+    uint64_t slotKey(size_t slot) const {
+        return m_keys[slot];
+    }
+    
+    uint32_t slotValue(size_t slot) const {
+        return m_values[slot];
+    }
+    
+private:
+    static size_t hash(uint64_t key) {
+        // murmur3 finalizer, the low bits of consecutive keys have to scatter
+        key ^= key >> 33u;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33u;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33u;
+        return static_cast<size_t>(key);
+    }
+    
+    void rehash(size_t slots_count) {
+        std::vector<uint64_t> keys(slots_count, EMPTY_KEY);
+        std::vector<uint32_t> values(slots_count, 0u);
+        size_t mask = slots_count - 1u;
+        for(size_t i = 0u; i < m_keys.size(); ++i) {
+            if(m_keys[i] == EMPTY_KEY) {
+                continue;
+            }
+            size_t slot = hash(m_keys[i]) & mask;
+            while(keys[slot] != EMPTY_KEY) {
+                slot = (slot + 1u) & mask;
+            }
+            keys[slot] = m_keys[i];
+            values[slot] = m_values[i];
+        }
+        m_keys = std::move(keys);
+        m_values = std::move(values);
+    }
+    
+    std::vector<uint64_t> m_keys;
+    std::vector<uint32_t> m_values;
+    size_t m_size = 0u;
+};
+
+// Post-transform cache size assumed by the mesh optimization and the ACMR numbers.
+const uint32_t VERTEX_CACHE_SIZE = 16u;
+
+// Average cache miss ratio: vertices transformed per triangle with a FIFO post-transform cache.
+// 3 means no reuse at all, about 0.5 is the best a large regular grid can get.
+static double computeAcmr(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size = VERTEX_CACHE_SIZE) {
+    if(indices.empty()) {
+        return 0.0;
+    }
+    // a vertex is cached when fewer than cache_size vertices were inserted after it
+    std::vector<uint32_t> timestamps(vertex_count, 0u);
+    uint32_t time = cache_size + 1u;
+    size_t misses = 0u;
+    for(uint32_t index : indices) {
+        if(time - timestamps[index] > cache_size) {
+            timestamps[index] = time++;
+            ++misses;
+        }
+    }
+    return static_cast<double>(misses) / static_cast<double>(indices.size() / 3u);
+}
+
+// Tipsify (Sander, Nehab, Barczak 2007): fans around a vertex and moves on to a neighbour that is still
+// cached, falling back to recently used vertices and finally the next vertex with triangles left.
+static void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size = VERTEX_CACHE_SIZE) {
+    size_t triangle_count = indices.size() / 3u;
+    
+    // vertex to triangle adjacency, triangles of vertex v are adjacency[offsets[v]..offsets[v + 1])
+    std::vector<uint32_t> live_triangles(vertex_count, 0u);
+    for(uint32_t index : indices) {
+        ++live_triangles[index];
+    }
+    std::vector<uint32_t> offsets(vertex_count + 1u, 0u);
+    for(size_t v = 0u; v < vertex_count; ++v) {
+        offsets[v + 1u] = offsets[v] + live_triangles[v];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill_offsets(offsets.begin(), offsets.end() - 1);
+    for(size_t i = 0u; i < indices.size(); ++i) {
+        adjacency[fill_offsets[indices[i]]++] = static_cast<uint32_t>(i / 3u);
+    }
+    
+    std::vector<uint32_t> timestamps(vertex_count, 0u);
+    std::vector<uint8_t> emitted(triangle_count, 0u);
+    std::vector<uint32_t> dead_ends;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> result;
+    dead_ends.reserve(indices.size());
+    result.reserve(indices.size());
+    uint32_t time = cache_size + 1u;
+    size_t cursor = 0u;
+    
+    int64_t fanning = indices.empty() ? -1 : static_cast<int64_t>(indices[0]);
+    while(fanning >= 0) {
+        candidates.clear();
+        for(uint32_t a = offsets[fanning]; a < offsets[fanning + 1]; ++a) {
+            uint32_t triangle = adjacency[a];
+            if(emitted[triangle]) {
+                continue;
+            }
+            for(size_t corner = 0u; corner < 3u; ++corner) {
+                uint32_t v = indices[triangle * 3u + corner];
+                result.push_back(v);
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                --live_triangles[v];
+                if(time - timestamps[v] > cache_size) {
+                    timestamps[v] = time++;
+                }
+            }
+            emitted[triangle] = 1u;
+        }
+        
+        // the oldest candidate that stays cached while its remaining triangles are emitted
+        int64_t next = -1;
+        int64_t best_priority = -1;
+        for(uint32_t v : candidates) {
+            if(live_triangles[v] == 0u) {
+                continue;
+            }
+            int64_t priority = 0;
+            if(time - timestamps[v] + 2u * live_triangles[v] <= cache_size) {
+                priority = time - timestamps[v];
+            }
+            if(priority > best_priority) {
+                best_priority = priority;
+                next = v;
+            }
+        }
+        while(next < 0 && !dead_ends.empty()) {
+            uint32_t v = dead_ends.back();
+            dead_ends.pop_back();
+            if(live_triangles[v] > 0u) {
+                next = v;
+            }
+        }
+        for(; next < 0 && cursor < vertex_count; ++cursor) {
+            if(live_triangles[cursor] > 0u) {
+                next = static_cast<int64_t>(cursor);
+            }
+        }
+        fanning = next;
+    }
+    indices.swap(result);
+}
+
+// Cuts the cache optimized order into clusters and draws the outward facing ones first (Sander et al. 2007).
+// A cluster starts at every triangle that misses the cache with all three vertices, long clusters are cut
+// again wherever their ACMR so far is within threshold of the whole cluster's.
+static void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions, float threshold = 1.05f, uint32_t cache_size = VERTEX_CACHE_SIZE) {
+    size_t triangle_count = indices.size() / 3u;
+    if(triangle_count == 0u) {
+        return;
+    }
+    
+    std::vector<uint8_t> triangle_misses(triangle_count, 0u);
+    std::vector<uint32_t> timestamps(positions.size(), 0u);
+    uint32_t time = cache_size + 1u;
+    for(size_t t = 0u; t < triangle_count; ++t) {
+        for(size_t corner = 0u; corner < 3u; ++corner) {
+            uint32_t v = indices[t * 3u + corner];
+            if(time - timestamps[v] > cache_size) {
+                timestamps[v] = time++;
+                ++triangle_misses[t];
+            }
+        }
+    }
+    
+    std::vector<size_t> hard_starts;
+    for(size_t t = 0u; t < triangle_count; ++t) {
+        if(t == 0u || triangle_misses[t] == 3u) {
+            hard_starts.push_back(t);
+        }
+    }
+    hard_starts.push_back(triangle_count);
+    
+    std::vector<size_t> cluster_starts;
+    for(size_t h = 0u; h + 1u < hard_starts.size(); ++h) {
+        size_t begin = hard_starts[h];
+        size_t end = hard_starts[h + 1u];
+        size_t misses = 0u;
+        for(size_t t = begin; t < end; ++t) {
+            misses += triangle_misses[t];
+        }
+        double cluster_threshold = threshold * static_cast<double>(misses) / static_cast<double>(end - begin);
+        
+        // every cluster may end up drawn after any other, so each one is simulated from an empty cache
+        cluster_starts.push_back(begin);
+        time += cache_size + 1u;
+        size_t running_misses = 0u;
+        size_t running_start = begin;
+        for(size_t t = begin; t + 1u < end; ++t) {
+            for(size_t corner = 0u; corner < 3u; ++corner) {
+                uint32_t v = indices[t * 3u + corner];
+                if(time - timestamps[v] > cache_size) {
+                    timestamps[v] = time++;
+                    ++running_misses;
+                }
+            }
+            if(static_cast<double>(running_misses) / static_cast<double>(t + 1u - running_start) <= cluster_threshold) {
+                cluster_starts.push_back(t + 1u);
+                time += cache_size + 1u;
+                running_misses = 0u;
+                running_start = t + 1u;
+            }
+        }
+    }
+    cluster_starts.push_back(triangle_count);
+    
+    struct Cluster {
+        size_t begin;
+        size_t end;
+        float sort_key;
+    };
+    std::vector<Cluster> clusters;
+    clusters.reserve(cluster_starts.size() - 1u);
+    std::vector<glm::vec3> cluster_centroids;
+    std::vector<glm::vec3> cluster_normals;
+    glm::vec3 mesh_centroid(0.0f);
+    float mesh_area = 0.0f;
+    for(size_t c = 0u; c + 1u < cluster_starts.size(); ++c) {
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for(size_t t = cluster_starts[c]; t < cluster_starts[c + 1u]; ++t) {
+            const glm::vec3& p0 = positions[indices[t * 3u]];
+            const glm::vec3& p1 = positions[indices[t * 3u + 1u]];
+            const glm::vec3& p2 = positions[indices[t * 3u + 2u]];
+            glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+            float triangle_area = glm::length(cross);
+            centroid += (p0 + p1 + p2) * (triangle_area / 3.0f);
+            normal += cross;
+            area += triangle_area;
+        }
+        mesh_centroid += centroid;
+        mesh_area += area;
+        cluster_centroids.push_back(area > 0.0f ? centroid / area : positions[indices[cluster_starts[c] * 3u]]);
+        cluster_normals.push_back(glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f));
+        clusters.push_back({cluster_starts[c], cluster_starts[c + 1u], 0.0f});
+    }
+    mesh_centroid = mesh_area > 0.0f ? mesh_centroid / mesh_area : glm::vec3(0.0f);
+    for(size_t c = 0u; c < clusters.size(); ++c) {
+        clusters[c].sort_key = glm::dot(cluster_centroids[c] - mesh_centroid, cluster_normals[c]);
+    }
+    
+    // clusters facing away from the centre are more likely to occlude the rest
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sort_key > b.sort_key; });
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for(const Cluster& cluster : clusters) {
+        result.insert(result.end(), indices.begin() + cluster.begin * 3u, indices.begin() + cluster.end * 3u);
+    }
+    indices.swap(result);
+}
+
+// Renumbers the vertices in order of first use so vertex fetch walks the buffer forwards, returns old to new.
+static std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, size_t vertex_count) {
+    constexpr uint32_t UNUSED = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(vertex_count, UNUSED);
+    uint32_t next_vertex = 0u;
+    for(uint32_t& index : indices) {
+        if(remap[index] == UNUSED) {
+            remap[index] = next_vertex++;
+        }
+        index = remap[index];
+    }
+    // unreferenced vertices keep a slot at the end
+    for(uint32_t& new_index : remap) {
+        if(new_index == UNUSED) {
+            new_index = next_vertex++;
+        }
+    }
+    return remap;
+}
+
+struct MeshOptimizeStep {
+    const char* name;
+    double acmr_before;
+    double acmr_after;
+    double ms;
+};
+
+struct MeshLoadStats {
+    std::string file_name;
+    size_t file_bytes = 0u;
+    double parse_ms = 0.0; // mapping, parsing and vertex dedupe
+    double load_ms = 0.0;  // everything up to the staged upload, optimization included
+    size_t vertex_count = 0u;
+    size_t index_count = 0u;
+    uint32_t index_bits = 16u;
+    std::vector<MeshOptimizeStep> optimize_steps;
+    
+    double megabytesPerSecond() const {
+        return parse_ms > 0.0 ? static_cast<double>(file_bytes) / 1000000.0 / (parse_ms / 1000.0) : 0.0;
+    }
+};
+
+// Parses the v, vt and f lines of a Wavefront OBJ file on the worker pool. The file is cut into chunks at line
+// breaks, a counting pass sizes the attribute pools and gives every chunk its output offsets, a second pass
+// parses the chunks in place. Faces are fan-triangulated, "v x y z r g b" carries a vertex color, normals,
+// groups and materials are ignored.
+class ObjMeshParser final {
+public:
+    void parse(const char* data, size_t size, WorkerPool& pool) {
+        constexpr size_t MIN_CHUNK_BYTES = 256u * 1024u;
+        size_t chunks_count = std::clamp<size_t>(size / MIN_CHUNK_BYTES, 1u, (pool.threadCount() + 1u) * 4u);
+        const char* end = data + size;
+        const char* chunk_begin = data;
+        m_chunks.assign(chunks_count, Chunk{});
+        for(size_t i = 0u; i < chunks_count; ++i) {
+            const char* chunk_end = end;
+            if(i + 1u < chunks_count) {
+                chunk_end = std::find(std::max(chunk_begin, data + size * (i + 1u) / chunks_count), end, '\n');
+                chunk_end = chunk_end == end ? end : chunk_end + 1;
+            }
+            m_chunks[i].begin = chunk_begin;
+            m_chunks[i].end = chunk_end;
+            chunk_begin = chunk_end;
+        }
+        
+        pool.parallelFor(chunks_count, 1u, [this](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                countChunk(m_chunks[i]);
+            }
+        });
+        
+        size_t positions_count = 0u;
+        size_t tex_coords_count = 0u;
+        size_t corners_count = 0u;
+        for(Chunk& chunk : m_chunks) {
+            chunk.position_base = positions_count;
+            chunk.tex_coord_base = tex_coords_count;
+            chunk.corner_base = corners_count;
+            positions_count += chunk.positions_count;
+            tex_coords_count += chunk.tex_coords_count;
+            corners_count += chunk.corners_count;
+        }
+        if(corners_count == 0u) {
+            throw std::runtime_error("mesh has no faces!");
+        }
+        if(positions_count >= std::numeric_limits<uint32_t>::max() || tex_coords_count >= std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("mesh has too many vertices!");
+        }
+        m_positions.resize(positions_count);
+        m_colors.resize(positions_count);
+        m_tex_coords.resize(tex_coords_count);
+        m_corners.resize(corners_count);
+        
+        pool.parallelFor(chunks_count, 1u, [this](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                parseChunk(m_chunks[i]);
+            }
+        });
+    }
+    
+    size_t indexCount() const {
+        return m_corners.size();
+    }
+    
+    // Dedupes the corners into vertices numbered in order of first use and writes the index of every
+    // corner, returns the vertex count.
+    uint32_t buildIndices(uint32_t* indices) {
+        m_dedup.reserve(m_positions.size());
+        for(size_t i = 0u; i < m_corners.size(); ++i) {
+            indices[i] = m_dedup.findOrInsert(m_corners[i]);
+        }
+        return static_cast<uint32_t>(m_dedup.size());
+    }
+    
+    // Position of every vertex found by buildIndices(), for the mesh optimization.
+    std::vector<glm::vec3> gatherPositions(WorkerPool& pool) const {
+        std::vector<glm::vec3> positions(m_dedup.size());
+        pool.parallelFor(m_dedup.slotCount(), SLOTS_PER_RANGE, [&](size_t begin, size_t end) {
+            for(size_t slot = begin; slot < end; ++slot) {
+                uint64_t key = m_dedup.slotKey(slot);
+                if(key != VertexDedupMap::EMPTY_KEY) {
+                    positions[m_dedup.slotValue(slot)] = m_positions[static_cast<uint32_t>(key >> 32u)];
+                }
+            }
+        });
+        return positions;
+    }
+    
+    // Bounds of the vertices found by buildIndices().
+    BoundingBox computeBounds(WorkerPool& pool) const {
+        const BoundingBox empty_box{glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest())};
+        BoundingBox box = empty_box;
+        std::mutex box_mutex;
+        pool.parallelFor(m_dedup.slotCount(), SLOTS_PER_RANGE, [&](size_t begin, size_t end) {
+            BoundingBox range_box = empty_box;
+            for(size_t slot = begin; slot < end; ++slot) {
+                uint64_t key = m_dedup.slotKey(slot);
+                if(key != VertexDedupMap::EMPTY_KEY) {
+                    const glm::vec3& position = m_positions[static_cast<uint32_t>(key >> 32u)];
+                    range_box.min_pos = glm::min(range_box.min_pos, position);
+                    range_box.max_pos = glm::max(range_box.max_pos, position);
+                }
+            }
+            std::lock_guard<std::mutex> lock(box_mutex);
+            box.min_pos = glm::min(box.min_pos, range_box.min_pos);
+            box.max_pos = glm::max(box.max_pos, range_box.max_pos);
+        });
+        return box;
+    }
+    
+    // Writes the vertices first_vertex to first_vertex + vertex_count - 1 found by buildIndices() to vertices[0] onwards,
+    // encode turns a Vertex into the stored VertexType. remap moves vertex i to remap[i], empty keeps the order of buildIndices().
+    template<typename VertexType, typename Encode>
+    void writeVertices(VertexType* vertices, uint32_t first_vertex, uint32_t vertex_count, const std::vector<uint32_t>& remap, WorkerPool& pool, Encode&& encode) const {
+        pool.parallelFor(m_dedup.slotCount(), SLOTS_PER_RANGE, [&](size_t begin, size_t end) {
+            for(size_t slot = begin; slot < end; ++slot) {
+                uint64_t key = m_dedup.slotKey(slot);
+                if(key == VertexDedupMap::EMPTY_KEY) {
+                    continue;
+                }
+                uint32_t index = m_dedup.slotValue(slot);
+                uint32_t vertex_index = (remap.empty() ? index : remap[index]) - first_vertex;
+                if(vertex_index >= vertex_count) {
+                    continue;
+                }
+                uint32_t position = static_cast<uint32_t>(key >> 32u);
+                uint32_t tex_coord = static_cast<uint32_t>(key & 0xffffffffu);
+                Vertex vertex{};
+                vertex.pos = m_positions[position];
+                vertex.color = m_colors[position];
+                vertex.tex_coord = tex_coord ? m_tex_coords[tex_coord - 1u] : glm::vec2(0.0f);
+                vertices[vertex_index] = encode(vertex);
+            }
+        });
+    }
+    
+private:
+    static constexpr size_t SLOTS_PER_RANGE = 16384u;
+    
+    enum class LineKind {
+        Other,
+        Position,
+        TexCoord,
+        Face
+    };
+    
+    struct Chunk {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+        size_t positions_count = 0u;
+        size_t tex_coords_count = 0u;
+        size_t corners_count = 0u;
+        size_t position_base = 0u;
+        size_t tex_coord_base = 0u;
+        size_t corner_base = 0u;
+    };
+    
+    // Calls line_func(kind, first character after the keyword, line end) for every line of the chunk.
+    template<typename LineFunc>
+    static void forEachLine(const Chunk& chunk, LineFunc&& line_func) {
+        for(const char* line = chunk.begin; line < chunk.end;) {
+            const char* line_end = std::find(line, chunk.end, '\n');
+            const char* p = skipObjSpaces(line, line_end);
+            auto is_space = [line_end](const char* c) { return c < line_end && (*c == ' ' || *c == '\t'); };
+            if(p < line_end && p[0] == 'v' && is_space(p + 1)) {
+                line_func(LineKind::Position, p + 1, line_end);
+            }
+            else if(p + 1 < line_end && p[0] == 'v' && p[1] == 't' && is_space(p + 2)) {
+                line_func(LineKind::TexCoord, p + 2, line_end);
+            }
+            else if(p < line_end && p[0] == 'f' && is_space(p + 1)) {
+                line_func(LineKind::Face, p + 1, line_end);
+            }
+            line = line_end == chunk.end ? line_end : line_end + 1;
+        }
+    }
+    
+    static size_t countFaceCorners(const char* p, const char* line_end) {
+        size_t face_vertices = 0u;
+        while(true) {
+            p = skipObjSpaces(p, line_end);
+            if(p == line_end) {
+                break;
+            }
+            ++face_vertices;
+            while(p < line_end && *p != ' ' && *p != '\t' && *p != '\r') {
+                ++p;
+            }
+        }
+        return face_vertices >= 3u ? 3u * (face_vertices - 2u) : 0u;
+    }
+    
+    // 1-based and negative (relative) OBJ indices to a 0-based one
+    static uint32_t resolveIndex(int64_t index, size_t defined_count, size_t total_count) {
+        int64_t resolved = index > 0 ? index - 1 : static_cast<int64_t>(defined_count) + index;
+        if(index == 0 || resolved < 0 || resolved >= static_cast<int64_t>(total_count)) {
+            throw std::runtime_error("OBJ face references a missing vertex!");
+        }
+        return static_cast<uint32_t>(resolved);
+    }
+    
+    void countChunk(Chunk& chunk) {
+        forEachLine(chunk, [&chunk](LineKind kind, const char* p, const char* line_end) {
+            if(kind == LineKind::Position) {
+                ++chunk.positions_count;
+            }
+            else if(kind == LineKind::TexCoord) {
+                ++chunk.tex_coords_count;
+            }
+            else if(kind == LineKind::Face) {
+                chunk.corners_count += countFaceCorners(p, line_end);
+            }
+        });
+    }
+    
+    void parseChunk(const Chunk& chunk) {
+        size_t position = chunk.position_base;
+        size_t tex_coord = chunk.tex_coord_base;
+        size_t corner = chunk.corner_base;
+        forEachLine(chunk, [&](LineKind kind, const char* p, const char* line_end) {
+            if(kind == LineKind::Position) {
+                std::array<float, 6> values = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+                for(size_t i = 0u; i < values.size(); ++i) {
+                    const char* value_end = parseObjFloat(skipObjSpaces(p, line_end), line_end, values[i]);
+                    if(!value_end) {
+                        if(i < 3u) {
+                            throw std::runtime_error("malformed OBJ vertex position!");
+                        }
+                        break;
+                    }
+                    p = value_end;
+                }
+                m_positions[position] = glm::vec3(values[0], values[1], values[2]);
+                m_colors[position] = glm::vec3(values[3], values[4], values[5]);
+                ++position;
+            }
+            else if(kind == LineKind::TexCoord) {
+                glm::vec2 uv(0.0f);
+                p = parseObjFloat(skipObjSpaces(p, line_end), line_end, uv.x);
+                if(!p || !parseObjFloat(skipObjSpaces(p, line_end), line_end, uv.y)) {
+                    throw std::runtime_error("malformed OBJ texture coordinate!");
+                }
+                // OBJ puts v = 0 at the bottom of the image, Vulkan samples the first row at v = 0
+                m_tex_coords[tex_coord++] = glm::vec2(uv.x, 1.0f - uv.y);
+            }
+            else if(kind == LineKind::Face) {
+                // key - position index in the high half, texture coordinate index + 1 in the low half, 0 when there is none
+                uint64_t first_key = 0u;
+                uint64_t previous_key = 0u;
+                for(size_t face_vertex = 0u;; ++face_vertex) {
+                    p = skipObjSpaces(p, line_end);
+                    if(p == line_end) {
+                        break;
+                    }
+                    int64_t position_index = 0;
+                    p = parseObjInt(p, line_end, position_index);
+                    if(!p) {
+                        throw std::runtime_error("malformed OBJ face!");
+                    }
+                    uint64_t key = static_cast<uint64_t>(resolveIndex(position_index, position, m_positions.size())) << 32u;
+                    if(p < line_end && *p == '/' && p + 1 < line_end && p[1] != '/') {
+                        int64_t tex_coord_index = 0;
+                        p = parseObjInt(p + 1, line_end, tex_coord_index);
+                        if(!p) {
+                            throw std::runtime_error("malformed OBJ face!");
+                        }
+                        key |= static_cast<uint64_t>(resolveIndex(tex_coord_index, tex_coord, m_tex_coords.size())) + 1u;
+                    }
+                    // the normal index is not used
+                    while(p < line_end && *p != ' ' && *p != '\t' && *p != '\r') {
+                        ++p;
+                    }
+                    
+                    if(face_vertex == 0u) {
+                        first_key = key;
+                    }
+                    else if(face_vertex >= 2u) {
+                        m_corners[corner++] = first_key;
+                        m_corners[corner++] = previous_key;
+                        m_corners[corner++] = key;
+                    }
+                    previous_key = key;
+                }
+            }
+        });
+    }
+    
+    std::vector<Chunk> m_chunks;
+    std::vector<glm::vec3> m_positions;
+    std::vector<glm::vec3> m_colors;
+    std::vector<glm::vec2> m_tex_coords;
+    std::vector<uint64_t> m_corners;
+    VertexDedupMap m_dedup;
+};
+
+// Mip level stored in a texture container, offset and size are in bytes from the start of the file.
+struct TextureFileLevel {
+    size_t offset;
+    size_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Texture read from a KTX2 or DDS container, the level data stays in the mapped file.
+struct TextureFile {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    std::vector<TextureFileLevel> levels; // level 0 is the full size one
+};
+
+static uint32_t getBlockBytes(VkFormat format) {
+    switch(format) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+            return 8u;
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            return 16u;
+        default:
+            return 0u;
+    }
+}
+
+// Bytes of one width x height level, 0 for formats the texture containers can not hold.
+static size_t getTextureLevelSize(VkFormat format, uint32_t width, uint32_t height) {
+    if(format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB) {
+        return static_cast<size_t>(width) * height * 4u;
+    }
+    return static_cast<size_t>((width + 3u) / 4u) * ((height + 3u) / 4u) * getBlockBytes(format);
+}
+
+static const char* getTextureFormatName(VkFormat format) {
+    switch(format) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return "BC1_RGB_UNORM";
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return "BC1_RGB_SRGB";
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: return "BC1_RGBA_UNORM";
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: return "BC1_RGBA_SRGB";
+        case VK_FORMAT_BC3_UNORM_BLOCK: return "BC3_UNORM";
+        case VK_FORMAT_BC3_SRGB_BLOCK: return "BC3_SRGB";
+        case VK_FORMAT_BC5_UNORM_BLOCK: return "BC5_UNORM";
+        case VK_FORMAT_BC7_UNORM_BLOCK: return "BC7_UNORM";
+        case VK_FORMAT_BC7_SRGB_BLOCK: return "BC7_SRGB";
+        case VK_FORMAT_R8G8B8A8_UNORM: return "R8G8B8A8_UNORM";
+        case VK_FORMAT_R8G8B8A8_SRGB: return "R8G8B8A8_SRGB";
+        case VK_FORMAT_R8G8_UNORM: return "R8G8_UNORM";
+        default: return "unknown";
+    }
+}
+
+template<typename T>
+static T readLittleEndian(const uint8_t* data) {
+    T value;
+    memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+static void addTextureLevels(TextureFile& texture, uint32_t width, uint32_t height, uint32_t level_count, const std::function<size_t(uint32_t level, size_t level_size)>& get_offset, size_t file_size, const std::string& file_name) {
+    // the chain ends with the 1x1 level, more levels than that are no valid image
+    uint32_t max_level_count = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1u;
+    if(level_count > max_level_count) {
+        throw std::runtime_error("texture file has more mip levels than its size allows: " + file_name + "\n");
+    }
+    for(uint32_t level = 0u; level < level_count; ++level) {
+        TextureFileLevel texture_level{};
+        texture_level.width = std::max(1u, width >> level);
+        texture_level.height = std::max(1u, height >> level);
+        texture_level.size = getTextureLevelSize(texture.format, texture_level.width, texture_level.height);
+        texture_level.offset = get_offset(level, texture_level.size);
+        if(texture_level.offset > file_size || file_size - texture_level.offset < texture_level.size) {
+            throw std::runtime_error("truncated texture file: " + file_name + "\n");
+        }
+        texture.levels.push_back(texture_level);
+    }
+}
+
+// KTX2 without supercompression, 2D textures only, as written by TextureCooker or block-compressed by other tools.
+// The level index gives every level its own offset.
+static TextureFile parseKtx2(const uint8_t* data, size_t size, const std::string& file_name) {
+    const size_t HEADER_SIZE = 80u;
+    const size_t LEVEL_INDEX_ENTRY_SIZE = 24u;
+    if(size < HEADER_SIZE) {
+        throw std::runtime_error("truncated texture file: " + file_name + "\n");
+    }
+    TextureFile texture{};
+    texture.format = static_cast<VkFormat>(readLittleEndian<uint32_t>(data + 12u));
+    uint32_t width = readLittleEndian<uint32_t>(data + 20u);
+    uint32_t height = readLittleEndian<uint32_t>(data + 24u);
+    uint32_t depth = readLittleEndian<uint32_t>(data + 28u);
+    uint32_t layer_count = readLittleEndian<uint32_t>(data + 32u);
+    uint32_t face_count = readLittleEndian<uint32_t>(data + 36u);
+    uint32_t level_count = std::max(1u, readLittleEndian<uint32_t>(data + 40u));
+    uint32_t supercompression = readLittleEndian<uint32_t>(data + 44u);
+    
+    if(getTextureLevelSize(texture.format, 1u, 1u) == 0u) {
+        throw std::runtime_error("texture format is not BC1, BC3, BC5, BC7 or R8G8B8A8: " + file_name + "\n");
+    }
+    if(width == 0u || height == 0u || depth > 1u || layer_count > 1u || face_count != 1u || supercompression != 0u) {
+        throw std::runtime_error("only uncompressed single 2D KTX2 textures are supported: " + file_name + "\n");
+    }
+    if(size < HEADER_SIZE + LEVEL_INDEX_ENTRY_SIZE * level_count) {
+        throw std::runtime_error("truncated texture file: " + file_name + "\n");
+    }
+    addTextureLevels(texture, width, height, level_count, [&](uint32_t level, size_t level_size) {
+        const uint8_t* entry = data + HEADER_SIZE + LEVEL_INDEX_ENTRY_SIZE * level;
+        if(readLittleEndian<uint64_t>(entry + 8u) < level_size) {
+            throw std::runtime_error("texture level is smaller than its format needs: " + file_name + "\n");
+        }
+        return static_cast<size_t>(readLittleEndian<uint64_t>(entry));
+    }, size, file_name);
+    return texture;
+}
+
+static constexpr uint32_t makeFourCC(char a, char b, char c, char d) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(a)) | static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8u
+         | static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16u | static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24u;
+}
+
+// DDS with a DXT1, DXT5, ATI2 or BC5U FourCC or a DX10 header. The levels follow each other from the largest.
+// Legacy FourCCs carry no color space, DXT1 and DXT5 are taken as sRGB color textures.
+static TextureFile parseDds(const uint8_t* data, size_t size, const std::string& file_name) {
+    const size_t HEADER_SIZE = 128u;
+    const size_t DX10_HEADER_SIZE = 20u;
+    const uint32_t DDSD_MIPMAPCOUNT = 0x20000u;
+    const uint32_t DDPF_FOURCC = 0x4u;
+    if(size < HEADER_SIZE) {
+        throw std::runtime_error("truncated texture file: " + file_name + "\n");
+    }
+    uint32_t flags = readLittleEndian<uint32_t>(data + 8u);
+    uint32_t height = readLittleEndian<uint32_t>(data + 12u);
+    uint32_t width = readLittleEndian<uint32_t>(data + 16u);
+    uint32_t level_count = (flags & DDSD_MIPMAPCOUNT) ? std::max(1u, readLittleEndian<uint32_t>(data + 28u)) : 1u;
+    uint32_t pixel_flags = readLittleEndian<uint32_t>(data + 80u);
+    uint32_t four_cc = readLittleEndian<uint32_t>(data + 84u);
+    if(width == 0u || height == 0u || !(pixel_flags & DDPF_FOURCC)) {
+        throw std::runtime_error("DDS texture is not block-compressed: " + file_name + "\n");
+    }
+    
+    TextureFile texture{};
+    size_t data_offset = HEADER_SIZE;
+    if(four_cc == makeFourCC('D', 'X', 'T', '1')) {
+        texture.format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+    }
+    else if(four_cc == makeFourCC('D', 'X', 'T', '5')) {
+        texture.format = VK_FORMAT_BC3_SRGB_BLOCK;
+    }
+    else if(four_cc == makeFourCC('A', 'T', 'I', '2') || four_cc == makeFourCC('B', 'C', '5', 'U')) {
+        texture.format = VK_FORMAT_BC5_UNORM_BLOCK;
+    }
+    else if(four_cc == makeFourCC('D', 'X', '1', '0')) {
+        if(size < HEADER_SIZE + DX10_HEADER_SIZE) {
+            throw std::runtime_error("truncated texture file: " + file_name + "\n");
+        }
+        const uint32_t DDS_DIMENSION_TEXTURE2D = 3u;
+        uint32_t dxgi_format = readLittleEndian<uint32_t>(data + HEADER_SIZE);
+        uint32_t dimension = readLittleEndian<uint32_t>(data + HEADER_SIZE + 4u);
+        uint32_t array_size = readLittleEndian<uint32_t>(data + HEADER_SIZE + 12u);
+        if(dimension != DDS_DIMENSION_TEXTURE2D || array_size > 1u) {
+            throw std::runtime_error("only single 2D DDS textures are supported: " + file_name + "\n");
+        }
+        switch(dxgi_format) {
+            case 71u: texture.format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK; break; // DXGI_FORMAT_BC1_UNORM
+            case 72u: texture.format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK; break;  // DXGI_FORMAT_BC1_UNORM_SRGB
+            case 77u: texture.format = VK_FORMAT_BC3_UNORM_BLOCK; break;      // DXGI_FORMAT_BC3_UNORM
+            case 78u: texture.format = VK_FORMAT_BC3_SRGB_BLOCK; break;       // DXGI_FORMAT_BC3_UNORM_SRGB
+            case 83u: texture.format = VK_FORMAT_BC5_UNORM_BLOCK; break;      // DXGI_FORMAT_BC5_UNORM
+            case 98u: texture.format = VK_FORMAT_BC7_UNORM_BLOCK; break;      // DXGI_FORMAT_BC7_UNORM
+            case 99u: texture.format = VK_FORMAT_BC7_SRGB_BLOCK; break;       // DXGI_FORMAT_BC7_UNORM_SRGB
+            default:
+                throw std::runtime_error("texture format is not BC1, BC3, BC5 or BC7: " + file_name + "\n");
+        }
+        data_offset += DX10_HEADER_SIZE;
+    }
+    else {
+        throw std::runtime_error("texture format is not BC1, BC3, BC5 or BC7: " + file_name + "\n");
+    }
+    
+    size_t level_offset = data_offset;
+    addTextureLevels(texture, width, height, level_count, [&](uint32_t, size_t level_size) {
+        size_t offset = level_offset;
+        level_offset += level_size;
+        return offset;
+    }, size, file_name);
+    return texture;
+}
+
+static TextureFile parseTextureFile(const uint8_t* data, size_t size, const std::string& file_name) {
+    const std::array<uint8_t, 12> KTX2_IDENTIFIER = {0xABu, 0x4Bu, 0x54u, 0x58u, 0x20u, 0x32u, 0x30u, 0xBBu, 0x0Du, 0x0Au, 0x1Au, 0x0Au};
+    if(size >= KTX2_IDENTIFIER.size() && std::equal(KTX2_IDENTIFIER.begin(), KTX2_IDENTIFIER.end(), data)) {
+        return parseKtx2(data, size, file_name);
+    }
+    if(size >= 4u && readLittleEndian<uint32_t>(data) == makeFourCC('D', 'D', 'S', ' ')) {
+        return parseDds(data, size, file_name);
+    }
+    throw std::runtime_error("texture file is neither KTX2 nor DDS: " + file_name + "\n");
+}
+
+static bool isTextureContainerFile(const std::string& file_name) {
+    std::string extension = std::filesystem::path(file_name).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension == ".ktx2" || extension == ".dds";
+}
+
+// Picks one palette entry per texel of a 4x4 block, index_bits wide indices are packed from texel 0 up.
+// The palette always has 8 entries, the ones past 1 << index_bits are never read.
+using PaletteKernel = void (*)(const uint32_t* palette, uint64_t indices, uint32_t index_bits, uint32_t* texels);
+
+static void lookupPaletteScalar(const uint32_t* palette, uint64_t indices, uint32_t index_bits, uint32_t* texels) {
+    uint64_t mask = (1u << index_bits) - 1u;
+    for(uint32_t i = 0u; i < 16u; ++i) {
+        texels[i] = palette[(indices >> (i * index_bits)) & mask];
+    }
+}
+
+#if VKSAMPLE_X86_SIMD
+// Eight texels per permute: their indices are shifted into the lanes of one register and select palette lanes.
+__attribute__((target("avx2")))
+static void lookupPaletteAvx2(const uint32_t* palette, uint64_t indices, uint32_t index_bits, uint32_t* texels) {
+    const __m256i table = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(palette));
+    const __m256i shifts = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(index_bits)));
+    const __m256i mask = _mm256_set1_epi32((1 << index_bits) - 1);
+    for(uint32_t half = 0u; half < 2u; ++half) {
+        __m256i half_indices = _mm256_set1_epi32(static_cast<int>(indices >> (half * 8u * index_bits)));
+        __m256i lanes = _mm256_and_si256(_mm256_srlv_epi32(half_indices, shifts), mask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(texels + half * 8u), _mm256_permutevar8x32_epi32(table, lanes));
+    }
+}
+#endif
+
+// BC7 mode descriptions and the partition tables of the BC7 specification. Partitions keep the subset of
+// texel i in bits 2i and 2i + 1, the anchors are the texels whose index has an implied zero top bit.
+struct Bc7Mode {
+    uint32_t subset_count;
+    uint32_t partition_bits;
+    uint32_t rotation_bits;
+    uint32_t index_selection_bits;
+    uint32_t color_bits;
+    uint32_t alpha_bits;
+    uint32_t endpoint_p_bits; // one p-bit per endpoint
+    uint32_t shared_p_bits;   // one p-bit per subset
+    uint32_t index_bits;
+    uint32_t secondary_index_bits;
+};
+
+static constexpr std::array<Bc7Mode, 8> BC7_MODES = {{
+    {3u, 4u, 0u, 0u, 4u, 0u, 1u, 0u, 3u, 0u},
+    {2u, 6u, 0u, 0u, 6u, 0u, 0u, 1u, 3u, 0u},
+    {3u, 6u, 0u, 0u, 5u, 0u, 0u, 0u, 2u, 0u},
+    {2u, 6u, 0u, 0u, 7u, 0u, 1u, 0u, 2u, 0u},
+    {1u, 0u, 2u, 1u, 5u, 6u, 0u, 0u, 2u, 3u},
+    {1u, 0u, 2u, 0u, 7u, 8u, 0u, 0u, 2u, 2u},
+    {1u, 0u, 0u, 0u, 7u, 7u, 1u, 0u, 4u, 0u},
+    {2u, 6u, 0u, 0u, 5u, 5u, 1u, 0u, 2u, 0u}
+}};
+
+static constexpr std::array<uint32_t, 64> BC7_PARTITIONS_2 = {
+        0x50505050u, 0x40404040u, 0x54545454u, 0x54505040u, 0x50404000u, 0x55545450u, 0x55545040u, 0x54504000u,
+        0x50400000u, 0x55555450u, 0x55544000u, 0x54400000u, 0x55555440u, 0x55550000u, 0x55555500u, 0x55000000u,
+        0x55150100u, 0x00004054u, 0x15010000u, 0x00405054u, 0x00004050u, 0x15050100u, 0x05010000u, 0x40505054u,
+        0x00404050u, 0x05010100u, 0x14141414u, 0x05141450u, 0x01155440u, 0x00555500u, 0x15014054u, 0x05414150u,
+        0x44444444u, 0x55005500u, 0x11441144u, 0x05055050u, 0x05500550u, 0x11114444u, 0x41144114u, 0x44111144u,
+        0x15055054u, 0x01055040u, 0x05041050u, 0x05455150u, 0x14414114u, 0x50050550u, 0x41411414u, 0x00141400u,
+        0x00041504u, 0x00105410u, 0x10541000u, 0x04150400u, 0x50410514u, 0x41051450u, 0x05415014u, 0x14054150u,
+        0x41050514u, 0x41505014u, 0x40011554u, 0x54150140u, 0x50505500u, 0x00555050u, 0x15151010u, 0x54540404u
+};
+
+static constexpr std::array<uint32_t, 64> BC7_PARTITIONS_3 = {
+        0xAA685050u, 0x6A5A5040u, 0x5A5A4200u, 0x5450A0A8u, 0xA5A50000u, 0xA0A05050u, 0x5555A0A0u, 0x5A5A5050u,
+        0xAA550000u, 0xAA555500u, 0xAAAA5500u, 0x90909090u, 0x94949494u, 0xA4A4A4A4u, 0xA9A59450u, 0x2A0A4250u,
+        0xA5945040u, 0x0A425054u, 0xA5A5A500u, 0x55A0A0A0u, 0xA8A85454u, 0x6A6A4040u, 0xA4A45000u, 0x1A1A0500u,
+        0x0050A4A4u, 0xAAA59090u, 0x14696914u, 0x69691400u, 0xA08585A0u, 0xAA821414u, 0x50A4A450u, 0x6A5A0200u,
+        0xA9A58000u, 0x5090A0A8u, 0xA8A09050u, 0x24242424u, 0x00AA5500u, 0x24924924u, 0x24499224u, 0x50A50A50u,
+        0x500AA550u, 0xAAAA4444u, 0x66660000u, 0xA5A0A5A0u, 0x50A050A0u, 0x69286928u, 0x44AAAA44u, 0x66666600u,
+        0xAA444444u, 0x54A854A8u, 0x95809580u, 0x96969600u, 0xA85454A8u, 0x80959580u, 0xAA141414u, 0x96960000u,
+        0xAAAA1414u, 0xA05050A0u, 0xA0A5A5A0u, 0x96000000u, 0x40804080u, 0xA9A8A9A8u, 0xAAAAAA44u, 0x2A4A5254u
+};
+
+static constexpr std::array<uint8_t, 64> BC7_ANCHORS_2 = {
+        15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u,
+        15u, 2u, 8u, 2u, 2u, 8u, 8u, 15u, 2u, 8u, 2u, 2u, 8u, 8u, 2u, 2u,
+        15u, 15u, 6u, 8u, 2u, 8u, 15u, 15u, 2u, 8u, 2u, 2u, 2u, 15u, 15u, 6u,
+        6u, 2u, 6u, 8u, 15u, 15u, 2u, 2u, 15u, 15u, 15u, 15u, 15u, 2u, 2u, 15u
+};
+
+static constexpr std::array<uint8_t, 64> BC7_ANCHORS_3_SECOND = {
+        3u, 3u, 15u, 15u, 8u, 3u, 15u, 15u, 8u, 8u, 6u, 6u, 6u, 5u, 3u, 3u,
+        3u, 3u, 8u, 15u, 3u, 3u, 6u, 10u, 5u, 8u, 8u, 6u, 8u, 5u, 15u, 15u,
+        8u, 15u, 3u, 5u, 6u, 10u, 8u, 15u, 15u, 3u, 15u, 5u, 15u, 15u, 15u, 15u,
+        3u, 15u, 5u, 5u, 5u, 8u, 5u, 10u, 5u, 10u, 8u, 13u, 15u, 12u, 3u, 3u
+};
+
+static constexpr std::array<uint8_t, 64> BC7_ANCHORS_3_THIRD = {
+        15u, 8u, 8u, 3u, 15u, 15u, 3u, 8u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 8u,
+        15u, 8u, 15u, 3u, 15u, 8u, 15u, 8u, 3u, 15u, 6u, 10u, 15u, 15u, 10u, 8u,
+        15u, 3u, 15u, 10u, 10u, 8u, 9u, 10u, 6u, 15u, 8u, 15u, 3u, 6u, 6u, 8u,
+        15u, 3u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 15u, 3u, 15u, 15u, 8u
+};
+
+// Decodes BC1, BC3, BC5 and BC7 textures on the worker pool for devices that can not sample them. Texels come
+// out as R8G8B8A8 for BC1, BC3 and BC7 and as R8G8 for BC5, which is what those formats sample as.
+class BlockDecoder final {
+public:
+    BlockDecoder() {
+#if VKSAMPLE_X86_SIMD
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) {
+            m_kernel = lookupPaletteAvx2;
+            m_kernel_name = "avx2";
+        }
+#endif
+    }
+    
+    // Format the decoded texels are uploaded in, VK_FORMAT_UNDEFINED when format can not be decoded.
+    static VkFormat getDecodedFormat(VkFormat format) {
+        switch(format) {
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+            case VK_FORMAT_BC7_UNORM_BLOCK:
+                return VK_FORMAT_R8G8B8A8_UNORM;
+            case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+            case VK_FORMAT_BC3_SRGB_BLOCK:
+            case VK_FORMAT_BC7_SRGB_BLOCK:
+                return VK_FORMAT_R8G8B8A8_SRGB;
+            case VK_FORMAT_BC5_UNORM_BLOCK:
+                return VK_FORMAT_R8G8_UNORM;
+            default:
+                return VK_FORMAT_UNDEFINED;
+        }
+    }
+    
+    static uint32_t getDecodedTexelBytes(VkFormat format) {
+        return getDecodedFormat(format) == VK_FORMAT_R8G8_UNORM ? 2u : 4u;
+    }
+    
+    const char* kernelName() const {
+        return m_kernel_name;
+    }
+    
+    // Writes one level of width x height texels as tightly packed rows, rows of blocks are spread over the pool.
+    void decode(WorkerPool& pool, VkFormat format, const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* dst) const {
+        const uint32_t BLOCK_ROWS_PER_RANGE = 16u;
+        uint32_t blocks_x = (width + 3u) / 4u;
+        uint32_t blocks_y = (height + 3u) / 4u;
+        size_t block_bytes = getBlockBytes(format);
+        size_t texel_bytes = getDecodedTexelBytes(format);
+        pool.parallelFor(blocks_y, BLOCK_ROWS_PER_RANGE, [&](size_t begin, size_t end) {
+            std::array<uint32_t, 16> texels{};
+            for(size_t block_y = begin; block_y < end; ++block_y) {
+                for(uint32_t block_x = 0u; block_x < blocks_x; ++block_x) {
+                    decodeBlock(format, blocks + (block_y * blocks_x + block_x) * block_bytes, texels.data());
+                    
+                    uint32_t x = block_x * 4u;
+                    uint32_t y = static_cast<uint32_t>(block_y) * 4u;
+                    uint32_t columns = std::min(4u, width - x);
+                    uint32_t rows = std::min(4u, height - y);
+                    for(uint32_t row = 0u; row < rows; ++row) {
+                        uint8_t* dst_row = dst + (static_cast<size_t>(y + row) * width + x) * texel_bytes;
+                        if(texel_bytes == 4u) {
+                            memcpy(dst_row, texels.data() + row * 4u, columns * 4u);
+                        }
+                        else {
+                            for(uint32_t column = 0u; column < columns; ++column) {
+                                uint16_t texel = static_cast<uint16_t>(texels[row * 4u + column]);
+                                memcpy(dst_row + column * 2u, &texel, 2u);
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+    
+private:
+    static uint32_t expandRgb565(uint16_t color) {
+        uint32_t r = (color >> 11u) & 31u;
+        uint32_t g = (color >> 5u) & 63u;
+        uint32_t b = color & 31u;
+        return ((r << 3u) | (r >> 2u)) | ((g << 2u) | (g >> 4u)) << 8u | ((b << 3u) | (b >> 2u)) << 16u | 0xFF000000u;
+    }
+    
+    // Per channel (a * weight_a + b * weight_b) / divisor of two RGBA8 colors, alpha stays opaque.
+    static uint32_t blendColors(uint32_t a, uint32_t b, uint32_t weight_a, uint32_t weight_b, uint32_t divisor) {
+        uint32_t result = 0xFF000000u;
+        for(uint32_t shift = 0u; shift < 24u; shift += 8u) {
+            uint32_t channel = (((a >> shift) & 0xFFu) * weight_a + ((b >> shift) & 0xFFu) * weight_b) / divisor;
+            result |= channel << shift;
+        }
+        return result;
+    }
+    
+    // BC1 color half: two RGB565 endpoints and 2-bit indices. c0 <= c1 selects the 3-color mode with
+    // a transparent black entry, BC3 always decodes in the 4-color mode.
+    void decodeColorBlock(const uint8_t* block, bool allow_three_color, uint32_t transparent_alpha, uint32_t* texels) const {
+        uint16_t c0 = readLittleEndian<uint16_t>(block);
+        uint16_t c1 = readLittleEndian<uint16_t>(block + 2u);
+        std::array<uint32_t, 8> palette{};
+        palette[0] = expandRgb565(c0);
+        palette[1] = expandRgb565(c1);
+        if(c0 > c1 || !allow_three_color) {
+            palette[2] = blendColors(palette[0], palette[1], 2u, 1u, 3u);
+            palette[3] = blendColors(palette[0], palette[1], 1u, 2u, 3u);
+        }
+        else {
+            palette[2] = blendColors(palette[0], palette[1], 1u, 1u, 2u);
+            palette[3] = transparent_alpha << 24u;
+        }
+        m_kernel(palette.data(), readLittleEndian<uint32_t>(block + 4u), 2u, texels);
+    }
+    
+    // BC4 style channel: two 8-bit endpoints and 3-bit indices, a0 <= a1 adds explicit 0 and 255 entries.
+    void decodeChannelBlock(const uint8_t* block, uint32_t* texels) const {
+        uint32_t a0 = block[0];
+        uint32_t a1 = block[1];
+        std::array<uint32_t, 8> palette{};
+        palette[0] = a0;
+        palette[1] = a1;
+        if(a0 > a1) {
+            for(uint32_t i = 1u; i < 7u; ++i) {
+                palette[i + 1u] = ((7u - i) * a0 + i * a1) / 7u;
+            }
+        }
+        else {
+            for(uint32_t i = 1u; i < 5u; ++i) {
+                palette[i + 1u] = ((5u - i) * a0 + i * a1) / 5u;
+            }
+            palette[6] = 0u;
+            palette[7] = 255u;
+        }
+        uint64_t indices = 0u;
+        memcpy(&indices, block + 2u, 6u);
+        m_kernel(palette.data(), indices, 3u, texels);
+    }
+    
+    // Takes the fields of a BC7 block from bit 0 up.
+    class Bc7Bits final {
+    public:
+        explicit Bc7Bits(const uint8_t* block) {
+            m_low = readLittleEndian<uint64_t>(block);
+            m_high = readLittleEndian<uint64_t>(block + 8u);
+        }
+        
+        uint32_t read(uint32_t count) {
+            if(count == 0u) {
+                return 0u;
+            }
+            uint32_t value = static_cast<uint32_t>(m_low & ((1ull << count) - 1u));
+            m_low = (m_low >> count) | (m_high << (64u - count));
+            m_high >>= count;
+            return value;
+        }
+        
+    private:
+        uint64_t m_low;
+        uint64_t m_high;
+    };
+    
+    static uint32_t getBc7Weight(uint32_t index_bits, uint32_t index) {
+        static constexpr std::array<uint32_t, 4> WEIGHTS_2 = {0u, 21u, 43u, 64u};
+        static constexpr std::array<uint32_t, 8> WEIGHTS_3 = {0u, 9u, 18u, 27u, 37u, 46u, 55u, 64u};
+        static constexpr std::array<uint32_t, 16> WEIGHTS_4 = {0u, 4u, 9u, 13u, 17u, 21u, 26u, 30u, 34u, 38u, 43u, 47u, 51u, 55u, 60u, 64u};
+        return index_bits == 2u ? WEIGHTS_2[index] : (index_bits == 3u ? WEIGHTS_3[index] : WEIGHTS_4[index]);
+    }
+    
+    // Modes are picked by the lowest set bit of the first byte, reserved blocks decode to transparent black.
+    static void decodeBc7Block(const uint8_t* block, uint32_t* texels) {
+        uint32_t mode_index = 0u;
+        while(mode_index < 8u && !(block[0] & (1u << mode_index))) {
+            ++mode_index;
+        }
+        if(mode_index == 8u) {
+            std::fill(texels, texels + 16u, 0u);
+            return;
+        }
+        const Bc7Mode& mode = BC7_MODES[mode_index];
+        Bc7Bits bits(block);
+        bits.read(mode_index + 1u);
+        uint32_t partition = bits.read(mode.partition_bits);
+        uint32_t rotation = bits.read(mode.rotation_bits);
+        uint32_t index_selection = bits.read(mode.index_selection_bits);
+        
+        // endpoints[subset * 2 + end][channel], RGBA
+        std::array<std::array<uint32_t, 4>, 6> endpoints{};
+        uint32_t endpoint_count = mode.subset_count * 2u;
+        for(uint32_t channel = 0u; channel < 4u; ++channel) {
+            uint32_t channel_bits = channel < 3u ? mode.color_bits : mode.alpha_bits;
+            for(uint32_t i = 0u; i < endpoint_count; ++i) {
+                endpoints[i][channel] = channel_bits > 0u ? bits.read(channel_bits) : 255u;
+            }
+        }
+        
+        std::array<uint32_t, 6> p_bits{};
+        bool has_p_bits = mode.endpoint_p_bits > 0u || mode.shared_p_bits > 0u;
+        if(mode.endpoint_p_bits > 0u) {
+            for(uint32_t i = 0u; i < endpoint_count; ++i) {
+                p_bits[i] = bits.read(1u);
+            }
+        }
+        else if(mode.shared_p_bits > 0u) {
+            for(uint32_t subset = 0u; subset < mode.subset_count; ++subset) {
+                p_bits[subset * 2u] = p_bits[subset * 2u + 1u] = bits.read(1u);
+            }
+        }
+        for(uint32_t i = 0u; i < endpoint_count; ++i) {
+            for(uint32_t channel = 0u; channel < 4u; ++channel) {
+                uint32_t channel_bits = channel < 3u ? mode.color_bits : mode.alpha_bits;
+                if(channel_bits == 0u) {
+                    continue;
+                }
+                uint32_t value = endpoints[i][channel];
+                if(has_p_bits) {
+                    value = (value << 1u) | p_bits[i];
+                    ++channel_bits;
+                }
+                value <<= 8u - channel_bits;
+                endpoints[i][channel] = value | (value >> channel_bits);
+            }
+        }
+        
+        uint32_t partitions = 0u;
+        std::array<uint32_t, 3> anchors = {0u, 16u, 16u};
+        if(mode.subset_count == 2u) {
+            partitions = BC7_PARTITIONS_2[partition];
+            anchors[1] = BC7_ANCHORS_2[partition];
+        }
+        else if(mode.subset_count == 3u) {
+            partitions = BC7_PARTITIONS_3[partition];
+            anchors[1] = BC7_ANCHORS_3_SECOND[partition];
+            anchors[2] = BC7_ANCHORS_3_THIRD[partition];
+        }
+        std::array<uint32_t, 16> indices{};
+        for(uint32_t i = 0u; i < 16u; ++i) {
+            bool is_anchor = i == anchors[0] || i == anchors[1] || i == anchors[2];
+            indices[i] = bits.read(is_anchor ? mode.index_bits - 1u : mode.index_bits);
+        }
+        std::array<uint32_t, 16> secondary_indices{};
+        for(uint32_t i = 0u; i < 16u && mode.secondary_index_bits > 0u; ++i) {
+            secondary_indices[i] = bits.read(i == 0u ? mode.secondary_index_bits - 1u : mode.secondary_index_bits);
+        }
+        
+        for(uint32_t i = 0u; i < 16u; ++i) {
+            uint32_t subset = (partitions >> (i * 2u)) & 3u;
+            const std::array<uint32_t, 4>& e0 = endpoints[subset * 2u];
+            const std::array<uint32_t, 4>& e1 = endpoints[subset * 2u + 1u];
+            uint32_t color_weight = getBc7Weight(mode.index_bits, indices[i]);
+            uint32_t alpha_weight = color_weight;
+            if(mode.secondary_index_bits > 0u) {
+                // index_selection swaps which of the two index sets the color takes
+                uint32_t secondary_weight = getBc7Weight(mode.secondary_index_bits, secondary_indices[i]);
+                color_weight = index_selection ? secondary_weight : color_weight;
+                alpha_weight = index_selection ? alpha_weight : secondary_weight;
+            }
+            std::array<uint32_t, 4> texel{};
+            for(uint32_t channel = 0u; channel < 4u; ++channel) {
+                uint32_t weight = channel < 3u ? color_weight : alpha_weight;
+                texel[channel] = (e0[channel] * (64u - weight) + e1[channel] * weight + 32u) >> 6u;
+            }
+            if(rotation > 0u) {
+                std::swap(texel[3], texel[rotation - 1u]);
+            }
+            texels[i] = texel[0] | texel[1] << 8u | texel[2] << 16u | texel[3] << 24u;
+        }
+    }
+    
+    void decodeBlock(VkFormat format, const uint8_t* block, uint32_t* texels) const {
+        std::array<uint32_t, 16> channel{};
+        switch(format) {
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+                decodeColorBlock(block, true, 255u, texels);
+                break;
+            case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+                decodeColorBlock(block, true, 0u, texels);
+                break;
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+            case VK_FORMAT_BC3_SRGB_BLOCK:
+                decodeColorBlock(block + 8u, false, 255u, texels);
+                decodeChannelBlock(block, channel.data());
+                for(uint32_t i = 0u; i < 16u; ++i) {
+                    texels[i] = (texels[i] & 0x00FFFFFFu) | channel[i] << 24u;
+                }
+                break;
+            case VK_FORMAT_BC5_UNORM_BLOCK:
+                decodeChannelBlock(block, texels);
+                decodeChannelBlock(block + 8u, channel.data());
+                for(uint32_t i = 0u; i < 16u; ++i) {
+                    texels[i] |= channel[i] << 8u;
+                }
+                break;
+            case VK_FORMAT_BC7_UNORM_BLOCK:
+            case VK_FORMAT_BC7_SRGB_BLOCK:
+                decodeBc7Block(block, texels);
+                break;
+            default:
+                throw std::runtime_error("no CPU decoder for this texture format!");
+        }
+    }
+    
+    PaletteKernel m_kernel = lookupPaletteScalar;
+    const char* m_kernel_name = "scalar";
+};
+
+struct TextureLoadStats {
+    std::string file_name;
+    VkFormat file_format = VK_FORMAT_UNDEFINED;
+    VkFormat image_format = VK_FORMAT_UNDEFINED; // differs from file_format when the blocks were decoded on the CPU
+    uint32_t width = 0u;
+    uint32_t height = 0u;
+    uint32_t mip_levels = 1u;
+    size_t image_bytes = 0u;  // all levels as uploaded
+    size_t rgba8_bytes = 0u;  // the same levels in R8G8B8A8
+    const char* decode_kernel = nullptr; // nullptr - uploaded as stored
+    double decode_ms = 0.0;
+    double wait_ms = 0.0; // decoded, waiting for the upload stage
+    double load_ms = 0.0; // from the start of its load until its upload was submitted
+};
+
+struct Texture {
+    VkImage image = VK_NULL_HANDLE;
+    MemoryAllocation memory;
+    VkImageView view = VK_NULL_HANDLE;
+    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+    uint32_t width = 0u;
+    uint32_t height = 0u;
+    uint32_t mip_levels = 1u;
+};
+
+// Runs stb_image decodes on threads of its own, so the thread that owns the device keeps creating images and
+// submitting uploads meanwhile. stb_image decodes to RGBA8 into memory of its own, the job copies that into the
+// staging ring space reserved for it. Finished jobs come back from takeFinished() in completion order.
+class TextureDecodeQueue final {
+public:
+    struct Job {
+        size_t texture_index;
+        std::string file_name;
+        uint32_t width;  // from stbi_info, the decode has to agree
+        uint32_t height;
+        uint8_t* dst;    // mapped staging memory of width * height * 4 bytes, nullptr - the pixels stay in the job
+        std::unique_ptr<stbi_uc, void (*)(void*)> pixels{nullptr, stbi_image_free};
+        std::chrono::high_resolution_clock::time_point finish;
+        double decode_ms = 0.0;
+        std::string error; // empty - decoded
+    };
+    
+    void init(uint32_t threads_count) {
+        m_threads.reserve(threads_count);
+        for(uint32_t i = 0u; i < threads_count; ++i) {
+            m_threads.emplace_back(&TextureDecodeQueue::workerLoop, this);
+        }
+    }
+    
+    // Jobs that have not started are dropped, running ones are finished first.
+    void destroy() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_queue.clear();
+        }
+        m_job_ready.notify_all();
+        for(std::thread& thread : m_threads) {
+            if(thread.joinable()) {
+                thread.join();
+            }
+        }
+        m_threads.clear();
+    }
+    
+    uint32_t threadCount() const {
+        return static_cast<uint32_t>(m_threads.size());
+    }
+    
+    void push(Job job) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.push_back(std::move(job));
+            ++m_in_flight;
+        }
+        m_job_ready.notify_one();
+    }
+    
+    size_t inFlight() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_in_flight;
+    }
+    
+    // Blocks until at least one job is done and returns all the finished ones, nothing when none is in flight.
+    std::vector<Job> takeFinished() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_job_done.wait(lock, [this]() { return !m_finished.empty() || m_in_flight == 0u; });
+        std::vector<Job> finished = std::move(m_finished);
+        m_finished.clear();
+        m_in_flight -= finished.size();
+        return finished;
+    }
+    
+private:
+    static void decode(Job& job) {
+        int tex_width;
+        int tex_height;
+        int tex_channels;
+        job.pixels.reset(stbi_load(job.file_name.c_str(), &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha));
+        if(!job.pixels) {
+            job.error = "failed to load texture image: " + job.file_name + "\n";
+            return;
+        }
+        if(static_cast<uint32_t>(tex_width) != job.width || static_cast<uint32_t>(tex_height) != job.height) {
+            job.error = "texture image changed while loading: " + job.file_name + "\n";
+        }
+        else if(job.dst) {
+            memcpy(job.dst, job.pixels.get(), static_cast<size_t>(job.width) * job.height * 4u);
+            job.pixels.reset();
+        }
+    }
+    
+    void workerLoop() {
+        while(true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_job_ready.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+                if(m_stop) {
+                    return;
+                }
+                job = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            
+            auto decode_start = std::chrono::high_resolution_clock::now();
+            decode(job);
+            job.finish = std::chrono::high_resolution_clock::now();
+            job.decode_ms = elapsedMs(decode_start, job.finish);
+            
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_finished.push_back(std::move(job));
+            }
+            m_job_done.notify_one();
+        }
+    }
+    
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_job_ready;
+    std::condition_variable m_job_done;
+    std::deque<Job> m_queue;
+    std::vector<Job> m_finished;
+    size_t m_in_flight = 0u; // pushed and not yet taken back
+    bool m_stop = false;
+};
+
+template<typename T>
+static void writeLittleEndian(uint8_t* data, T value) {
+    memcpy(data, &value, sizeof(T));
+}
+
+// Lanczos window with a = 2, sharper than the box and bilinear filters of blits without their aliasing.
+static float lanczos2(float x) {
+    x = std::abs(x);
+    if(x < 1e-5f) {
+        return 1.0f;
+    }
+    if(x >= 2.0f) {
+        return 0.0f;
+    }
+    float pi_x = std::numbers::pi_v<float> * x;
+    return 2.0f * std::sin(pi_x) * std::sin(0.5f * pi_x) / (pi_x * pi_x);
+}
+
+// Resampling of one axis: destination texel i sums taps source texels sources[i * taps + k] with weights[i * taps + k].
+// The sources wrap around the edges like the REPEAT sampler, so tiling textures keep their seams.
+struct MipFilterAxis {
+    uint32_t taps = 0u;
+    std::vector<uint32_t> sources;
+    std::vector<float> weights;
+    
+    MipFilterAxis(uint32_t src_size, uint32_t dst_size) {
+        const float FILTER_RADIUS = 2.0f;
+        float scale = static_cast<float>(src_size) / static_cast<float>(dst_size);
+        float support = FILTER_RADIUS * scale;
+        taps = static_cast<uint32_t>(std::ceil(2.0f * support)) + 1u;
+        sources.resize(static_cast<size_t>(dst_size) * taps);
+        weights.resize(static_cast<size_t>(dst_size) * taps);
+        for(uint32_t i = 0u; i < dst_size; ++i) {
+            float center = (static_cast<float>(i) + 0.5f) * scale;
+            int64_t first = static_cast<int64_t>(std::floor(center - support + 0.5f));
+            float weight_sum = 0.0f;
+            for(uint32_t k = 0u; k < taps; ++k) {
+                int64_t source = first + k;
+                float weight = lanczos2((static_cast<float>(source) + 0.5f - center) / scale);
+                sources[i * taps + k] = static_cast<uint32_t>(((source % src_size) + src_size) % src_size);
+                weights[i * taps + k] = weight;
+                weight_sum += weight;
+            }
+            for(uint32_t k = 0u; k < taps; ++k) {
+                weights[i * taps + k] /= weight_sum;
+            }
+        }
+    }
+};
+
+// Offline half of the texture pipeline: reads an image, builds its whole mip chain on the worker pool and
+// writes the levels to an R8G8B8A8_SRGB KTX2 file that loadTextureContainer() uploads without blits.
+// Every level is filtered from the one above it in linear space with a separable Lanczos filter,
+// texels are kept as four floats so that one SSE register holds a texel.
+class TextureCooker final {
+public:
+    explicit TextureCooker(WorkerPool& pool) : m_pool(pool) {
+        for(uint32_t i = 0u; i < 256u; ++i) {
+            float value = static_cast<float>(i) / 255.0f;
+            m_srgb_to_linear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+        }
+        m_linear_to_srgb.resize(LINEAR_STEPS + 1u);
+        for(uint32_t i = 0u; i <= LINEAR_STEPS; ++i) {
+            float value = static_cast<float>(i) / static_cast<float>(LINEAR_STEPS);
+            float srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+            m_linear_to_srgb[i] = static_cast<uint8_t>(std::lround(srgb * 255.0f));
+        }
+    }
+    
+    void cook(const std::string& input_file, const std::string& output_file) {
+        using clock = std::chrono::high_resolution_clock;
+        auto cook_start = clock::now();
+        int tex_width;
+        int tex_height;
+        int tex_channels;
+        stbi_uc* pixels = stbi_load(input_file.c_str(), &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha);
+        if(!pixels) {
+            throw std::runtime_error("failed to load texture image: " + input_file + "\n");
+        }
+        uint32_t width = static_cast<uint32_t>(tex_width);
+        uint32_t height = static_cast<uint32_t>(tex_height);
+        uint32_t mip_levels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1u;
+        
+        std::vector<float> level(static_cast<size_t>(width) * height * 4u);
+        m_pool.parallelFor(height, ROWS_PER_RANGE, [&](size_t begin, size_t end) {
+            for(size_t i = begin * width * 4u; i < end * width * 4u; ++i) {
+                level[i] = (i & 3u) == 3u ? static_cast<float>(pixels[i]) / 255.0f : m_srgb_to_linear[pixels[i]];
+            }
+        });
+        stbi_image_free(pixels);
+        double decode_ms = elapsedMs(cook_start, clock::now());
+        
+        auto mips_start = clock::now();
+        std::vector<std::vector<uint8_t>> levels(mip_levels);
+        std::vector<float> next_level;
+        for(uint32_t mip = 0u; mip < mip_levels; ++mip) {
+            uint32_t level_width = std::max(1u, width >> mip);
+            uint32_t level_height = std::max(1u, height >> mip);
+            levels[mip].resize(static_cast<size_t>(level_width) * level_height * 4u);
+            encode(level, level_width, level_height, levels[mip].data());
+            if(mip + 1u < mip_levels) {
+                downsample(level, level_width, level_height, next_level, std::max(1u, level_width / 2u), std::max(1u, level_height / 2u));
+                level.swap(next_level);
+            }
+        }
+        double mips_ms = elapsedMs(mips_start, clock::now());
+        
+        size_t file_size = writeKtx2(output_file, width, height, levels);
+        std::cout << "cooked " << input_file << " -> " << output_file << ": " << width << "x" << height << ", " << mip_levels << " levels, "
+                  << file_size / 1000000.0 << " MB, decode " << decode_ms << " ms, mips " << mips_ms << " ms, total "
+                  << elapsedMs(cook_start, clock::now()) << " ms on " << m_pool.threadCount() + 1u << " threads" << std::endl;
+    }
+    
+private:
+    static const uint32_t LINEAR_STEPS = 65535u;
+    static const size_t ROWS_PER_RANGE = 8u;
+    
+    // Horizontal pass into a width-reduced copy, then the vertical pass, both split into rows over the pool.
+    void downsample(const std::vector<float>& src, uint32_t src_width, uint32_t src_height, std::vector<float>& dst, uint32_t dst_width, uint32_t dst_height) {
+        MipFilterAxis horizontal(src_width, dst_width);
+        MipFilterAxis vertical(src_height, dst_height);
+        m_rows.resize(static_cast<size_t>(dst_width) * src_height * 4u);
+        dst.resize(static_cast<size_t>(dst_width) * dst_height * 4u);
+        
+        m_pool.parallelFor(src_height, ROWS_PER_RANGE, [&](size_t begin, size_t end) {
+            for(size_t y = begin; y < end; ++y) {
+                const float* src_row = src.data() + y * src_width * 4u;
+                float* dst_row = m_rows.data() + y * dst_width * 4u;
+                for(uint32_t x = 0u; x < dst_width; ++x) {
+                    const uint32_t* sources = horizontal.sources.data() + static_cast<size_t>(x) * horizontal.taps;
+                    const float* weights = horizontal.weights.data() + static_cast<size_t>(x) * horizontal.taps;
+#if VKSAMPLE_X86_SIMD
+                    __m128 texel = _mm_setzero_ps();
+                    for(uint32_t k = 0u; k < horizontal.taps; ++k) {
+                        texel = _mm_add_ps(texel, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(src_row + sources[k] * 4u)));
+                    }
+                    _mm_storeu_ps(dst_row + x * 4u, texel);
+#else
+                    for(uint32_t c = 0u; c < 4u; ++c) {
+                        float texel = 0.0f;
+                        for(uint32_t k = 0u; k < horizontal.taps; ++k) {
+                            texel += weights[k] * src_row[sources[k] * 4u + c];
+                        }
+                        dst_row[x * 4u + c] = texel;
+                    }
+#endif
+                }
+            }
+        });
+        
+        size_t row_floats = static_cast<size_t>(dst_width) * 4u;
+        m_pool.parallelFor(dst_height, ROWS_PER_RANGE, [&](size_t begin, size_t end) {
+            for(size_t y = begin; y < end; ++y) {
+                float* dst_row = dst.data() + y * row_floats;
+                std::fill(dst_row, dst_row + row_floats, 0.0f);
+                for(uint32_t k = 0u; k < vertical.taps; ++k) {
+                    const float* src_row = m_rows.data() + vertical.sources[y * vertical.taps + k] * row_floats;
+                    float weight = vertical.weights[y * vertical.taps + k];
+#if VKSAMPLE_X86_SIMD
+                    __m128 weight4 = _mm_set1_ps(weight);
+                    for(size_t i = 0u; i < row_floats; i += 4u) {
+                        _mm_storeu_ps(dst_row + i, _mm_add_ps(_mm_loadu_ps(dst_row + i), _mm_mul_ps(weight4, _mm_loadu_ps(src_row + i))));
+                    }
+#else
+                    for(size_t i = 0u; i < row_floats; ++i) {
+                        dst_row[i] += weight * src_row[i];
+                    }
+#endif
+                }
+            }
+        });
+    }
+    
+    // Back to sRGB color and linear alpha, the filter overshoots are clamped away here.
+    void encode(const std::vector<float>& src, uint32_t width, uint32_t height, uint8_t* dst) {
+        m_pool.parallelFor(height, ROWS_PER_RANGE, [&](size_t begin, size_t end) {
+            for(size_t i = begin * width * 4u; i < end * width * 4u; ++i) {
+                float value = std::clamp(src[i], 0.0f, 1.0f);
+                dst[i] = (i & 3u) == 3u ? static_cast<uint8_t>(value * 255.0f + 0.5f) : m_linear_to_srgb[static_cast<size_t>(value * LINEAR_STEPS + 0.5f)];
+            }
+        });
+    }
+    
+    // KTX2 with a basic data format descriptor for R8G8B8A8_SRGB. The levels are stored smallest first,
+    // as the format recommends for streaming, the level index still goes from level 0.
+    static size_t writeKtx2(const std::string& file_name, uint32_t width, uint32_t height, const std::vector<std::vector<uint8_t>>& levels) {
+        const std::array<uint8_t, 12> KTX2_IDENTIFIER = {0xABu, 0x4Bu, 0x54u, 0x58u, 0x20u, 0x32u, 0x30u, 0xBBu, 0x0Du, 0x0Au, 0x1Au, 0x0Au};
+        const size_t HEADER_SIZE = 80u;
+        const size_t LEVEL_INDEX_ENTRY_SIZE = 24u;
+        const uint32_t DFD_BLOCK_SIZE = 24u + 16u * 4u; // block header and one sample per channel
+        const uint32_t DFD_SIZE = 4u + DFD_BLOCK_SIZE;
+        
+        size_t dfd_offset = HEADER_SIZE + LEVEL_INDEX_ENTRY_SIZE * levels.size();
+        size_t data_size = 0u;
+        for(const std::vector<uint8_t>& level : levels) {
+            data_size += level.size(); // RGBA8 levels keep the 4 byte alignment on their own
+        }
+        std::vector<uint8_t> file(dfd_offset + DFD_SIZE + data_size, 0u);
+        
+        std::copy(KTX2_IDENTIFIER.begin(), KTX2_IDENTIFIER.end(), file.begin());
+        writeLittleEndian<uint32_t>(file.data() + 12u, VK_FORMAT_R8G8B8A8_SRGB);
+        writeLittleEndian<uint32_t>(file.data() + 16u, 1u); // type size
+        writeLittleEndian<uint32_t>(file.data() + 20u, width);
+        writeLittleEndian<uint32_t>(file.data() + 24u, height);
+        writeLittleEndian<uint32_t>(file.data() + 36u, 1u); // faces
+        writeLittleEndian<uint32_t>(file.data() + 40u, static_cast<uint32_t>(levels.size()));
+        writeLittleEndian<uint32_t>(file.data() + 48u, static_cast<uint32_t>(dfd_offset));
+        writeLittleEndian<uint32_t>(file.data() + 52u, DFD_SIZE);
+        
+        uint8_t* dfd = file.data() + dfd_offset;
+        writeLittleEndian<uint32_t>(dfd, DFD_SIZE);
+        writeLittleEndian<uint32_t>(dfd + 8u, 2u | DFD_BLOCK_SIZE << 16u);  // version 2
+        writeLittleEndian<uint32_t>(dfd + 12u, 1u | 1u << 8u | 2u << 16u); // RGBSDA model, BT.709 primaries, sRGB transfer
+        writeLittleEndian<uint32_t>(dfd + 20u, 4u);                         // bytes in plane 0
+        for(uint32_t channel = 0u; channel < 4u; ++channel) {
+            uint32_t channel_type = channel == 3u ? 15u | 0x10u : channel; // alpha is flagged linear
+            uint8_t* sample = dfd + 28u + channel * 16u;
+            writeLittleEndian<uint32_t>(sample, channel * 8u | 7u << 16u | channel_type << 24u);
+            writeLittleEndian<uint32_t>(sample + 12u, 255u);
+        }
+        
+        size_t level_offset = dfd_offset + DFD_SIZE;
+        for(size_t mip = levels.size(); mip-- > 0u;) {
+            uint8_t* entry = file.data() + HEADER_SIZE + LEVEL_INDEX_ENTRY_SIZE * mip;
+            writeLittleEndian<uint64_t>(entry, level_offset);
+            writeLittleEndian<uint64_t>(entry + 8u, levels[mip].size());
+            writeLittleEndian<uint64_t>(entry + 16u, levels[mip].size());
+            std::copy(levels[mip].begin(), levels[mip].end(), file.begin() + static_cast<std::ptrdiff_t>(level_offset));
+            level_offset += levels[mip].size();
+        }
+        
+        std::ofstream out(file_name, std::ios::binary);
+        if(!out.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()))) {
+            throw std::runtime_error("failed to write cooked texture: " + file_name + "\n");
+        }
+        return file.size();
+    }
+    
+    WorkerPool& m_pool;
+    std::array<float, 256> m_srgb_to_linear{};
+    std::vector<uint8_t> m_linear_to_srgb;
+    std::vector<float> m_rows; // horizontal pass output, dst_width x src_height
+};
+
+// Copy out of the staging ring that is recorded into the next frame, or flushed immediately.
+struct PendingBufferUpload {
+    VkBuffer dst_buffer;
+    VkBufferCopy region;
+};
+
+// Copies out of the staging ring into some mip levels of a texture, one region per level.
+// All mip levels are left in TRANSFER_DST_OPTIMAL.
+struct PendingImageUpload {
+    VkImage dst_image;
+    std::vector<VkBufferImageCopy> regions;
+    uint32_t mip_levels;
+    // images staged over several submissions only leave UNDEFINED before the first part and change owner after the last
+    bool is_first_part;
+    bool is_last_part;
+};
+
+// Completion point of a submission on a timeline semaphore. A default constructed ticket is already complete.
+struct UploadTicket {
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    uint64_t value = 0u;
+};
+
+// Timeline semaphore signaled by every single-time submission to one queue, so its values grow in submission order.
+struct SubmissionTimeline {
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    uint64_t last_value = 0u;
+    std::vector<std::pair<uint64_t, VkCommandBuffer>> in_flight; // freed once the semaphore reaches the value
+};
+
+// Set 1 of the graphics pipeline. Both blocks live in the UniformArena and are bound with dynamic offsets,
+// one FrameUniforms per frame and one ObjectUniforms per draw.
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 proj;
+    glm::vec4 position_offset; // packed positions: offset + unorm * scale, identity for float vertices
+    glm::vec4 position_scale;
+};
+
+struct ObjectUniforms {
+    glm::mat4 model;
+};
+
+// Objects replaced by a resize, a render scale change or a shader reload. Frames still in flight may use them,
+// so they are destroyed once MAX_FRAMES_IN_FLIGHT frames have started after frame_number.
+struct RetiredSwapchain {
+    uint64_t frame_number = 0u;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    std::vector<VkImageView> views;
+    std::vector<VkFramebuffer> framebuffers;
+    RenderGraphTransients transients;
+    std::vector<VkPipeline> pipelines;
+};
+
+enum class ShaderTarget {
+    SceneVertex,
+    SceneFragment,
+    Cull
+};
+
+struct ShaderFile {
+    std::string glsl_path;
+    ShaderTarget target;
+    const char* origin; // how it was loaded at startup
+    double load_ms;
+};
+
+// Everything but the shaders that scene pipelines are created from. It is a copy, so the shader watcher can build
+// pipelines while the main thread goes on with the frame.
+struct ScenePipelineDesc {
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkRenderPass render_pass = VK_NULL_HANDLE; // null - dynamic rendering
+    VkFormat color_format = VK_FORMAT_UNDEFINED;
+    VkFormat depth_format = VK_FORMAT_UNDEFINED;
+    VertexFormat vertex_format = VertexFormat::Float;
+    std::vector<VkSampleCountFlagBits> sample_levels; // one pipeline each
+};
+
+class HelloTriangleApplication {
+public:
+    HelloTriangleApplication(AppOptions options) : m_options(std::move(options)) {}
+    
+    void setFrameConsumer(FrameConsumer consumer) {
+        m_frame_consumer = std::move(consumer);
+    }
+    
+    void run() {
+        if(!m_options.headless) {
+            initMainWindow();
+        }
+        initVulkan();
+        mainLoop();
+        cleanup();
+    }
+
+private:
+    AppOptions m_options;
+    FrameConsumer m_frame_consumer;
+    GLFWwindow* m_window = nullptr;
+    VkInstance m_vk_instance = VK_NULL_HANDLE;;
+    std::unordered_set<std::string> m_available_instance_ext;
+    std::unordered_set<std::string> m_available_device_ext;
+    std::unordered_set<std::string> m_validation_layers;
+    VkDebugUtilsMessengerEXT m_debug_messenger = VK_NULL_HANDLE;;
+    VkPhysicalDevice m_physical_device = VK_NULL_HANDLE;
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkQueue m_graphics_queue = VK_NULL_HANDLE;
+    VkQueue m_transfer_queue = VK_NULL_HANDLE;
+    VkQueue m_present_queue = VK_NULL_HANDLE;
+    VkSurfaceKHR m_surface = VK_NULL_HANDLE;
+    VkSwapchainKHR m_swapchain = VK_NULL_HANDLE;
+    std::vector<VkImage> m_swapchain_images;
+    std::vector<VkImageView> m_swapchain_views;
+    std::vector<VkFramebuffer> m_swapchain_framebuffers;
+    SwapchainParams m_swapchain_params;
+    SwapchainSupportDetails m_swapchain_support_details;
+    VkDescriptorSetLayout m_texture_set_layout = VK_NULL_HANDLE; // set 0
+    VkDescriptorSetLayout m_uniform_set_layout = VK_NULL_HANDLE; // set 1
+    VkPipelineLayout m_pipeline_layout = VK_NULL_HANDLE;
+    VkRenderPass m_render_pass = VK_NULL_HANDLE;
+    VkShaderModule m_vert_shader_modeule = VK_NULL_HANDLE;
+    VkShaderModule m_frag_shader_modeule = VK_NULL_HANDLE;
+    VkPipeline m_graphics_pipeline = VK_NULL_HANDLE;
+    VkCommandPool m_grapics_cmd_pool = VK_NULL_HANDLE;
+    VkCommandPool m_transfer_cmd_pool = VK_NULL_HANDLE;
+    DescriptorLayoutCache m_desc_layout_cache;
+    DescriptorAllocator m_desc_allocator; // uniform and culling sets are allocated anew every frame from pools of that frame slot
+    DescriptorTemplateFunctions m_desc_template_functions;
+    DescriptorWriter m_uniform_writer;
+    std::array<VkDescriptorBufferInfo, 2> m_uniform_desc_data{}; // frame and object block windows, moved by the dynamic offsets
+    VkDescriptorPool m_texture_desc_pool = VK_NULL_HANDLE; // holds m_texture_set only, update-after-bind with bindless textures
+    VkDescriptorSet m_texture_set = VK_NULL_HANDLE; // allocated once, writeTextureDescriptors() rewrites the slots that change
+    std::vector<VkDescriptorSet> m_uniform_sets;
+    std::vector<VkCommandBuffer> m_command_buffers;
+    std::vector<VkSemaphore> m_image_available; // signaled when the presentation engine is finished using the image.
+    std::vector<VkSemaphore> m_render_finished;
+    std::vector<VkFence> m_in_flight_frame; // will be signaled when the command buffers finish
+    uint32_t m_current_frame = 0u;
+    bool m_framebuffer_resized = false;
+    std::deque<RetiredSwapchain> m_retired_swapchains;
+    uint32_t m_swapchain_recreations = 0u;
+    VkBuffer m_vertex_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_vertex_memory;
+    VkBuffer m_index_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_index_memory;
+    uint32_t m_index_count = 0u;
+    VkIndexType m_index_type = VK_INDEX_TYPE_UINT16;
+    BoundingBox m_mesh_box{};
+    std::optional<MeshLoadStats> m_mesh_stats; // set when the mesh came from a file
+    VkBuffer m_instance_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_instance_memory;
+    std::vector<InstanceData> m_instances;
+    float m_scene_radius = 1.0f; // bounds all instances, keeps them in view
+    glm::mat4 m_cull_matrix = glm::mat4(1.0f); // proj * view * model of the frame being recorded
+    glm::vec4 m_mesh_sphere = glm::vec4(0.0f);
+    bool m_gpu_cull_enabled = false;
+    VkShaderModule m_cull_shader_module = VK_NULL_HANDLE;
+    VkDescriptorSetLayout m_cull_desc_set_layout = VK_NULL_HANDLE;
+    VkPipelineLayout m_cull_pipeline_layout = VK_NULL_HANDLE;
+    VkPipeline m_cull_pipeline = VK_NULL_HANDLE;
+    DescriptorWriter m_cull_desc_writer;
+    std::vector<std::array<VkDescriptorBufferInfo, 4>> m_cull_desc_data;
+    std::vector<VkDescriptorSet> m_cull_desc_sets;
+    std::vector<VkBuffer> m_culled_instance_buffers; // per frame, the instances that survived GPU culling
+    std::vector<MemoryAllocation> m_culled_instance_memory;
+    std::vector<VkBuffer> m_indirect_buffers; // per frame, the one instanced draw of the survivors
+    std::vector<MemoryAllocation> m_indirect_memory;
+    std::vector<VkBuffer> m_indirect_count_buffers;
+    std::vector<MemoryAllocation> m_indirect_count_memory;
+    bool m_cpu_cull_enabled = false;
+    CpuCuller m_cpu_culler;
+    WorkerPool m_worker_pool;
+    std::vector<VkBuffer> m_visible_instance_buffers; // per frame, the instances that survived CPU culling
+    std::vector<MemoryAllocation> m_visible_instance_memory;
+    VkBuffer m_uniform_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_uniform_memory;
+    UniformArena m_uniform_arena;
+    uint32_t m_frame_uniform_offset = 0u;
+    std::vector<uint32_t> m_object_uniform_offsets; // one per entry of m_draw_list
+    std::vector<Texture> m_textures;
+    std::vector<TextureLoadStats> m_texture_stats;
+    double m_texture_load_ms = 0.0;
+    VkSampler m_texture_sampler = VK_NULL_HANDLE;
+    VkSampleCountFlagBits m_msaa_samples = VK_SAMPLE_COUNT_1_BIT;
+    RenderGraph m_render_graph; // owns the multisampled color and the depth attachment
+    RenderGraph::ResourceId m_graph_backbuffer = RenderGraph::INVALID_RESOURCE;
+    RenderGraph::ResourceId m_graph_color = RenderGraph::INVALID_RESOURCE; // invalid when dynamic rendering has nothing to resolve
+    RenderGraph::ResourceId m_graph_depth = RenderGraph::INVALID_RESOURCE;
+    RenderGraph::ResourceId m_graph_scene = RenderGraph::INVALID_RESOURCE; // what the scene resolves into, the backbuffer unless scaled
+    VkExtent2D m_render_extent{}; // extent of the scene attachments
+    bool m_dynamic_resolution_enabled = false; // m_resolution_controller picks m_render_extent and m_msaa_samples
+    bool m_render_settings_changed = false;
+    ResolutionController m_resolution_controller;
+    std::map<VkSampleCountFlagBits, VkPipeline> m_msaa_pipelines; // dynamic resolution only, m_graphics_pipeline is one of them
+    std::vector<MemoryAllocation> m_offscreen_memory; // headless only, backs m_swapchain_images
+    std::vector<VkBuffer> m_readback_buffers;
+    std::vector<MemoryAllocation> m_readback_memory;
+    std::vector<void*> m_readback_mapped;
+    std::vector<std::optional<uint64_t>> m_readback_pending; // frame number waiting in each readback buffer
+    uint64_t m_frame_number = 0u;
+    FrameTimings m_frame_timings;
+    BenchmarkRecorder m_benchmark;
+    GpuProfiler m_gpu_profiler;
+    DeviceMemoryAllocator m_allocator;
+    VkBuffer m_staging_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_staging_memory;
+    RingAllocator m_staging_ring;
+    std::vector<PendingBufferUpload> m_pending_uploads;
+    std::vector<PendingImageUpload> m_pending_image_uploads;
+    std::vector<VkBufferMemoryBarrier> m_pending_buffer_acquires; // ownership acquires the graphics queue still has to record
+    std::vector<VkImageMemoryBarrier> m_pending_image_acquires;
+    UploadTicket m_upload_wait_ticket; // last transfer submission the next frame has to wait on
+    SubmissionTimeline m_graphics_timeline;
+    SubmissionTimeline m_transfer_timeline;
+    QueueFamilyIndices m_queue_family_indices;
+    bool m_timeline_supported = false;
+    bool m_creation_feedback_supported = false;
+    VertexFormat m_vertex_format = VertexFormat::Float;
+    PipelineCache m_pipeline_cache;
+    ShaderCompiler m_shader_compiler;
+    ShaderWatcher m_shader_watcher;
+    std::vector<ShaderFile> m_shader_files; // every loaded shader, in the order the watcher knows them
+    std::vector<std::vector<uint32_t>> m_shader_code; // latest SPIR-V of each file, only the watcher thread touches it once it runs
+    ScenePipelineDesc m_scene_pipeline_desc; // changes only under m_shader_watcher.pause()
+    uint64_t m_scene_pipeline_generation = 0u; // bumped with every new m_scene_pipeline_desc
+    uint32_t m_shader_reloads = 0u;
+    RecordWorkers m_record_workers;
+    std::vector<VkDrawIndexedIndirectCommand> m_draw_list;
+    PFN_vkWaitSemaphores m_pfnWaitSemaphores = nullptr;
+    PFN_vkGetSemaphoreCounterValue m_pfnGetSemaphoreCounterValue = nullptr;
+    bool m_draw_indirect_count_supported = false;
+    bool m_bindless_enabled = false; // binding 1 is an array of m_bindless_capacity textures indexed by material
+    uint32_t m_bindless_capacity = 1u;
+    PFN_vkCmdDrawIndexedIndirectCount m_pfnCmdDrawIndexedIndirectCount = nullptr;
+    bool m_dynamic_rendering_enabled = false; // m_render_pass and the framebuffers stay null
+    PFN_vkCmdBeginRendering m_pfnCmdBeginRendering = nullptr;
+    PFN_vkCmdEndRendering m_pfnCmdEndRendering = nullptr;
+    PFN_vkCmdPipelineBarrier2 m_pfnCmdPipelineBarrier2 = nullptr; // null - the render graph records vkCmdPipelineBarrier
+    std::chrono::high_resolution_clock::time_point m_benchmark_start;
+    std::chrono::high_resolution_clock::time_point m_benchmark_end;
+    PFN_vkDebugMarkerSetObjectNameEXT m_pfnDebugMarkerSetObjectNameEXT;
+    
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& memory) {
+        VkBufferCreateInfo buffer_info{};
+        buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        buffer_info.size = size;
+        buffer_info.usage = usage;
+        // uploads hand ownership over from the transfer family explicitly, see recordPendingUploads()
+        buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        
+        VkResult result = vkCreateBuffer(m_device, &buffer_info, nullptr, &buffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create buffer!");
+        }
+        
+        memory = createMemory(buffer, properties);
+        vkBindBufferMemory(m_device, buffer, memory.memory, memory.offset);
+    }
+    
+    
+    
+    static void framebuffer_resize_callback(GLFWwindow* window, int width, int height) {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        app->m_framebuffer_resized = true;
+    }
+        
+    void initMainWindow() {
+        glfwInit();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        //glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        m_window = glfwCreateWindow(WIDTH, HEIGHT, WINDOW_TITLE, nullptr, nullptr);
+        glfwSetWindowUserPointer(m_window, this);
+        glfwSetFramebufferSizeCallback(m_window, framebuffer_resize_callback);
+    }
+    
+    uint32_t getVkApiVersion() {
+        uint32_t api_version = VK_API_VERSION_1_0;
+        VkResult result = vkEnumerateInstanceVersion(&api_version);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to get Vulkan API version!");
+        }
+        return api_version;
+    }
+    
+    std::vector<const char*> getRequiredInstanceExtensions() {
+		std::vector<const char*> extensions;
+		if (!m_options.headless) {
+			uint32_t glfw_extension_count = 0;
+			const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+			extensions.assign(glfw_extensions, glfw_extensions + glfw_extension_count);
+		}
+		if (ENABLE_VALIDATION_LAYERS) {
+			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		}
+#ifdef __APPLE__
+        extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
+#endif
+#ifndef NDEBUG
+        extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+#endif
+		return extensions;
+	}
+ 
+    std::vector<const char*> getRequiredValidationLayers() {
+		std::vector<const char*> layers;
+		if (ENABLE_VALIDATION_LAYERS) {
+			layers.insert(layers.begin(), VALIDATION_LAYERS.cbegin(), VALIDATION_LAYERS.cend());
+		}
+		return layers;
+	}
+ 
+    std::unordered_set<std::string> getAvailableInstanceExtensions() {
+        uint32_t ext_count = 0u;
+        VkResult result = vkEnumerateInstanceExtensionProperties(nullptr, &ext_count, nullptr);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to read instance properties!");
+        }
+        std::vector<VkExtensionProperties> ext_props(ext_count);
+        result = vkEnumerateInstanceExtensionProperties(nullptr, &ext_count, ext_props.data());
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to read instance properties!");
+        }
+        std::unordered_set<std::string> available_ext;
+        available_ext.reserve(ext_count);
+        for(const VkExtensionProperties& prop : ext_props) {
+            available_ext.insert(std::string(prop.extensionName));
+        }
+        
+        return available_ext;
+    }
+    
+    std::vector<const char*> getRequiredDeviceExtensions() {
+        std::vector<const char*> extensions;
+        for(const char* name : DEVICE_EXTENSIONS) {
+            if(m_options.headless && std::string_view(name) == VK_KHR_SWAPCHAIN_EXTENSION_NAME) {
+                continue;
+            }
+            extensions.push_back(name);
+        }
+#ifdef __APPLE__
+        extensions.push_back("VK_KHR_portability_subset");
+#endif
+        return extensions;
+    }
+    
+    std::unordered_set<std::string> getAvailableValidationLayers() {
+        uint32_t layers_count = 0u;
+        VkResult result = vkEnumerateInstanceLayerProperties(&layers_count, nullptr);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to read validation layer properties!");
+        }
+        std::vector<VkLayerProperties> layer_props(layers_count);
+        result = vkEnumerateInstanceLayerProperties(&layers_count, layer_props.data());
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to read validation layer properties!");
+        }
+        std::unordered_set<std::string> validation_layers; 
+        validation_layers.reserve(layers_count);
+        for(const VkLayerProperties& prop : layer_props) {
+            validation_layers.insert(std::string(prop.layerName));
+        }
+        
+        return validation_layers;
+    }
+    
+    void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& messanger_info) {
+        messanger_info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+        messanger_info.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+        messanger_info.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+        messanger_info.pfnUserCallback = debugCallback;
+        messanger_info.pUserData = (void*)this;
+    }
+    
+     VkDebugUtilsMessengerEXT setupDebugMessanger() {
+        if(!ENABLE_VALIDATION_LAYERS) return VK_NULL_HANDLE;
+        
+        VkDebugUtilsMessengerCreateInfoEXT messanger_info{};
+        populateDebugMessengerCreateInfo(messanger_info);
         
         VkDebugUtilsMessengerEXT debug_messanger = VK_NULL_HANDLE;
         VkResult result = CreateDebugUtilsMessengerEXT(m_vk_instance, &messanger_info, nullptr, &debug_messanger);
@@ -576,7 +5218,7 @@ private:
         size_t ct = views.size();
         std::vector<VkFramebuffer> result_framebuffers(ct);
         for(size_t i = 0u; i < ct; ++i) {
-            std::array<VkImageView, 3> attachments = {m_color_image_view, m_depth_view, views[i]};
+            std::array<VkImageView, 3> attachments = {m_render_graph.getView(m_graph_color), m_render_graph.getView(m_graph_depth), views[i]};
             //std::array<VkImageView, 3> attachments = {views[i], m_depth_view, m_color_image_view};
             VkFramebufferCreateInfo framebuffer_info{};
             framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -601,82 +5243,106 @@ private:
         return result_framebuffers;
     }
     
-    void createDescSets() {
-        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_desc_set_layout);
+    // Only the uniform set and, with GPU culling, the culling set are allocated every frame, the pools hold the
+    // average of their layouts. The texture set has a pool of its own.
+    void createDescAllocator() {
+        // 2 dynamic uniform buffers in the uniform layout, 4 storage buffers in the culling one
+        std::vector<VkDescriptorPoolSize> sizes_per_set = {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2u}};
+        if(m_gpu_cull_enabled) {
+            sizes_per_set[0].descriptorCount = 1u;
+            sizes_per_set.push_back({VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2u});
+        }
+        m_desc_allocator.init(m_device, MAX_FRAMES_IN_FLIGHT, std::move(sizes_per_set), 0u);
+    }
     
-        VkDescriptorSetAllocateInfo alloc_info{};
-        alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        alloc_info.descriptorPool = m_desc_pool;
-        alloc_info.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-        alloc_info.pSetLayouts = layouts.data();
+    // The texture set never goes back to a pool, so the bindless array is written once instead of every frame.
+    void createTextureDescriptorSet() {
+        VkDescriptorPoolSize pool_size{};
+        pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        pool_size.descriptorCount = m_bindless_enabled ? m_bindless_capacity : 1u;
         
-        m_desc_sets.resize(MAX_FRAMES_IN_FLIGHT);
-        VkResult result = vkAllocateDescriptorSets(m_device, &alloc_info, m_desc_sets.data());
-        if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate descriptor sets!");
-        }
+        VkDescriptorPoolCreateInfo pool_info{};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.flags = m_bindless_enabled ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT : 0u;
+        pool_info.maxSets = 1u;
+        pool_info.poolSizeCount = 1u;
+        pool_info.pPoolSizes = &pool_size;
         
-        for(size_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-            VkDescriptorBufferInfo buffer_info{};
-            buffer_info.buffer = m_uniform_buffers[i];
-            buffer_info.offset = 0u;
-            buffer_info.range = sizeof(UniformBufferObject);
-            
-            VkDescriptorImageInfo image_info{};
-            image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            image_info.imageView = m_texture_view;
-            image_info.sampler = m_texture_sampler;
-            
-            std::array<VkWriteDescriptorSet, 2u> desc_writes{};
-            desc_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            desc_writes[0].dstSet = m_desc_sets[i];
-            desc_writes[0].dstBinding = 0u;
-            desc_writes[0].dstArrayElement = 0u;
-            desc_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            desc_writes[0].descriptorCount = 1u;
-            desc_writes[0].pBufferInfo = &buffer_info;
-            desc_writes[0].pImageInfo = nullptr;
-            desc_writes[0].pTexelBufferView = nullptr;
-            
-            desc_writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            desc_writes[1].dstSet = m_desc_sets[i];
-            desc_writes[1].dstBinding = 1u;
-            desc_writes[1].dstArrayElement = 0u;
-            desc_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            desc_writes[1].descriptorCount = 1u;
-            desc_writes[1].pImageInfo = &image_info;
-            desc_writes[1].pBufferInfo = nullptr;
-            desc_writes[1].pTexelBufferView = nullptr;
-            
-            vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(desc_writes.size()), desc_writes.data(), 0u, nullptr);
-            
+        VkResult result = vkCreateDescriptorPool(m_device, &pool_info, nullptr, &m_texture_desc_pool);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
         }
+        
+        VkDescriptorSetAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        alloc_info.descriptorPool = m_texture_desc_pool;
+        alloc_info.descriptorSetCount = 1u;
+        alloc_info.pSetLayouts = &m_texture_set_layout;
+        result = vkAllocateDescriptorSets(m_device, &alloc_info, &m_texture_set);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor set!");
+        }
+        
+        // the fallback layout has a single texture, the bindless one leaves the unused tail of the array unwritten
+        writeTextureDescriptors(0u, m_bindless_enabled ? static_cast<uint32_t>(m_textures.size()) : 1u);
     }
     
-    VkDescriptorPool createDescPool() {
-        std::array<VkDescriptorPoolSize, 2u> pool_sizes{};
-        pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        pool_sizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-        pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        pool_sizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    // Writes texture slots first to first + count - 1 of m_texture_set. Textures are only replaced while no frame
+    // is in flight, update-after-bind is what lets the bindless array be larger than the per-stage limits.
+    void writeTextureDescriptors(uint32_t first, uint32_t count) {
+        std::vector<VkDescriptorImageInfo> image_infos(count);
+        for(uint32_t i = 0u; i < count; ++i) {
+            image_infos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            image_infos[i].imageView = m_textures[first + i].view;
+            image_infos[i].sampler = m_texture_sampler;
+        }
         
-        VkDescriptorPoolCreateInfo pool_info{};
-        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        pool_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
-        pool_info.pPoolSizes = pool_sizes.data();
-        pool_info.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-        pool_info.flags = 0u;
-     
-        VkDescriptorPool desc_pool;
-        VkResult result = vkCreateDescriptorPool(m_device, &pool_info, nullptr, &desc_pool);
-        if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor pool!");
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = m_texture_set;
+        write.dstBinding = 1u;
+        write.dstArrayElement = first;
+        write.descriptorCount = count;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write.pImageInfo = image_infos.data();
+        vkUpdateDescriptorSets(m_device, 1u, &write, 0u, nullptr);
+    }
+    
+    // The writes are packed once, a frame then only allocates its sets and applies them.
+    void createDescWriters() {
+        // the ranges cover one block, where it sits in the arena is given by the dynamic offsets
+        m_uniform_desc_data[0].buffer = m_uniform_buffer;
+        m_uniform_desc_data[0].offset = 0u;
+        m_uniform_desc_data[0].range = sizeof(FrameUniforms);
+        m_uniform_desc_data[1].buffer = m_uniform_buffer;
+        m_uniform_desc_data[1].offset = 0u;
+        m_uniform_desc_data[1].range = sizeof(ObjectUniforms);
+        
+        VkDescriptorUpdateTemplateEntry uniform_entry{};
+        uniform_entry.dstBinding = 0u;
+        uniform_entry.dstArrayElement = 0u;
+        uniform_entry.descriptorCount = static_cast<uint32_t>(m_uniform_desc_data.size()); // bindings 0 and 1
+        uniform_entry.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        uniform_entry.offset = 0u;
+        uniform_entry.stride = sizeof(VkDescriptorBufferInfo);
+        m_uniform_writer.init(m_device, m_desc_template_functions, m_uniform_set_layout, {uniform_entry});
+        
+        m_uniform_sets.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    }
+    
+    // Called once the fence of the frame has signaled, the sets its previous submission used go back to the pools.
+    void allocateFrameDescriptors() {
+        m_desc_allocator.resetFrame(m_current_frame);
+        m_uniform_sets[m_current_frame] = m_desc_allocator.allocate(m_current_frame, m_uniform_set_layout);
+        m_uniform_writer.update(m_device, m_uniform_sets[m_current_frame], m_uniform_desc_data.data());
+        if(m_gpu_cull_enabled) {
+            m_cull_desc_sets[m_current_frame] = m_desc_allocator.allocate(m_current_frame, m_cull_desc_set_layout);
+            m_cull_desc_writer.update(m_device, m_cull_desc_sets[m_current_frame], m_cull_desc_data[m_current_frame].data());
         }
-        return desc_pool;
     }
     
     void createCommandPools() {
-        QueueFamilyIndices queue_family_indices = findQueueFamilies(m_physical_device, m_surface);
+        const QueueFamilyIndices& queue_family_indices = m_queue_family_indices;
         VkCommandPoolCreateInfo gfx_cmd_pool_info{};
         gfx_cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         gfx_cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
@@ -738,50 +5404,512 @@ private:
             throw std::runtime_error("failed to begin recording commandbuffer!");
         }
         
-        VkRenderPassBeginInfo renderpass_info{};
-        renderpass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderpass_info.renderPass = m_render_pass;
-        renderpass_info.framebuffer = m_swapchain_framebuffers[image_index];
-        renderpass_info.renderArea.offset = {0, 0};
-        renderpass_info.renderArea.extent = m_swapchain_params.extent;
+        m_gpu_profiler.beginFrame(command_buffer, m_current_frame, m_frame_number);
+        m_gpu_profiler.beginZone(command_buffer, m_current_frame, "frame");
+        
+        if(hasPendingUploads() || !m_pending_buffer_acquires.empty() || !m_pending_image_acquires.empty()) {
+            m_gpu_profiler.beginZone(command_buffer, m_current_frame, "uploads");
+            recordPendingAcquires(command_buffer);
+            recordPendingUploads(command_buffer, false);
+            m_gpu_profiler.endZone(command_buffer, m_current_frame);
+        }
+        
+        if(m_gpu_cull_enabled) {
+            m_gpu_profiler.beginZone(command_buffer, m_current_frame, "cull");
+            recordCulling(command_buffer);
+            m_gpu_profiler.endZone(command_buffer, m_current_frame);
+        }
+        
+        if(m_dynamic_rendering_enabled) {
+            m_render_graph.setImported(m_graph_backbuffer, m_swapchain_images[image_index], m_swapchain_views[image_index]);
+            m_render_graph.execute(command_buffer);
+        }
+        else {
+            VkRenderPassBeginInfo renderpass_info{};
+            renderpass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderpass_info.renderPass = m_render_pass;
+            renderpass_info.framebuffer = m_swapchain_framebuffers[image_index];
+            renderpass_info.renderArea.offset = {0, 0};
+            renderpass_info.renderArea.extent = m_swapchain_params.extent;
+            
+            std::array<VkClearValue, 2> clear_values{};
+            clear_values[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+            clear_values[1].depthStencil = {1.0f, 0};
+            renderpass_info.clearValueCount = static_cast<uint32_t>(clear_values.size());
+            renderpass_info.pClearValues = clear_values.data();
+            
+            m_gpu_profiler.beginZone(command_buffer, m_current_frame, "render_pass");
+            vkCmdBeginRenderPass(command_buffer, &renderpass_info, useRecordWorkers() ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+            recordSceneDraws(command_buffer, m_swapchain_framebuffers[image_index]);
+            vkCmdEndRenderPass(command_buffer);
+            m_gpu_profiler.endZone(command_buffer, m_current_frame);
+            
+            if(m_options.headless) {
+                m_gpu_profiler.beginZone(command_buffer, m_current_frame, "readback");
+                recordReadback(command_buffer, image_index);
+                m_gpu_profiler.endZone(command_buffer, m_current_frame);
+            }
+        }
         
-        std::array<VkClearValue, 2> clear_values{};
-        clear_values[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
-        clear_values[1].depthStencil = {1.0f, 0};
-        renderpass_info.clearValueCount = static_cast<uint32_t>(clear_values.size());
-        renderpass_info.pClearValues = clear_values.data();
+        m_gpu_profiler.endZone(command_buffer, m_current_frame);
         
-        vkCmdBeginRenderPass(command_buffer, &renderpass_info, VK_SUBPASS_CONTENTS_INLINE);
+        result = vkEndCommandBuffer(command_buffer);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+    }
+    
+    // a single indirect draw leaves nothing to spread over the workers
+    bool useRecordWorkers() const {
+        return m_record_workers.threadCount() > 0u && !m_gpu_cull_enabled;
+    }
+    
+    // The draws inside the render pass or the dynamic rendering scope, framebuffer is null for the latter.
+    void recordSceneDraws(VkCommandBuffer command_buffer, VkFramebuffer framebuffer) {
+        if(useRecordWorkers()) {
+            // timestamps can not be written into the primary buffer inside this subpass, so there is no draw zone here
+            VkFormat color_format = m_swapchain_params.surface_format.format;
+            VkCommandBufferInheritanceRenderingInfo inheritance_rendering{};
+            inheritance_rendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+            inheritance_rendering.colorAttachmentCount = 1u;
+            inheritance_rendering.pColorAttachmentFormats = &color_format;
+            inheritance_rendering.depthAttachmentFormat = findDepthFormat();
+            inheritance_rendering.stencilAttachmentFormat = hasStencilComponent(inheritance_rendering.depthAttachmentFormat) ? inheritance_rendering.depthAttachmentFormat : VK_FORMAT_UNDEFINED;
+            inheritance_rendering.rasterizationSamples = m_msaa_samples;
+        
+            VkCommandBufferInheritanceInfo inheritance{};
+            inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritance.pNext = m_dynamic_rendering_enabled ? &inheritance_rendering : nullptr;
+            inheritance.renderPass = m_render_pass;
+            inheritance.subpass = 0u;
+            inheritance.framebuffer = framebuffer;
+        
+            size_t threads_count = m_record_workers.threadCount();
+            size_t draws_per_thread = (m_draw_list.size() + threads_count - 1u) / threads_count;
+            RecordWorkers::Job job = [&](uint32_t thread_index, VkCommandBuffer secondary) {
+                size_t first = std::min(m_draw_list.size(), thread_index * draws_per_thread);
+                size_t last = std::min(m_draw_list.size(), first + draws_per_thread);
+                if(first == last) {
+                    return;
+                }
+                recordDrawState(secondary);
+                recordDraws(secondary, first, last);
+            };
+            const std::vector<VkCommandBuffer>& secondaries = m_record_workers.record(m_current_frame, inheritance, job);
+            vkCmdExecuteCommands(command_buffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+        }
+        else {
+            recordDrawState(command_buffer);
+            m_gpu_profiler.beginZone(command_buffer, m_current_frame, "draw");
+            if(m_gpu_cull_enabled) {
+                // the compute pass culled with the model of the first draw
+                bindObjectUniforms(command_buffer, 0u);
+                m_pfnCmdDrawIndexedIndirectCount(
+                    command_buffer,
+                    m_indirect_buffers[m_current_frame], 0u,
+                    m_indirect_count_buffers[m_current_frame], 0u,
+                    1u,
+                    sizeof(VkDrawIndexedIndirectCommand)
+                );
+            }
+            else {
+                recordDraws(command_buffer, 0u, m_draw_list.size());
+            }
+            m_gpu_profiler.endZone(command_buffer, m_current_frame);
+        }
+    }
+    
+    // The render graph has moved the attachments into their layouts already. Color and depth are cleared and only
+    // the resolved scene image is stored, the backbuffer itself unless the scene is scaled.
+    void beginDynamicRendering(VkCommandBuffer command_buffer, VkRenderingFlags flags) {
+        VkFormat depth_format = findDepthFormat();
+        bool resolve = m_graph_color != RenderGraph::INVALID_RESOURCE;
+        VkImageView target_view = m_render_graph.getView(m_graph_scene);
+        
+        VkRenderingAttachmentInfo color_attachment{};
+        color_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        color_attachment.imageView = resolve ? m_render_graph.getView(m_graph_color) : target_view;
+        color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        color_attachment.resolveMode = resolve ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE;
+        color_attachment.resolveImageView = resolve ? target_view : VK_NULL_HANDLE;
+        color_attachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        color_attachment.storeOp = resolve ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+        color_attachment.clearValue.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+        
+        VkRenderingAttachmentInfo depth_attachment{};
+        depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        depth_attachment.imageView = m_render_graph.getView(m_graph_depth);
+        depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depth_attachment.resolveMode = VK_RESOLVE_MODE_NONE;
+        depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depth_attachment.clearValue.depthStencil = {1.0f, 0};
+        
+        VkRenderingInfo rendering_info{};
+        rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+        rendering_info.flags = flags;
+        rendering_info.renderArea.offset = {0, 0};
+        rendering_info.renderArea.extent = m_render_extent;
+        rendering_info.layerCount = 1u;
+        rendering_info.colorAttachmentCount = 1u;
+        rendering_info.pColorAttachments = &color_attachment;
+        rendering_info.pDepthAttachment = &depth_attachment;
+        rendering_info.pStencilAttachment = hasStencilComponent(depth_format) ? &depth_attachment : nullptr;
+        m_pfnCmdBeginRendering(command_buffer, &rendering_info);
+    }
+    
+    // Everything a draw needs bound, recorded again at the start of every secondary buffer since no state is inherited.
+    void recordDrawState(VkCommandBuffer command_buffer) {
         vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics_pipeline);
         
-        VkBuffer vertex_buffers[] = {m_vertex_buffer};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
-        vkCmdBindIndexBuffer(command_buffer, m_index_buffer, 0u, VK_INDEX_TYPE_UINT16);
+        VkBuffer instance_buffer = m_instance_buffer;
+        if(m_gpu_cull_enabled) {
+            instance_buffer = m_culled_instance_buffers[m_current_frame];
+        }
+        else if(m_cpu_cull_enabled) {
+            instance_buffer = m_visible_instance_buffers[m_current_frame];
+        }
+        VkBuffer vertex_buffers[] = {m_vertex_buffer, instance_buffer};
+        VkDeviceSize offsets[] = {0, 0};
+        vkCmdBindVertexBuffers(command_buffer, 0, 2, vertex_buffers, offsets);
+        vkCmdBindIndexBuffer(command_buffer, m_index_buffer, 0u, m_index_type);
         
         VkViewport view_port{};
         view_port.x = 0.0f;
         view_port.y = 0.0f;
-        view_port.width = static_cast<float>(m_swapchain_params.extent.width);
-        view_port.height = static_cast<float>(m_swapchain_params.extent.height);
+        view_port.width = static_cast<float>(m_render_extent.width);
+        view_port.height = static_cast<float>(m_render_extent.height);
         view_port.minDepth = 0.0f;
         view_port.maxDepth = 1.0f;
         vkCmdSetViewport(command_buffer, 0u, 1u, &view_port);
         
         VkRect2D scissor{};
         scissor.offset = {0, 0};
-        scissor.extent = m_swapchain_params.extent;
+        scissor.extent = m_render_extent;
         vkCmdSetScissor(command_buffer, 0u, 1u, &scissor);
         
-        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 0, 1, &m_desc_sets[m_current_frame], 0, nullptr);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 0, 1, &m_texture_set, 0, nullptr);
+    }
+    
+    // Points set 1 at the frame block and the object block of one draw.
+    void bindObjectUniforms(VkCommandBuffer command_buffer, size_t draw_index) {
+        std::array<uint32_t, 2> dynamic_offsets = {m_frame_uniform_offset, m_object_uniform_offsets[draw_index]};
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 1u, 1u, &m_uniform_sets[m_current_frame], static_cast<uint32_t>(dynamic_offsets.size()), dynamic_offsets.data());
+    }
+    
+    void recordDraws(VkCommandBuffer command_buffer, size_t first, size_t last) {
+        for(size_t i = first; i < last; ++i) {
+            bindObjectUniforms(command_buffer, i);
+            const VkDrawIndexedIndirectCommand& draw = m_draw_list[i];
+            vkCmdDrawIndexed(command_buffer, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
+        }
+    }
+    
+    void buildDrawList() {
+        VkDrawIndexedIndirectCommand draw{};
+        draw.indexCount = m_index_count;
+        draw.instanceCount = static_cast<uint32_t>(m_instances.size());
+        draw.firstIndex = 0u;
+        draw.vertexOffset = 0;
+        draw.firstInstance = 0u;
+        m_draw_list.assign(m_options.draw_count, draw);
+    }
+    
+    void createCullingResources() {
+        uint32_t queue_family_count = 0u;
+        vkGetPhysicalDeviceQueueFamilyProperties(m_physical_device, &queue_family_count, nullptr);
+        std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+        vkGetPhysicalDeviceQueueFamilyProperties(m_physical_device, &queue_family_count, queue_families.data());
+        bool has_compute = queue_families[m_queue_family_indices.graphics_family.value()].queueFlags & VK_QUEUE_COMPUTE_BIT;
+        if(!m_draw_indirect_count_supported || !has_compute) {
+            std::cout << "GPU culling: indirect count draws or compute on the graphics queue are not supported, drawing from the CPU" << std::endl;
+            return;
+        }
+        
+        m_mesh_sphere = computeBoundingSphere(m_mesh_box);
+        m_cull_shader_module = loadShader("shaders/cull.comp", "shaders/cull.spv", ShaderTarget::Cull);
+        
+        // 0 - instances, 1 - visible instances, 2 - draw command, 3 - draw count
+        std::vector<VkDescriptorSetLayoutBinding> bindings(4u);
+        for(uint32_t i = 0u; i < bindings.size(); ++i) {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1u;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[i].pImmutableSamplers = nullptr;
+        }
+        m_cull_desc_set_layout = m_desc_layout_cache.get(m_device, bindings, {}, 0u);
         
-        vkCmdDrawIndexed(command_buffer, static_cast<uint32_t>(g_indices.size()), 1u, 0u, 0u, 0u);
-        vkCmdEndRenderPass(command_buffer);
+        VkPushConstantRange push_range{};
+        push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        push_range.offset = 0u;
+        push_range.size = sizeof(CullPushConstants);
         
-        result = vkEndCommandBuffer(command_buffer);
+        VkPipelineLayoutCreateInfo pipeline_layout_info{};
+        pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipeline_layout_info.setLayoutCount = 1u;
+        pipeline_layout_info.pSetLayouts = &m_cull_desc_set_layout;
+        pipeline_layout_info.pushConstantRangeCount = 1u;
+        pipeline_layout_info.pPushConstantRanges = &push_range;
+        VkResult result = vkCreatePipelineLayout(m_device, &pipeline_layout_info, nullptr, &m_cull_pipeline_layout);
         if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
+            throw std::runtime_error("failed to create culling pipeline layout!");
+        }
+        
+        PipelineCreation creation = createCullPipeline(m_cull_shader_module);
+        recordPipelineCreation("culling pipeline", creation);
+        m_cull_pipeline = creation.pipeline;
+        
+        // one set of outputs per frame in flight, the previous frame may still be drawing from its own
+        VkDeviceSize instances_size = sizeof(InstanceData) * m_instances.size();
+        m_culled_instance_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+        m_culled_instance_memory.resize(MAX_FRAMES_IN_FLIGHT);
+        m_indirect_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+        m_indirect_memory.resize(MAX_FRAMES_IN_FLIGHT);
+        m_indirect_count_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+        m_indirect_count_memory.resize(MAX_FRAMES_IN_FLIGHT);
+        for(size_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+            createBuffer(instances_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_culled_instance_buffers[i], m_culled_instance_memory[i]);
+            createBuffer(sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indirect_buffers[i], m_indirect_memory[i]);
+            createBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indirect_count_buffers[i], m_indirect_count_memory[i]);
+        }
+        
+        m_cull_desc_data.resize(MAX_FRAMES_IN_FLIGHT);
+        for(size_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+            std::array<VkDescriptorBufferInfo, 4>& buffer_infos = m_cull_desc_data[i];
+            buffer_infos[0].buffer = m_instance_buffer;
+            buffer_infos[0].offset = 0u;
+            buffer_infos[0].range = VK_WHOLE_SIZE;
+            buffer_infos[1].buffer = m_culled_instance_buffers[i];
+            buffer_infos[1].offset = 0u;
+            buffer_infos[1].range = VK_WHOLE_SIZE;
+            buffer_infos[2].buffer = m_indirect_buffers[i];
+            buffer_infos[2].offset = 0u;
+            buffer_infos[2].range = VK_WHOLE_SIZE;
+            buffer_infos[3].buffer = m_indirect_count_buffers[i];
+            buffer_infos[3].offset = 0u;
+            buffer_infos[3].range = VK_WHOLE_SIZE;
+        }
+        
+        VkDescriptorUpdateTemplateEntry entry{};
+        entry.dstBinding = 0u;
+        entry.dstArrayElement = 0u;
+        entry.descriptorCount = static_cast<uint32_t>(bindings.size()); // consecutive bindings of one type are written as one array
+        entry.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        entry.offset = 0u;
+        entry.stride = sizeof(VkDescriptorBufferInfo);
+        m_cull_desc_writer.init(m_device, m_desc_template_functions, m_cull_desc_set_layout, {entry});
+        m_cull_desc_sets.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+        
+        m_gpu_cull_enabled = true;
+    }
+    
+    // Only reads members that are fixed once the culling resources exist, the shader watcher calls it from its thread.
+    PipelineCreation createCullPipeline(VkShaderModule cull_shader_module) {
+        VkComputePipelineCreateInfo pipeline_info{};
+        pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipeline_info.stage.module = cull_shader_module;
+        pipeline_info.stage.pName = "main";
+        pipeline_info.layout = m_cull_pipeline_layout;
+        
+        VkPipelineCreationFeedback pipeline_feedback{};
+        VkPipelineCreationFeedback stage_feedback{};
+        VkPipelineCreationFeedbackCreateInfo feedback_info{};
+        feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+        feedback_info.pPipelineCreationFeedback = &pipeline_feedback;
+        feedback_info.pipelineStageCreationFeedbackCount = 1u;
+        feedback_info.pPipelineStageCreationFeedbacks = &stage_feedback;
+        if(m_creation_feedback_supported) {
+            pipeline_info.pNext = &feedback_info;
+        }
+        
+        PipelineCreation creation;
+        auto create_start = std::chrono::high_resolution_clock::now();
+        VkResult result = vkCreateComputePipelines(m_device, m_pipeline_cache.get(), 1u, &pipeline_info, nullptr, &creation.pipeline);
+        creation.ms = elapsedMs(create_start, std::chrono::high_resolution_clock::now());
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create culling pipeline!");
+        }
+        if(m_creation_feedback_supported && (pipeline_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT)) {
+            creation.cache_hit = (pipeline_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) != 0u;
+        }
+        return creation;
+    }
+    
+    void destroyCullingResources() {
+        for(size_t i = 0u; i < m_indirect_buffers.size(); ++i) {
+            vkDestroyBuffer(m_device, m_culled_instance_buffers[i], nullptr);
+            m_allocator.free(m_culled_instance_memory[i]);
+            vkDestroyBuffer(m_device, m_indirect_buffers[i], nullptr);
+            m_allocator.free(m_indirect_memory[i]);
+            vkDestroyBuffer(m_device, m_indirect_count_buffers[i], nullptr);
+            m_allocator.free(m_indirect_count_memory[i]);
+        }
+        m_cull_desc_writer.destroy(m_device);
+        vkDestroyPipeline(m_device, m_cull_pipeline, nullptr);
+        vkDestroyPipelineLayout(m_device, m_cull_pipeline_layout, nullptr);
+        vkDestroyShaderModule(m_device, m_cull_shader_module, nullptr);
+    }
+    
+    void createCpuCulling() {
+        m_cpu_culler.init(m_instances, m_mesh_box);
+        
+        VkDeviceSize buffer_size = sizeof(InstanceData) * m_instances.size();
+        m_visible_instance_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+        m_visible_instance_memory.resize(MAX_FRAMES_IN_FLIGHT);
+        for(size_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+            createBuffer(buffer_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_visible_instance_buffers[i], m_visible_instance_memory[i]);
+        }
+        m_cpu_cull_enabled = true;
+        std::cout << "CPU culling: " << m_cpu_culler.kernelName() << " kernel, " << m_worker_pool.threadCount() + 1u << " threads" << std::endl;
+    }
+    
+    void destroyCpuCulling() {
+        for(size_t i = 0u; i < m_visible_instance_buffers.size(); ++i) {
+            vkDestroyBuffer(m_device, m_visible_instance_buffers[i], nullptr);
+            m_allocator.free(m_visible_instance_memory[i]);
+        }
+        m_visible_instance_buffers.clear();
+        m_visible_instance_memory.clear();
+    }
+    
+    // Writes the instances inside the frustum of m_cull_matrix to this frame's instance stream and
+    // points the draws at them. The frame's fence must have signaled.
+    void cullInstances() {
+        auto cull_start = std::chrono::high_resolution_clock::now();
+        InstanceData* dst = static_cast<InstanceData*>(m_visible_instance_memory[m_current_frame].mapped);
+        uint32_t visible_count = m_cpu_culler.cull(m_worker_pool, extractFrustumPlanes(m_cull_matrix), m_instances, dst);
+        for(VkDrawIndexedIndirectCommand& draw : m_draw_list) {
+            draw.instanceCount = visible_count;
+        }
+        m_frame_timings.cull_ms = elapsedMs(cull_start, std::chrono::high_resolution_clock::now());
+        m_frame_timings.visible_instances = static_cast<double>(visible_count);
+        m_frame_timings.culled_instances = static_cast<double>(m_instances.size() - visible_count);
+    }
+    
+    // Tests every instance against the frustum of m_cull_matrix, compacts the survivors into this frame's
+    // instance stream and counts them into its indirect draw. Must be recorded outside of the render pass.
+    void recordCulling(VkCommandBuffer command_buffer) {
+        // the shader only adds to instanceCount and fills in indexCount, everything else stays 0
+        std::array<VkBuffer, 2> cleared_buffers = {m_indirect_buffers[m_current_frame], m_indirect_count_buffers[m_current_frame]};
+        std::array<VkBufferMemoryBarrier, 2> clear_barriers{};
+        for(size_t i = 0u; i < cleared_buffers.size(); ++i) {
+            vkCmdFillBuffer(command_buffer, cleared_buffers[i], 0u, VK_WHOLE_SIZE, 0u);
+            
+            clear_barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            clear_barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            clear_barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            clear_barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            clear_barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            clear_barriers[i].buffer = cleared_buffers[i];
+            clear_barriers[i].offset = 0u;
+            clear_barriers[i].size = VK_WHOLE_SIZE;
+        }
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0u, 0u, nullptr, static_cast<uint32_t>(clear_barriers.size()), clear_barriers.data(), 0u, nullptr);
+        
+        CullPushConstants push_constants{};
+        std::array<glm::vec4, 6> planes = extractFrustumPlanes(m_cull_matrix);
+        std::copy(planes.cbegin(), planes.cend(), push_constants.frustum_planes);
+        push_constants.mesh_sphere = m_mesh_sphere;
+        push_constants.object_count = static_cast<uint32_t>(m_instances.size());
+        push_constants.index_count = m_index_count;
+        
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cull_pipeline);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cull_pipeline_layout, 0u, 1u, &m_cull_desc_sets[m_current_frame], 0u, nullptr);
+        vkCmdPushConstants(command_buffer, m_cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0u, sizeof(push_constants), &push_constants);
+        vkCmdDispatch(command_buffer, (push_constants.object_count + CULL_GROUP_SIZE - 1u) / CULL_GROUP_SIZE, 1u, 1u);
+        
+        VkMemoryBarrier indirect_barrier{};
+        indirect_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        indirect_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        indirect_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0u, 1u, &indirect_barrier, 0u, nullptr, 0u, nullptr);
+    }
+    
+    void recordReadback(VkCommandBuffer command_buffer, uint32_t image_index) {
+        // the render pass already left the image in TRANSFER_SRC_OPTIMAL, only the writes need to be made visible
+        VkImageMemoryBarrier image_barrier{};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.image = m_swapchain_images[image_index];
+        image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        image_barrier.subresourceRange.baseMipLevel = 0u;
+        image_barrier.subresourceRange.levelCount = 1u;
+        image_barrier.subresourceRange.baseArrayLayer = 0u;
+        image_barrier.subresourceRange.layerCount = 1u;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0u, 0u, nullptr, 0u, nullptr, 1u, &image_barrier);
+        
+        recordReadbackCopy(command_buffer, m_swapchain_images[image_index]);
+    }
+    
+    // Copies an image in TRANSFER_SRC_OPTIMAL into the readback buffer of the frame.
+    void recordReadbackCopy(VkCommandBuffer command_buffer, VkImage image) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0u;
+        region.bufferRowLength = 0u;
+        region.bufferImageHeight = 0u;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0u;
+        region.imageSubresource.baseArrayLayer = 0u;
+        region.imageSubresource.layerCount = 1u;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {m_swapchain_params.extent.width, m_swapchain_params.extent.height, 1u};
+        vkCmdCopyImageToBuffer(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_readback_buffers[m_current_frame], 1u, &region);
+        
+        VkBufferMemoryBarrier host_barrier{};
+        host_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        host_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        host_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        host_barrier.buffer = m_readback_buffers[m_current_frame];
+        host_barrier.offset = 0u;
+        host_barrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0u, 0u, nullptr, 1u, &host_barrier, 0u, nullptr);
+    }
+    
+    VkDeviceSize getReadbackRowPitch() {
+        return static_cast<VkDeviceSize>(m_swapchain_params.extent.width) * 4u;
+    }
+    
+    void createReadbackBuffers() {
+        VkDeviceSize buffer_size = getReadbackRowPitch() * m_swapchain_params.extent.height;
+        
+        m_readback_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+        m_readback_memory.resize(MAX_FRAMES_IN_FLIGHT);
+        m_readback_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+        m_readback_pending.assign(MAX_FRAMES_IN_FLIGHT, std::nullopt);
+        
+        for(size_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+            createBuffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_readback_buffers[i], m_readback_memory[i]);
+            m_readback_mapped[i] = m_readback_memory[i].mapped;
+        }
+    }
+    
+    void deliverReadback(uint32_t frame) {
+        if(!m_readback_pending[frame].has_value()) {
+            return;
+        }
+        
+        if(m_frame_consumer) {
+            HeadlessFrame headless_frame{};
+            headless_frame.frame_number = m_readback_pending[frame].value();
+            headless_frame.width = m_swapchain_params.extent.width;
+            headless_frame.height = m_swapchain_params.extent.height;
+            headless_frame.format = m_swapchain_params.surface_format.format;
+            headless_frame.row_pitch = getReadbackRowPitch();
+            headless_frame.pixels = m_readback_mapped[frame];
+            m_frame_consumer(headless_frame);
         }
+        m_readback_pending[frame].reset();
     }
     
     void createSyncObjects(){
@@ -817,96 +5945,477 @@ private:
         }
     }
     
-    void copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size) {
-//        VkCommandBufferAllocateInfo alloc_info{};
-//        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-//        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-//        alloc_info.commandPool = m_transfer_cmd_pool;
-//        alloc_info.commandBufferCount = 1u;
-//        
-//        VkCommandBuffer command_buffer;
-//        vkAllocateCommandBuffers(m_device, &alloc_info, &command_buffer);
-//        
-//        VkCommandBufferBeginInfo begin_info{};
-//        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-//        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-//        vkBeginCommandBuffer(command_buffer, &begin_info);
-
-        VkCommandBuffer command_buffer = beginSingleTimeCommands(m_transfer_cmd_pool);
-        
-        VkBufferCopy copy_regions{};
-        copy_regions.srcOffset = 0u;
-        copy_regions.dstOffset = 0u;
-        copy_regions.size = size;
-        vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_regions);
-        
-        //vkEndCommandBuffer(command_buffer);
-        
-        endSingleTimeCommands(command_buffer, m_transfer_queue, m_transfer_cmd_pool);
+    template<typename IndexType>
+    void createAndTransferIndexBuffer(const std::vector<IndexType>& indices) {
+        static_assert(std::is_same_v<IndexType, uint16_t> || std::is_same_v<IndexType, uint32_t>, "indices are 16 or 32 bit");
+        VkDeviceSize buffer_size = sizeof(indices[0]) * indices.size();
         
-//        VkSubmitInfo submit_info{};
-//        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-//        submit_info.commandBufferCount = 1u;
-//        submit_info.pCommandBuffers = &command_buffer;
-//        vkQueueSubmit(m_transfer_queue, 1u, &submit_info, VK_NULL_HANDLE);
-//        vkQueueWaitIdle(m_transfer_queue);
-//        vkFreeCommandBuffers(m_device, m_transfer_cmd_pool, 1, &command_buffer);
+        createBuffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_index_buffer, m_index_memory);
+        queueBufferUpload(m_index_buffer, 0u, indices.data(), buffer_size);
+        m_index_type = std::is_same_v<IndexType, uint16_t> ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+        m_index_count = static_cast<uint32_t>(indices.size());
     }
     
-    void createAndTransferIndexBuffer(const std::vector<uint16_t>& indices) {
-        VkDeviceSize buffer_size = sizeof(indices[0]) * indices.size();
+    // Packed vertices are quantized against m_mesh_box, which has to be set already.
+    void createAndTransferVertexBuffer(const std::vector<Vertex>& vertices) {
+        VkDeviceSize buffer_size = getVertexStride() * vertices.size();
         
-        VkBuffer staging_buffer;
-        VkDeviceMemory staging_memory;
+        createBuffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertex_buffer, m_vertex_memory);
+        if(m_vertex_format == VertexFormat::Packed) {
+            std::vector<PackedVertex> packed_vertices(vertices.size());
+            std::transform(vertices.begin(), vertices.end(), packed_vertices.begin(), [this](const Vertex& vertex) { return packVertex(vertex, m_mesh_box); });
+            queueBufferUpload(m_vertex_buffer, 0u, packed_vertices.data(), buffer_size);
+        }
+        else {
+            queueBufferUpload(m_vertex_buffer, 0u, vertices.data(), buffer_size);
+        }
+    }
+    
+    VkDeviceSize getVertexStride() const {
+        return m_vertex_format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+    }
+    
+    // Falls back to full floats when the device can not fetch one of the packed formats.
+    void selectVertexFormat() {
+        m_vertex_format = m_options.vertex_format;
+        if(m_vertex_format != VertexFormat::Packed) {
+            return;
+        }
+        for(VkFormat format : {VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16G16_SFLOAT}) {
+            VkFormatProperties format_props{};
+            vkGetPhysicalDeviceFormatProperties(m_physical_device, format, &format_props);
+            if(!(format_props.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT)) {
+                std::cout << "packed vertices: format " << format << " can not be used for vertex input, using floats" << std::endl;
+                m_vertex_format = VertexFormat::Float;
+                return;
+            }
+        }
+    }
+    
+    // Parses an OBJ file on the worker pool, vertices are written straight into the staging ring.
+    void loadMesh(const std::string& file_name) {
+        auto load_start = std::chrono::high_resolution_clock::now();
+        MappedFile file(file_name);
+        ObjMeshParser parser;
+        parser.parse(file.data(), file.size(), m_worker_pool);
+        std::vector<uint32_t> indices(parser.indexCount());
+        uint32_t vertex_count = parser.buildIndices(indices.data());
+        
+        MeshLoadStats stats{};
+        stats.parse_ms = elapsedMs(load_start, std::chrono::high_resolution_clock::now());
+        std::vector<uint32_t> remap;
+        if(m_options.optimize_mesh) {
+            remap = optimizeMesh(indices, parser.gatherPositions(m_worker_pool), stats.optimize_steps);
+        }
         
-        createBuffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, staging_buffer, staging_memory);
-        void* data;
-        vkMapMemory(m_device, staging_memory, 0u, buffer_size, 0u, &data);
-        memcpy(data, indices.data(), buffer_size);
-        vkUnmapMemory(m_device, staging_memory);
+        // 16-bit indices whenever every vertex fits
+        m_index_type = vertex_count <= 65536u ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+        VkDeviceSize index_size = (m_index_type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)) * indices.size();
+        createBuffer(index_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_index_buffer, m_index_memory);
+        if(m_index_type == VK_INDEX_TYPE_UINT16) {
+            queueChunkedUpload(m_index_buffer, 0u, sizeof(uint16_t), indices.size(), [&indices](void* staging, VkDeviceSize first, VkDeviceSize count) {
+                std::transform(indices.begin() + first, indices.begin() + first + count, static_cast<uint16_t*>(staging), [](uint32_t index) { return static_cast<uint16_t>(index); });
+            });
+        }
+        else {
+            queueChunkedUpload(m_index_buffer, 0u, sizeof(uint32_t), indices.size(), [&indices](void* staging, VkDeviceSize first, VkDeviceSize count) {
+                memcpy(staging, indices.data() + first, static_cast<size_t>(count * sizeof(uint32_t)));
+            });
+        }
         
-        createBuffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_index_buffer, m_index_memory);
-        copyBuffer(staging_buffer, m_index_buffer, buffer_size);
+        m_mesh_box = parser.computeBounds(m_worker_pool);
+        VkDeviceSize vertex_size = getVertexStride() * vertex_count;
+        createBuffer(vertex_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertex_buffer, m_vertex_memory);
+        // every chunk walks all parsed vertices, meshes that fit into one chunk are written in a single pass
+        queueChunkedUpload(m_vertex_buffer, 0u, getVertexStride(), vertex_count, [&](void* staging, VkDeviceSize first, VkDeviceSize count) {
+            if(m_vertex_format == VertexFormat::Packed) {
+                const BoundingBox& box = m_mesh_box;
+                parser.writeVertices(static_cast<PackedVertex*>(staging), static_cast<uint32_t>(first), static_cast<uint32_t>(count), remap, m_worker_pool, [&box](const Vertex& vertex) { return packVertex(vertex, box); });
+            }
+            else {
+                parser.writeVertices(static_cast<Vertex*>(staging), static_cast<uint32_t>(first), static_cast<uint32_t>(count), remap, m_worker_pool, [](const Vertex& vertex) { return vertex; });
+            }
+        });
+        m_index_count = static_cast<uint32_t>(parser.indexCount());
+        
+        stats.file_name = file_name;
+        stats.file_bytes = file.size();
+        stats.load_ms = elapsedMs(load_start, std::chrono::high_resolution_clock::now());
+        stats.vertex_count = vertex_count;
+        stats.index_count = indices.size();
+        stats.index_bits = m_index_type == VK_INDEX_TYPE_UINT16 ? 16u : 32u;
+        std::cout << "mesh " << file_name << ": " << stats.vertex_count << " vertices, " << stats.index_count / 3u << " triangles, "
+                  << stats.index_bits << "-bit indices, " << stats.file_bytes / 1000000.0 << " MB parsed in " << stats.parse_ms << " ms ("
+                  << stats.megabytesPerSecond() << " MB/s), loaded in " << stats.load_ms << " ms" << std::endl;
+        for(const MeshOptimizeStep& step : stats.optimize_steps) {
+            std::cout << "  " << step.name << ": ACMR " << step.acmr_before << " -> " << step.acmr_after << " (" << step.ms << " ms)" << std::endl;
+        }
+        m_mesh_stats = stats;
+    }
+    
+    // Vertex cache order, then overdraw clusters, then vertex fetch order. Returns the vertex remap of the last step.
+    static std::vector<uint32_t> optimizeMesh(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions, std::vector<MeshOptimizeStep>& steps) {
+        using clock = std::chrono::high_resolution_clock;
+        std::vector<uint32_t> remap;
+        auto run_step = [&](const char* name, const std::function<void()>& step) {
+            MeshOptimizeStep result{};
+            result.name = name;
+            result.acmr_before = computeAcmr(indices, positions.size());
+            auto step_start = clock::now();
+            step();
+            result.ms = elapsedMs(step_start, clock::now());
+            result.acmr_after = computeAcmr(indices, positions.size());
+            steps.push_back(result);
+        };
+        run_step("vertex cache", [&]() { optimizeVertexCache(indices, positions.size()); });
+        run_step("overdraw", [&]() { optimizeOverdraw(indices, positions); });
+        run_step("vertex fetch", [&]() { remap = optimizeVertexFetch(indices, positions.size()); });
+        return remap;
+    }
+    
+    // Lays the instances out on a square grid in the XY plane, the material cycles through the loaded textures.
+    void createAndTransferInstanceBuffer(uint32_t instance_count) {
+        uint32_t grid_side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(instance_count))));
+        float grid_offset = 0.5f * INSTANCE_SPACING * static_cast<float>(grid_side - 1u);
+        m_instances.resize(instance_count);
+        for(uint32_t i = 0u; i < instance_count; ++i) {
+            glm::vec3 position(INSTANCE_SPACING * static_cast<float>(i % grid_side) - grid_offset, INSTANCE_SPACING * static_cast<float>(i / grid_side) - grid_offset, 0.0f);
+            m_instances[i].model = glm::translate(glm::mat4(1.0f), position);
+            m_instances[i].material_index = m_bindless_enabled ? i % static_cast<uint32_t>(m_textures.size()) : 0u;
+        }
+        m_scene_radius = std::max(1.0f, grid_offset * std::sqrt(2.0f) + 1.0f);
         
-        vkDestroyBuffer(m_device, staging_buffer, nullptr);
-        vkFreeMemory(m_device, staging_memory, nullptr);
+        VkDeviceSize buffer_size = sizeof(m_instances[0]) * m_instances.size();
+        createBuffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_instance_buffer, m_instance_memory);
+        queueBufferUpload(m_instance_buffer, 0u, m_instances.data(), buffer_size);
     }
     
-    void createAndTransferVertexBuffer(const std::vector<Vertex>& vertices) {
-        VkDeviceSize buffer_size = sizeof(vertices[0]) * vertices.size();
+    void createStagingRing() {
+        createBuffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_staging_buffer, m_staging_memory);
+        m_staging_ring.init(STAGING_RING_SIZE, MAX_FRAMES_IN_FLIGHT);
+    }
+    
+    // Reserves space in the persistently mapped staging ring and returns its offset in m_staging_buffer.
+    VkDeviceSize reserveStaging(VkDeviceSize size, VkDeviceSize alignment) {
+        std::optional<VkDeviceSize> offset = m_staging_ring.allocate(size, alignment);
+        if(!offset.has_value()) {
+            // everything staged so far has to reach the GPU before the ring space can be reused
+            flushUploads();
+            offset = m_staging_ring.allocate(size, alignment);
+            if(!offset.has_value()) {
+                throw std::runtime_error("upload does not fit into the staging ring!");
+            }
+        }
+        return offset.value();
+    }
+    
+    void* getStagingPointer(VkDeviceSize offset) {
+        return static_cast<char*>(m_staging_memory.mapped) + offset;
+    }
+    
+    // Stages element_count elements in pieces of at most STAGING_CHUNK_SIZE, reserveStaging() flushes the ring whenever it
+    // fills up, so buffers larger than the ring go through as well. fill(staging, first, count) writes elements
+    // first to first + count - 1 into the reserved ring space.
+    template<typename Fill>
+    void queueChunkedUpload(VkBuffer dst_buffer, VkDeviceSize dst_offset, VkDeviceSize element_size, VkDeviceSize element_count, Fill&& fill) {
+        VkDeviceSize chunk_elements = std::max<VkDeviceSize>(STAGING_CHUNK_SIZE / element_size, 1u);
+        for(VkDeviceSize first = 0u; first < element_count; first += chunk_elements) {
+            VkDeviceSize count = std::min(chunk_elements, element_count - first);
+            VkDeviceSize staging_offset = reserveStaging(count * element_size, STAGING_ALIGNMENT);
+            fill(getStagingPointer(staging_offset), first, count);
+            queueStagedBufferUpload(dst_buffer, dst_offset + first * element_size, staging_offset, count * element_size);
+        }
+    }
+    
+    // The copy is recorded at the start of the next frame, or by flushUploads() outside the frame loop.
+    void queueBufferUpload(VkBuffer dst_buffer, VkDeviceSize dst_offset, const void* data, VkDeviceSize size) {
+        queueChunkedUpload(dst_buffer, dst_offset, 1u, size, [data](void* staging, VkDeviceSize first, VkDeviceSize count) {
+            memcpy(staging, static_cast<const char*>(data) + first, static_cast<size_t>(count));
+        });
+    }
+    
+    // For data written straight into ring space from reserveStaging().
+    void queueStagedBufferUpload(VkBuffer dst_buffer, VkDeviceSize dst_offset, VkDeviceSize staging_offset, VkDeviceSize size) {
+        PendingBufferUpload upload{};
+        upload.dst_buffer = dst_buffer;
+        upload.region.srcOffset = staging_offset;
+        upload.region.dstOffset = dst_offset;
+        upload.region.size = size;
+        m_pending_uploads.push_back(upload);
+    }
+    
+    static VkBufferImageCopy getImageUploadRegion(VkDeviceSize staging_offset, uint32_t mip_level, uint32_t width, uint32_t height) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = staging_offset;
+        region.bufferRowLength = 0u;
+        region.bufferImageHeight = 0u;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = mip_level;
+        region.imageSubresource.baseArrayLayer = 0u;
+        region.imageSubresource.layerCount = 1u;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {width, height, 1};
+        return region;
+    }
+    
+    // For levels written straight into ring space, they go out in a single copy command. Textures that upload
+    // mip 0 only get the remaining levels from generateMipmaps() afterwards.
+    void queueStagedImageUpload(VkImage dst_image, std::vector<VkBufferImageCopy> regions, uint32_t mip_levels, bool is_first_part = true, bool is_last_part = true) {
+        PendingImageUpload upload{};
+        upload.dst_image = dst_image;
+        upload.regions = std::move(regions);
+        upload.mip_levels = mip_levels;
+        upload.is_first_part = is_first_part;
+        upload.is_last_part = is_last_part;
+        m_pending_image_uploads.push_back(std::move(upload));
+    }
+    
+    bool hasPendingUploads() const {
+        return !m_pending_uploads.empty() || !m_pending_image_uploads.empty();
+    }
+    
+    static VkImageMemoryBarrier getUploadImageBarrier(const PendingImageUpload& upload) {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = upload.dst_image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0u;
+        barrier.subresourceRange.levelCount = upload.mip_levels;
+        barrier.subresourceRange.baseArrayLayer = 0u;
+        barrier.subresourceRange.layerCount = 1u;
+        return barrier;
+    }
+    
+    // Records the staged copies. When they run on a separate transfer family the destinations are released
+    // to the graphics family here and the matching acquires are left for recordPendingAcquires().
+    void recordPendingUploads(VkCommandBuffer command_buffer, bool on_transfer_queue) {
+        if(!hasPendingUploads()) {
+            return;
+        }
+        bool release_ownership = on_transfer_queue && m_queue_family_indices.hasSeparateTransfer();
+        
+        if(!m_pending_image_uploads.empty()) {
+            std::vector<VkImageMemoryBarrier> to_transfer_dst;
+            VkPipelineStageFlags src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            for(const PendingImageUpload& upload : m_pending_image_uploads) {
+                VkImageMemoryBarrier barrier = getUploadImageBarrier(upload);
+                if(upload.is_first_part) {
+                    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+                    barrier.srcAccessMask = 0u;
+                }
+                else {
+                    // keeps the parts copied by earlier submissions
+                    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                    src_stages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+                }
+                barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                to_transfer_dst.push_back(barrier);
+            }
+            vkCmdPipelineBarrier(command_buffer, src_stages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0u, 0u, nullptr, 0u, nullptr, static_cast<uint32_t>(to_transfer_dst.size()), to_transfer_dst.data());
+            
+            for(const PendingImageUpload& upload : m_pending_image_uploads) {
+                vkCmdCopyBufferToImage(command_buffer, m_staging_buffer, upload.dst_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(upload.regions.size()), upload.regions.data());
+            }
+        }
         
-        VkBuffer staging_buffer;
-        VkDeviceMemory staging_memory;
-        createBuffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging_buffer, staging_memory);
+        // consecutive uploads into the same buffer go out as one copy command
+        std::vector<VkBufferCopy> regions;
+        for(size_t i = 0u; i < m_pending_uploads.size(); ++i) {
+            regions.push_back(m_pending_uploads[i].region);
+            bool is_last_for_buffer = i + 1u == m_pending_uploads.size() || m_pending_uploads[i + 1u].dst_buffer != m_pending_uploads[i].dst_buffer;
+            if(is_last_for_buffer) {
+                vkCmdCopyBuffer(command_buffer, m_staging_buffer, m_pending_uploads[i].dst_buffer, static_cast<uint32_t>(regions.size()), regions.data());
+                regions.clear();
+            }
+        }
         
-        void* data;
-        vkMapMemory(m_device, staging_memory, 0, buffer_size, 0u, &data);
-        memcpy(data, vertices.data(), buffer_size);
-        vkUnmapMemory(m_device, staging_memory);
+        if(release_ownership) {
+            std::vector<VkBufferMemoryBarrier> buffer_releases;
+            for(const PendingBufferUpload& upload : m_pending_uploads) {
+                VkBufferMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                barrier.srcQueueFamilyIndex = m_queue_family_indices.transfer_family.value();
+                barrier.dstQueueFamilyIndex = m_queue_family_indices.graphics_family.value();
+                barrier.buffer = upload.dst_buffer;
+                barrier.offset = upload.region.dstOffset;
+                barrier.size = upload.region.size;
+                
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = 0u;
+                buffer_releases.push_back(barrier);
+                
+                barrier.srcAccessMask = 0u;
+                barrier.dstAccessMask = UPLOAD_CONSUMER_ACCESS;
+                m_pending_buffer_acquires.push_back(barrier);
+            }
+            
+            std::vector<VkImageMemoryBarrier> image_releases;
+            for(const PendingImageUpload& upload : m_pending_image_uploads) {
+                if(!upload.is_last_part) {
+                    continue;
+                }
+                VkImageMemoryBarrier barrier = getUploadImageBarrier(upload);
+                barrier.srcQueueFamilyIndex = m_queue_family_indices.transfer_family.value();
+                barrier.dstQueueFamilyIndex = m_queue_family_indices.graphics_family.value();
+                
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = 0u;
+                image_releases.push_back(barrier);
+                
+                // the acquiring side goes on with the mip chain blits or the layout transition
+                barrier.srcAccessMask = 0u;
+                barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+                m_pending_image_acquires.push_back(barrier);
+            }
+            
+            vkCmdPipelineBarrier(
+                command_buffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                0u,
+                0u, nullptr,
+                static_cast<uint32_t>(buffer_releases.size()), buffer_releases.data(),
+                static_cast<uint32_t>(image_releases.size()), image_releases.data()
+            );
+        }
+        else if(!on_transfer_queue) {
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = UPLOAD_CONSUMER_ACCESS;
+            vkCmdPipelineBarrier(
+                command_buffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                UPLOAD_CONSUMER_STAGES,
+                0u,
+                1u, &barrier,
+                0u, nullptr,
+                0u, nullptr
+            );
+        }
+        // same family on the transfer queue: the timeline semaphore wait already makes the writes visible
         
-        createBuffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertex_buffer, m_vertex_memory);
-        copyBuffer(staging_buffer, m_vertex_buffer, buffer_size);
+        m_pending_uploads.clear();
+        m_pending_image_uploads.clear();
+    }
+    
+    // Must be recorded by a graphics submission that waits on m_upload_wait_ticket.
+    void recordPendingAcquires(VkCommandBuffer command_buffer) {
+        if(!m_pending_buffer_acquires.empty()) {
+            vkCmdPipelineBarrier(
+                command_buffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                UPLOAD_CONSUMER_STAGES,
+                0u,
+                0u, nullptr,
+                static_cast<uint32_t>(m_pending_buffer_acquires.size()), m_pending_buffer_acquires.data(),
+                0u, nullptr
+            );
+            m_pending_buffer_acquires.clear();
+        }
+        if(!m_pending_image_acquires.empty()) {
+            vkCmdPipelineBarrier(
+                command_buffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0u,
+                0u, nullptr,
+                0u, nullptr,
+                static_cast<uint32_t>(m_pending_image_acquires.size()), m_pending_image_acquires.data()
+            );
+            m_pending_image_acquires.clear();
+        }
+    }
+    
+    // Sends the staged copies to the transfer queue without waiting for them. Graphics work that reads
+    // the destinations waits on the returned ticket, the next frame does so through m_upload_wait_ticket.
+    UploadTicket submitUploads() {
+        if(!hasPendingUploads()) {
+            return UploadTicket{};
+        }
+        if(!m_timeline_supported) {
+            VkCommandBuffer command_buffer = beginSingleTimeCommands(m_grapics_cmd_pool);
+            recordPendingUploads(command_buffer, false);
+            return endSingleTimeCommands(command_buffer, m_graphics_queue, m_grapics_cmd_pool, m_graphics_timeline);
+        }
         
-        vkDestroyBuffer(m_device, staging_buffer, nullptr);
-        vkFreeMemory(m_device, staging_memory, nullptr);
+        VkCommandBuffer command_buffer = beginSingleTimeCommands(m_transfer_cmd_pool);
+        recordPendingUploads(command_buffer, true);
+        UploadTicket ticket = endSingleTimeCommands(command_buffer, m_transfer_queue, m_transfer_cmd_pool, m_transfer_timeline);
+        m_upload_wait_ticket = ticket;
+        return ticket;
+    }
+    
+    // Submits pending uploads and waits for them, after which the whole ring is free again.
+    void flushUploads() {
+        submitUploads();
+        if(m_timeline_supported) {
+            // with timeline semaphores only the transfer queue reads the ring, its last submission covers all of them
+            waitUpload(UploadTicket{m_transfer_timeline.semaphore, m_transfer_timeline.last_value});
+        }
+        else {
+            vkDeviceWaitIdle(m_device);
+        }
+        m_staging_ring.reset();
+    }
+    
+    void waitUpload(const UploadTicket& ticket) {
+        if(ticket.semaphore == VK_NULL_HANDLE) {
+            return;
+        }
+        VkSemaphoreWaitInfo wait_info{};
+        wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        wait_info.semaphoreCount = 1u;
+        wait_info.pSemaphores = &ticket.semaphore;
+        wait_info.pValues = &ticket.value;
+        VkResult result = m_pfnWaitSemaphores(m_device, &wait_info, UINT64_MAX);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to wait for timeline semaphore!");
+        }
+    }
+    
+    bool isUploadComplete(const UploadTicket& ticket) {
+        if(ticket.semaphore == VK_NULL_HANDLE) {
+            return true;
+        }
+        uint64_t completed_value = 0u;
+        m_pfnGetSemaphoreCounterValue(m_device, ticket.semaphore, &completed_value);
+        return completed_value >= ticket.value;
     }
     
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-        VkCommandBuffer command_buffer = beginSingleTimeCommands(m_grapics_cmd_pool);
-        
-        VkBufferImageCopy region{};
-        region.bufferOffset = 0u;
-        region.bufferRowLength = 0u;
-        region.bufferImageHeight = 0u;
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0u;
-        region.imageSubresource.baseArrayLayer = 0u;
-        region.imageSubresource.layerCount = 1u;
-        region.imageOffset = {0, 0, 0};
-        region.imageExtent = {width, height, 1};
-        vkCmdCopyBufferToImage(command_buffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1u, &region);
-        
-        endSingleTimeCommands(command_buffer, m_graphics_queue, m_grapics_cmd_pool);
+    void createSubmissionTimelines() {
+        if(!m_timeline_supported) {
+            return;
+        }
+        for(SubmissionTimeline* timeline : {&m_graphics_timeline, &m_transfer_timeline}) {
+            VkSemaphoreTypeCreateInfo type_info{};
+            type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+            type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+            type_info.initialValue = 0u;
+            
+            VkSemaphoreCreateInfo semaphore_info{};
+            semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            semaphore_info.pNext = &type_info;
+            
+            VkResult result = vkCreateSemaphore(m_device, &semaphore_info, nullptr, &timeline->semaphore);
+            if(result != VK_SUCCESS) {
+                throw std::runtime_error("failed to create timeline semaphore!");
+            }
+        }
+    }
+    
+    void recycleSingleTimeCommands(SubmissionTimeline& timeline, VkCommandPool command_pool) {
+        std::erase_if(timeline.in_flight, [&](const std::pair<uint64_t, VkCommandBuffer>& entry) {
+            if(!isUploadComplete(UploadTicket{timeline.semaphore, entry.first})) {
+                return false;
+            }
+            vkFreeCommandBuffers(m_device, command_pool, 1u, &entry.second);
+            return true;
+        });
     }
     
     uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties) {
@@ -914,7 +6423,7 @@ private:
         vkGetPhysicalDeviceMemoryProperties(m_physical_device, &mem_prop);
         for(uint32_t i = 0u; i < mem_prop.memoryTypeCount; ++i) {
             bool is_type_suit = type_filter & (1 << i);
-            bool is_type_adequate = mem_prop.memoryTypes[i].propertyFlags & properties;
+            bool is_type_adequate = (mem_prop.memoryTypes[i].propertyFlags & properties) == properties;
             if(is_type_suit && is_type_adequate) {
                 return i;
             }
@@ -923,68 +6432,58 @@ private:
         throw std::runtime_error("failed to find suitable memory type!");
     }
     
-    VkDeviceMemory createMemory(VkBuffer buffer, VkMemoryPropertyFlags properties) {
+    MemoryAllocation createMemory(VkBuffer buffer, VkMemoryPropertyFlags properties) {
         VkMemoryRequirements mem_requirements{};
         vkGetBufferMemoryRequirements(m_device, buffer, &mem_requirements);
         uint32_t mem_type_idx = findMemoryType(mem_requirements.memoryTypeBits, properties);
         
-        VkMemoryAllocateInfo alloc_info{};
-        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        alloc_info.allocationSize = mem_requirements.size;
-        alloc_info.memoryTypeIndex = mem_type_idx;
-        VkDeviceMemory memory;
-        VkResult result = vkAllocateMemory(m_device, &alloc_info, nullptr, &memory);
-        if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate buffer memory!");
-        }
-        return memory;
+        return m_allocator.allocate(mem_requirements, mem_type_idx, AllocationKind::Linear);
     }
     
-    VkDescriptorSetLayout createDescSetLayout() {
-        VkDescriptorSetLayoutBinding ubo_layout_binding{};
-        ubo_layout_binding.binding = 0u;
-        ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        ubo_layout_binding.descriptorCount = 1u;
-        ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-        ubo_layout_binding.pImmutableSamplers = nullptr;
-        
+    // Set 0 holds the textures, set 1 the dynamic uniform blocks. They are kept apart because dynamic buffers
+    // can not be part of an update-after-bind layout.
+    void createDescSetLayouts() {
         VkDescriptorSetLayoutBinding sampler_layout_binding{};
         sampler_layout_binding.binding = 1u;
-        sampler_layout_binding.descriptorCount = 1u;
+        sampler_layout_binding.descriptorCount = m_bindless_capacity;
         sampler_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         sampler_layout_binding.pImmutableSamplers = nullptr;
         sampler_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
         
-        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {ubo_layout_binding, sampler_layout_binding};
-     
-        VkDescriptorSetLayoutCreateInfo layout_info{};
-        layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
-        layout_info.pBindings = bindings.data();
-        
-        VkDescriptorSetLayout desc_set_layout = VK_NULL_HANDLE;
-        VkResult result = vkCreateDescriptorSetLayout(m_device, &layout_info, nullptr, &desc_set_layout);
-        if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor set layout!");
+        if(m_bindless_enabled) {
+            // the texture array only has to be valid where the shader reads it and may be written while the set is bound
+            m_texture_set_layout = m_desc_layout_cache.get(m_device, {sampler_layout_binding}, {VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT}, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT);
+        }
+        else {
+            m_texture_set_layout = m_desc_layout_cache.get(m_device, {sampler_layout_binding}, {}, 0u);
         }
         
-        return desc_set_layout;
+        // 0 - frame block, 1 - object block
+        std::vector<VkDescriptorSetLayoutBinding> uniform_bindings(2u);
+        for(uint32_t i = 0u; i < uniform_bindings.size(); ++i) {
+            uniform_bindings[i].binding = i;
+            uniform_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            uniform_bindings[i].descriptorCount = 1u;
+            uniform_bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+            uniform_bindings[i].pImmutableSamplers = nullptr;
+        }
+        m_uniform_set_layout = m_desc_layout_cache.get(m_device, uniform_bindings, {}, 0u);
     }
     
-    void createUniformBuffers() {
-        VkDeviceSize buffer_size = sizeof(UniformBufferObject);
-        
-        m_uniform_buffers.resize(MAX_FRAMES_IN_FLIGHT);
-        m_uniform_memory.resize(MAX_FRAMES_IN_FLIGHT);
-        m_uniform_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+    // One arena region per frame in flight, sized for the frame block and an object block per draw.
+    void createUniformArena() {
+        VkPhysicalDeviceProperties device_props{};
+        vkGetPhysicalDeviceProperties(m_physical_device, &device_props);
+        VkDeviceSize alignment = device_props.limits.minUniformBufferOffsetAlignment;
+        VkDeviceSize region_size = UniformArena::alignedSize(sizeof(FrameUniforms), alignment)
+                                 + UniformArena::alignedSize(sizeof(ObjectUniforms), alignment) * std::max(m_options.draw_count, 1u);
         
-        for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-            createBuffer(buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_uniform_buffers[i], m_uniform_memory[i]);
-            vkMapMemory(m_device, m_uniform_memory[i], 0u, buffer_size, 0u, &m_uniform_mapped[i]);
-        }
+        VkDeviceSize buffer_size = UniformArena::alignedSize(region_size, alignment) * MAX_FRAMES_IN_FLIGHT;
+        createBuffer(buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_uniform_buffer, m_uniform_memory);
+        m_uniform_arena.init(m_uniform_memory.mapped, region_size, alignment, MAX_FRAMES_IN_FLIGHT);
     }
     
-    void createImage(const VkImageCreateInfo& image_info, VkImage& image, VkDeviceMemory& memory, VkMemoryPropertyFlags properties) {
+    void createImage(const VkImageCreateInfo& image_info, VkImage& image, MemoryAllocation& memory, VkMemoryPropertyFlags properties) {
         VkResult result = vkCreateImage(m_device, &image_info, nullptr, &image);
         if(result != VK_SUCCESS) {
             throw std::runtime_error("failed to create image!");
@@ -994,16 +6493,9 @@ private:
         vkGetImageMemoryRequirements(m_device, image, &mem_req);
         
         uint32_t mem_type_idx = findMemoryType(mem_req.memoryTypeBits, properties);
-        VkMemoryAllocateInfo alloc_info{};
-        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        alloc_info.allocationSize = mem_req.size;
-        alloc_info.memoryTypeIndex = mem_type_idx;
-        
-        result = vkAllocateMemory(m_device, &alloc_info, nullptr, &memory);
-        if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-        vkBindImageMemory(m_device, image, memory, 0u);
+        AllocationKind kind = image_info.tiling == VK_IMAGE_TILING_OPTIMAL ? AllocationKind::Optimal : AllocationKind::Linear;
+        memory = m_allocator.allocate(mem_req, mem_type_idx, kind);
+        vkBindImageMemory(m_device, image, memory.memory, memory.offset);
     }
     
     void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout old_layout, VkImageLayout new_layout, uint32_t mip_levels) {
@@ -1057,7 +6549,7 @@ private:
         barrier.subresourceRange.layerCount = 1u;
         vkCmdPipelineBarrier(command_buffer, source_stage, destination_stage, 0u, 0u, nullptr, 0u, nullptr, 1u, &barrier);
         
-        endSingleTimeCommands(command_buffer, m_graphics_queue, m_grapics_cmd_pool);
+        endSingleTimeCommands(command_buffer, m_graphics_queue, m_grapics_cmd_pool, m_graphics_timeline);
     }
     
     VkCommandBuffer beginSingleTimeCommands(VkCommandPool command_pool) {
@@ -1078,7 +6570,9 @@ private:
         return command_buffer;
     }
     
-    void endSingleTimeCommands(VkCommandBuffer command_buffer, VkQueue queue, VkCommandPool command_pool) {
+    // Submits without waiting for the queue and returns the ticket the work signals on the timeline.
+    // The command buffer goes back to the pool on a later call, once the timeline has passed it.
+    UploadTicket endSingleTimeCommands(VkCommandBuffer command_buffer, VkQueue queue, VkCommandPool command_pool, SubmissionTimeline& timeline, const UploadTicket& wait_ticket = UploadTicket{}, VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT) {
         vkEndCommandBuffer(command_buffer);
         
         VkSubmitInfo submit_info{};
@@ -1086,9 +6580,38 @@ private:
         submit_info.commandBufferCount = 1u;
         submit_info.pCommandBuffers = &command_buffer;
         
-        vkQueueSubmit(queue, 1u, &submit_info, VK_NULL_HANDLE);
-        vkQueueWaitIdle(queue);
-        vkFreeCommandBuffers(m_device, command_pool, 1u, &command_buffer);
+        if(!m_timeline_supported) {
+            vkQueueSubmit(queue, 1u, &submit_info, VK_NULL_HANDLE);
+            vkQueueWaitIdle(queue);
+            vkFreeCommandBuffers(m_device, command_pool, 1u, &command_buffer);
+            return UploadTicket{};
+        }
+        
+        recycleSingleTimeCommands(timeline, command_pool);
+        
+        uint64_t signal_value = ++timeline.last_value;
+        VkTimelineSemaphoreSubmitInfo timeline_info{};
+        timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timeline_info.signalSemaphoreValueCount = 1u;
+        timeline_info.pSignalSemaphoreValues = &signal_value;
+        submit_info.pNext = &timeline_info;
+        submit_info.signalSemaphoreCount = 1u;
+        submit_info.pSignalSemaphores = &timeline.semaphore;
+        if(wait_ticket.semaphore != VK_NULL_HANDLE) {
+            timeline_info.waitSemaphoreValueCount = 1u;
+            timeline_info.pWaitSemaphoreValues = &wait_ticket.value;
+            submit_info.waitSemaphoreCount = 1u;
+            submit_info.pWaitSemaphores = &wait_ticket.semaphore;
+            submit_info.pWaitDstStageMask = &wait_stage;
+        }
+        
+        VkResult result = vkQueueSubmit(queue, 1u, &submit_info, VK_NULL_HANDLE);
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit single time commands!");
+        }
+        timeline.in_flight.emplace_back(signal_value, command_buffer);
+        
+        return UploadTicket{timeline.semaphore, signal_value};
     }
     
     VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags, uint32_t mip_levels) {
@@ -1139,7 +6662,11 @@ private:
         sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
         sampler_info.mipLodBias = 0.0f;
         sampler_info.minLod = 0.0f;
-        sampler_info.maxLod = static_cast<float>(m_mip_levels);;
+        uint32_t max_mip_levels = 1u;
+        for(const Texture& texture : m_textures) {
+            max_mip_levels = std::max(max_mip_levels, texture.mip_levels);
+        }
+        sampler_info.maxLod = static_cast<float>(max_mip_levels);
         
         VkResult result = vkCreateSampler(m_device, &sampler_info, nullptr, &m_texture_sampler);
         if(result != VK_SUCCESS) {
@@ -1147,15 +6674,26 @@ private:
         }
     }
     
-    void generateMipmaps(VkImage image, VkFormat image_format, int32_t tex_width, uint32_t tex_height, uint32_t mip_levels) {
-        VkFormatProperties format_properties;
-        vkGetPhysicalDeviceFormatProperties(m_physical_device, image_format, &format_properties);
-        if (!(format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-            throw std::runtime_error("texture image format does not support linear blitting!");
+    // Blits the mip chains of textures whose level 0 was just uploaded, all of them in one graphics submission.
+    void generateMipmaps(const std::vector<const Texture*>& textures) {
+        for(const Texture* texture : textures) {
+            VkFormatProperties format_properties;
+            vkGetPhysicalDeviceFormatProperties(m_physical_device, texture->format, &format_properties);
+            if (!(format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+                throw std::runtime_error("texture image format does not support linear blitting!");
+            }
         }
     
         VkCommandBuffer command_buffer = beginSingleTimeCommands(m_grapics_cmd_pool);
-        
+        // takes the images over from the transfer queue before the first blit
+        recordPendingAcquires(command_buffer);
+        for(const Texture* texture : textures) {
+            recordMipmaps(command_buffer, texture->image, static_cast<int32_t>(texture->width), static_cast<int32_t>(texture->height), texture->mip_levels);
+        }
+        endSingleTimeCommands(command_buffer, m_graphics_queue, m_grapics_cmd_pool, m_graphics_timeline, m_upload_wait_ticket, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    }
+    
+    void recordMipmaps(VkCommandBuffer command_buffer, VkImage image, int32_t tex_width, int32_t tex_height, uint32_t mip_levels) {
         VkImageMemoryBarrier barrier{};
         barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         barrier.image = image;
@@ -1214,100 +6752,330 @@ private:
         barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
         vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0u, 0u, nullptr, 0u, nullptr, 1u, &barrier);
-        
-        endSingleTimeCommands(command_buffer, m_graphics_queue, m_grapics_cmd_pool);
     }
     
-    void createColorResources() {
-        VkFormat color_format = m_swapchain_params.surface_format.format;
-        VkImageCreateInfo image_info{};
-        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        image_info.imageType = VK_IMAGE_TYPE_2D;
-        image_info.extent.width = static_cast<uint32_t>(m_swapchain_params.extent.width);
-        image_info.extent.height = static_cast<uint32_t>(m_swapchain_params.extent.height);
-        image_info.extent.depth = 1u;
-        image_info.mipLevels = 1u;
-        image_info.arrayLayers = 1u;
-        image_info.format = color_format;
-        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        image_info.usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        image_info.samples = m_msaa_samples;
-        image_info.flags = 0u;
-        createImage(image_info, m_color_image, m_color_image_memory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        m_color_image_view = createImageView(m_color_image, color_format, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    void setImageDebugName(VkImage image, const std::string& name) {
+#ifndef NDEBUG
+        const VkDebugMarkerObjectNameInfoEXT imageNameInfo = {
+            .sType = VK_STRUCTURE_TYPE_DEBUG_MARKER_OBJECT_NAME_INFO_EXT,
+            .pNext = NULL,
+            .objectType = VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_EXT,
+            .object = (uint64_t)image,
+            .pObjectName = name.c_str()
+        };
+
+        m_pfnDebugMarkerSetObjectNameEXT(m_device, &imageNameInfo);
+#endif
     }
     
-    VkImage createImage(const std::string& path_to_file) {
-        int tex_width;
-        int tex_height;
-        int tex_channels;
-        stbi_uc* pixels = stbi_load(
-            path_to_file.c_str(),
-            &tex_width,
-            &tex_height,
-            &tex_channels,
-            STBI_rgb_alpha
-        );
-        if (!pixels) {
-            throw std::runtime_error("failed to load texture image!");
-        }
-        VkDeviceSize image_size = tex_width * tex_height * 4;
-        
-        m_mip_levels = static_cast<uint32_t>(std::floor(std::log2(std::max(tex_width, tex_height)))) + 1u;
-        
-        VkBuffer staging_buffer;
-        VkDeviceMemory staging_memory;
-        createBuffer(image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging_buffer, staging_memory);
-        
-        void* data;
-        vkMapMemory(m_device, staging_memory, 0, image_size, 0, &data);
-        memcpy(data, pixels, static_cast<size_t>(image_size));
-        vkUnmapMemory(m_device, staging_memory);
-        
-        stbi_image_free(pixels);
-        
+    void createTextureImage(Texture& texture, VkImageUsageFlags usage) {
         VkImageCreateInfo image_info{};
         image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
         image_info.imageType = VK_IMAGE_TYPE_2D;
-        image_info.extent.width = static_cast<uint32_t>(tex_width);
-        image_info.extent.height = static_cast<uint32_t>(tex_height);
+        image_info.extent.width = texture.width;
+        image_info.extent.height = texture.height;
         image_info.extent.depth = 1u;
-        image_info.mipLevels = m_mip_levels;
+        image_info.mipLevels = texture.mip_levels;
         image_info.arrayLayers = 1u;
-        image_info.format = VK_FORMAT_R8G8B8A8_SRGB;
+        image_info.format = texture.format;
         image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
         image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        image_info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        image_info.usage = usage;
         image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
         image_info.samples = VK_SAMPLE_COUNT_1_BIT;
         image_info.flags = 0u;
+        createImage(image_info, texture.image, texture.memory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+    
+    // KTX2 and DDS files are uploaded one after another first. The other images are then decoded by a
+    // TextureDecodeQueue into staging space reserved for them, while this thread submits the copies and mip
+    // chains of every batch that finished. The ring is only flushed once no decode is writing into it.
+    void loadTextures(const std::vector<std::string>& paths) {
+        if(m_bindless_enabled && paths.size() > m_bindless_capacity) {
+            throw std::runtime_error("too many textures for the bindless array: " + std::to_string(paths.size()) + " > " + std::to_string(m_bindless_capacity));
+        }
+        using clock = std::chrono::high_resolution_clock;
+        auto load_start = clock::now();
+        m_textures.resize(paths.size());
+        m_texture_stats.resize(paths.size());
+        std::vector<size_t> decoded_textures;
+        for(size_t i = 0u; i < paths.size(); ++i) {
+            if(isTextureContainerFile(paths[i])) {
+                loadTextureContainer(paths[i], m_textures[i], m_texture_stats[i]);
+            }
+            else {
+                decoded_textures.push_back(i);
+            }
+        }
         
-        VkImage image;
-        createImage(image_info, image, m_texture_memory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        
-        transitionImageLayout(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mip_levels);
-        copyBufferToImage(staging_buffer, image, static_cast<uint32_t>(tex_width), static_cast<uint32_t>(tex_height));
-        //transitionImageLayout(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_mip_levels);
-        generateMipmaps(image, VK_FORMAT_R8G8B8A8_SRGB, tex_width, tex_height, m_mip_levels);
+        TextureDecodeQueue decode_queue;
+        decode_queue.init(std::max(1u, m_options.worker_threads));
+        std::vector<clock::time_point> dispatch_times(paths.size());
+        std::vector<VkDeviceSize> staging_offsets(paths.size());
+        std::vector<TextureDecodeQueue::Job> banded_jobs; // decoded, waiting for the other decodes to leave the ring
+        size_t next_texture = 0u;
+        double decode_sum_ms = 0.0;
+        try {
+            while(next_texture < decoded_textures.size() || decode_queue.inFlight() > 0u || !banded_jobs.empty()) {
+                // keeps the decoders fed as long as the ring has room and no decoded image waits for its bands
+                while(next_texture < decoded_textures.size() && banded_jobs.empty()) {
+                    size_t index = decoded_textures[next_texture];
+                    int tex_width;
+                    int tex_height;
+                    int tex_channels;
+                    if(!stbi_info(paths[index].c_str(), &tex_width, &tex_height, &tex_channels)) {
+                        throw std::runtime_error("failed to load texture image: " + paths[index] + "\n");
+                    }
+                    // images larger than a chunk keep their pixels and are staged in row bands once decoded
+                    VkDeviceSize image_size = static_cast<VkDeviceSize>(tex_width) * tex_height * 4u;
+                    std::optional<VkDeviceSize> staging_offset;
+                    if(image_size <= STAGING_CHUNK_SIZE) {
+                        staging_offset = m_staging_ring.allocate(image_size, STAGING_ALIGNMENT);
+                        if(!staging_offset.has_value()) {
+                            if(decode_queue.inFlight() > 0u) {
+                                break;
+                            }
+                            staging_offset = reserveStaging(image_size, STAGING_ALIGNMENT);
+                        }
+                    }
+                    
+                    Texture& texture = m_textures[index];
+                    texture.format = VK_FORMAT_R8G8B8A8_SRGB;
+                    texture.width = static_cast<uint32_t>(tex_width);
+                    texture.height = static_cast<uint32_t>(tex_height);
+                    texture.mip_levels = static_cast<uint32_t>(std::floor(std::log2(std::max(tex_width, tex_height)))) + 1u;
+                    createTextureImage(texture, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+                    
+                    TextureDecodeQueue::Job job{};
+                    job.texture_index = index;
+                    job.file_name = paths[index];
+                    job.width = texture.width;
+                    job.height = texture.height;
+                    job.dst = nullptr;
+                    if(staging_offset.has_value()) {
+                        staging_offsets[index] = staging_offset.value();
+                        job.dst = static_cast<uint8_t*>(getStagingPointer(staging_offset.value()));
+                    }
+                    dispatch_times[index] = clock::now();
+                    decode_queue.push(std::move(job));
+                    ++next_texture;
+                }
+                
+                std::vector<TextureDecodeQueue::Job> finished;
+                std::vector<const Texture*> batch;
+                for(TextureDecodeQueue::Job& job : decode_queue.takeFinished()) {
+                    if(!job.error.empty()) {
+                        throw std::runtime_error(job.error);
+                    }
+                    if(!job.dst) {
+                        banded_jobs.push_back(std::move(job));
+                        continue;
+                    }
+                    const Texture& texture = m_textures[job.texture_index];
+                    // mip 0 only, the rest of the chain is blitted
+                    queueStagedImageUpload(texture.image, {getImageUploadRegion(staging_offsets[job.texture_index], 0u, texture.width, texture.height)}, texture.mip_levels);
+                    batch.push_back(&texture);
+                    finished.push_back(std::move(job));
+                }
+                // the bands may flush the ring, which is only safe while no decode writes into it
+                if(decode_queue.inFlight() == 0u) {
+                    for(TextureDecodeQueue::Job& job : banded_jobs) {
+                        const Texture& texture = m_textures[job.texture_index];
+                        queueImageRowBands(texture, job.pixels.get());
+                        job.pixels.reset();
+                        batch.push_back(&texture);
+                        finished.push_back(std::move(job));
+                    }
+                    banded_jobs.clear();
+                }
+                if(finished.empty()) {
+                    continue;
+                }
+                // one transfer submission for the copies and one graphics submission for all mip chains of the batch
+                submitUploads();
+                generateMipmaps(batch);
+                auto submit_time = clock::now();
+                
+                for(const TextureDecodeQueue::Job& job : finished) {
+                    const Texture& texture = m_textures[job.texture_index];
+                    TextureLoadStats& stats = m_texture_stats[job.texture_index];
+                    stats.file_name = job.file_name;
+                    stats.file_format = texture.format;
+                    stats.image_format = texture.format;
+                    stats.width = texture.width;
+                    stats.height = texture.height;
+                    stats.mip_levels = texture.mip_levels;
+                    for(uint32_t level = 0u; level < texture.mip_levels; ++level) {
+                        stats.image_bytes += static_cast<size_t>(std::max(1u, texture.width >> level)) * std::max(1u, texture.height >> level) * 4u;
+                    }
+                    stats.rgba8_bytes = stats.image_bytes;
+                    stats.decode_kernel = "stb_image";
+                    stats.decode_ms = job.decode_ms;
+                    stats.wait_ms = elapsedMs(job.finish, submit_time);
+                    stats.load_ms = elapsedMs(dispatch_times[job.texture_index], submit_time);
+                    decode_sum_ms += job.decode_ms;
+                }
+            }
+        }
+        catch(...) {
+            decode_queue.destroy();
+            throw;
+        }
+        decode_queue.destroy();
         
-        vkDestroyBuffer(m_device, staging_buffer, nullptr);
-        vkFreeMemory(m_device, staging_memory, nullptr);
+        for(size_t i = 0u; i < paths.size(); ++i) {
+            Texture& texture = m_textures[i];
+            texture.view = createImageView(texture.image, texture.format, VK_IMAGE_ASPECT_COLOR_BIT, texture.mip_levels);
+            setImageDebugName(texture.image, paths[i]);
+        }
+        m_texture_load_ms = elapsedMs(load_start, clock::now());
+        if(!decoded_textures.empty()) {
+            std::cout << "textures: " << decoded_textures.size() << " decoded on " << decode_queue.threadCount() << " threads, "
+                      << paths.size() << " loaded in " << m_texture_load_ms << " ms (" << decode_sum_ms << " ms of decoding)" << std::endl;
+        }
+    }
+    
+    // Stages mip 0 of an RGBA8 texture in bands of whole rows of at most STAGING_CHUNK_SIZE. When the ring is full
+    // the bands staged so far go out first.
+    void queueImageRowBands(const Texture& texture, const uint8_t* pixels) {
+        size_t row_bytes = static_cast<size_t>(texture.width) * 4u;
+        uint32_t band_rows = static_cast<uint32_t>(std::clamp<size_t>(STAGING_CHUNK_SIZE / row_bytes, 1u, texture.height));
+        std::vector<VkBufferImageCopy> regions;
+        bool is_first_part = true;
+        for(uint32_t y = 0u; y < texture.height; y += band_rows) {
+            uint32_t rows = std::min(band_rows, texture.height - y);
+            size_t band_size = rows * row_bytes;
+            std::optional<VkDeviceSize> staging_offset = m_staging_ring.allocate(band_size, STAGING_ALIGNMENT);
+            if(!staging_offset.has_value()) {
+                // reserveStaging() flushes the ring, the bands already in it have to be queued before
+                if(!regions.empty()) {
+                    queueStagedImageUpload(texture.image, std::move(regions), texture.mip_levels, is_first_part, false);
+                    regions.clear();
+                    is_first_part = false;
+                }
+                staging_offset = reserveStaging(band_size, STAGING_ALIGNMENT);
+            }
+            memcpy(getStagingPointer(staging_offset.value()), pixels + y * row_bytes, band_size);
+            VkBufferImageCopy region = getImageUploadRegion(staging_offset.value(), 0u, texture.width, rows);
+            region.imageOffset.y = static_cast<int32_t>(y);
+            regions.push_back(region);
+        }
+        queueStagedImageUpload(texture.image, std::move(regions), texture.mip_levels, is_first_part, true);
+    }
+    
+    // Uploads a KTX2 or DDS texture with the mip levels stored in the file, so cooked textures skip generateMipmaps().
+    // Levels go out in one copy command unless they do not fit into the staging ring together.
+    // Block-compressed formats the device can not sample are decoded on the worker pool straight into the staging ring.
+    void loadTextureContainer(const std::string& path_to_file, Texture& texture, TextureLoadStats& stats) {
+        auto load_start = std::chrono::high_resolution_clock::now();
+        MappedFile file(path_to_file);
+        const uint8_t* file_data = reinterpret_cast<const uint8_t*>(file.data());
+        TextureFile container = parseTextureFile(file_data, file.size(), path_to_file);
+        
+        std::vector<VkFormat> candidates = {container.format};
+        VkFormat decoded_format = BlockDecoder::getDecodedFormat(container.format);
+        if(decoded_format != VK_FORMAT_UNDEFINED) {
+            candidates.push_back(decoded_format);
+        }
+        texture.format = findSupportedFormat(candidates, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+        bool decode = texture.format != container.format;
+        texture.width = container.levels[0].width;
+        texture.height = container.levels[0].height;
+        texture.mip_levels = static_cast<uint32_t>(container.levels.size());
+        createTextureImage(texture, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+        
+        // Levels are staged in bands of whole block rows of at most STAGING_CHUNK_SIZE, every band starts at a STAGING_ALIGNMENT
+        // boundary, a multiple of all block and texel sizes. When the ring is full the bands staged so far go out first.
+        uint32_t block_height = getBlockBytes(container.format) != 0u ? 4u : 1u;
+        size_t texel_bytes = decode ? BlockDecoder::getDecodedTexelBytes(container.format) : 0u;
+        BlockDecoder decoder;
+        std::vector<VkBufferImageCopy> regions;
+        bool is_first_part = true;
+        for(uint32_t level = 0u; level < texture.mip_levels; ++level) {
+            const TextureFileLevel& texture_level = container.levels[level];
+            uint32_t block_rows = (texture_level.height + block_height - 1u) / block_height;
+            size_t src_row_bytes = texture_level.size / block_rows;
+            size_t dst_row_bytes = decode ? texture_level.width * texel_bytes * block_height : src_row_bytes;
+            uint32_t band_rows = static_cast<uint32_t>(std::clamp<size_t>(STAGING_CHUNK_SIZE / dst_row_bytes, 1u, block_rows));
+            for(uint32_t first_row = 0u; first_row < block_rows; first_row += band_rows) {
+                uint32_t rows = std::min(band_rows, block_rows - first_row);
+                uint32_t y = first_row * block_height;
+                uint32_t height = std::min(rows * block_height, texture_level.height - y);
+                size_t band_size = decode ? texture_level.width * texel_bytes * height : rows * src_row_bytes;
+                std::optional<VkDeviceSize> staging_offset = m_staging_ring.allocate(band_size, STAGING_ALIGNMENT);
+                if(!staging_offset.has_value()) {
+                    // reserveStaging() flushes the ring, the bands already in it have to be queued before
+                    if(!regions.empty()) {
+                        queueStagedImageUpload(texture.image, std::move(regions), texture.mip_levels, is_first_part, false);
+                        regions.clear();
+                        is_first_part = false;
+                    }
+                    staging_offset = reserveStaging(band_size, STAGING_ALIGNMENT);
+                }
+                
+                const uint8_t* src = file_data + texture_level.offset + first_row * src_row_bytes;
+                uint8_t* dst = static_cast<uint8_t*>(getStagingPointer(staging_offset.value()));
+                if(decode) {
+                    auto decode_start = std::chrono::high_resolution_clock::now();
+                    decoder.decode(m_worker_pool, container.format, src, texture_level.width, height, dst);
+                    stats.decode_ms += elapsedMs(decode_start, std::chrono::high_resolution_clock::now());
+                }
+                else {
+                    memcpy(dst, src, band_size);
+                }
+                VkBufferImageCopy region = getImageUploadRegion(staging_offset.value(), level, texture_level.width, height);
+                region.imageOffset.y = static_cast<int32_t>(y);
+                regions.push_back(region);
+            }
+            stats.image_bytes += decode ? texture_level.width * texel_bytes * texture_level.height : texture_level.size;
+            stats.rgba8_bytes += static_cast<size_t>(texture_level.width) * texture_level.height * 4u;
+        }
+        if(decode) {
+            stats.decode_kernel = decoder.kernelName();
+        }
+        queueStagedImageUpload(texture.image, std::move(regions), texture.mip_levels, is_first_part, true);
+        submitUploads();
+        transitionUploadedImage(texture.image, texture.mip_levels);
+        
+        stats.file_name = path_to_file;
+        stats.file_format = container.format;
+        stats.image_format = texture.format;
+        stats.width = texture.width;
+        stats.height = texture.height;
+        stats.mip_levels = texture.mip_levels;
+        stats.load_ms = elapsedMs(load_start, std::chrono::high_resolution_clock::now());
+        std::cout << "texture " << path_to_file << ": " << getTextureFormatName(container.format) << " " << stats.width << "x" << stats.height << ", "
+                  << stats.mip_levels << " levels, " << stats.image_bytes / 1000000.0 << " MB (" << stats.rgba8_bytes / 1000000.0 << " MB as RGBA8)";
+        if(decode) {
+            std::cout << ", not supported by the device, decoded to " << getTextureFormatName(texture.format) << " by the " << stats.decode_kernel
+                      << " kernel in " << stats.decode_ms << " ms";
+        }
+        std::cout << ", loaded in " << stats.load_ms << " ms" << std::endl;
+    }
+    
+    // Makes a texture whose levels all came from the staging ring readable by the fragment shader.
+    void transitionUploadedImage(VkImage image, uint32_t mip_levels) {
+        VkCommandBuffer command_buffer = beginSingleTimeCommands(m_grapics_cmd_pool);
+        // takes the image over from the transfer queue first
+        recordPendingAcquires(command_buffer);
         
-#ifndef NDEBUG
-        const VkDebugMarkerObjectNameInfoEXT imageNameInfo = {
-            .sType = VK_STRUCTURE_TYPE_DEBUG_MARKER_OBJECT_NAME_INFO_EXT,
-            .pNext = NULL,
-            .objectType = VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_EXT,
-            .object = (uint64_t)image,
-            .pObjectName = path_to_file.c_str()
-        };
-
-        m_pfnDebugMarkerSetObjectNameEXT(m_device, &imageNameInfo);
-#endif
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.image = image;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0u;
+        barrier.subresourceRange.levelCount = mip_levels;
+        barrier.subresourceRange.baseArrayLayer = 0u;
+        barrier.subresourceRange.layerCount = 1u;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0u, 0u, nullptr, 0u, nullptr, 1u, &barrier);
         
-        return image;
+        endSingleTimeCommands(command_buffer, m_graphics_queue, m_grapics_cmd_pool, m_graphics_timeline, m_upload_wait_ticket, VK_PIPELINE_STAGE_TRANSFER_BIT);
     }
     
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
@@ -1340,27 +7108,242 @@ private:
         );
     }
     
-    void createDepthResources() {
+    // The frame as render graph passes: the scene, the upscale blit when the scene is rendered below the swapchain
+    // extent, then the readback copy when headless. The graph creates the multisampled color, the depth attachment and
+    // the scaled scene image. The render pass path only takes the attachments from it, the render pass and its subpass
+    // dependency still do the transitions there.
+    void buildRenderGraph() {
+        bool resolve = m_msaa_samples != VK_SAMPLE_COUNT_1_BIT;
         VkFormat depth_format = findDepthFormat();
+        m_render_graph.reset();
         
-        VkImageCreateInfo image_info{};
-        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        image_info.imageType = VK_IMAGE_TYPE_2D;
-        image_info.extent.width = static_cast<uint32_t>(m_swapchain_params.extent.width);
-        image_info.extent.height = static_cast<uint32_t>(m_swapchain_params.extent.height);
-        image_info.extent.depth = 1u;
-        image_info.mipLevels = 1u;
-        image_info.arrayLayers = 1u;
-        image_info.format = depth_format;
-        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        image_info.samples = m_msaa_samples;
-        image_info.flags = 0u;
-        createImage(image_info, m_depth_image, m_depth_memory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        m_depth_view = createImageView(m_depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, 1u);
-        transitionImageLayout(m_depth_image, depth_format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1u);
+        m_render_extent = m_swapchain_params.extent;
+        if(m_dynamic_resolution_enabled) {
+            float scale = m_resolution_controller.getScale();
+            m_render_extent.width = std::max(1u, static_cast<uint32_t>(std::lround(m_swapchain_params.extent.width * scale)));
+            m_render_extent.height = std::max(1u, static_cast<uint32_t>(std::lround(m_swapchain_params.extent.height * scale)));
+        }
+        bool scaled = m_render_extent.width != m_swapchain_params.extent.width || m_render_extent.height != m_swapchain_params.extent.height;
+        
+        std::optional<RenderGraphUsage> backbuffer_final = m_options.headless ? std::nullopt : std::optional<RenderGraphUsage>(RenderGraphUsage::Present);
+        // the acquire semaphore is waited at the color output stage
+        m_graph_backbuffer = m_render_graph.addImported("backbuffer", VK_IMAGE_ASPECT_COLOR_BIT, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, backbuffer_final);
+        
+        RenderGraphImageDesc depth_desc{};
+        depth_desc.format = depth_format;
+        depth_desc.extent = m_render_extent;
+        depth_desc.samples = m_msaa_samples;
+        depth_desc.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        depth_desc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencilComponent(depth_format) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0u);
+        m_graph_depth = m_render_graph.addTransient("depth", depth_desc);
+        
+        m_graph_scene = m_graph_backbuffer;
+        if(scaled) {
+            RenderGraphImageDesc scene_desc{};
+            scene_desc.format = m_swapchain_params.surface_format.format;
+            scene_desc.extent = m_render_extent;
+            scene_desc.samples = VK_SAMPLE_COUNT_1_BIT;
+            scene_desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            scene_desc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+            m_graph_scene = m_render_graph.addTransient("scene", scene_desc);
+        }
+        
+        std::vector<std::pair<RenderGraph::ResourceId, RenderGraphUsage>> scene_uses = {
+            {m_graph_scene, RenderGraphUsage::ColorAttachment},
+            {m_graph_depth, RenderGraphUsage::DepthAttachment}
+        };
+        m_graph_color = RenderGraph::INVALID_RESOURCE;
+        if(resolve || !m_dynamic_rendering_enabled) {
+            RenderGraphImageDesc color_desc{};
+            color_desc.format = m_swapchain_params.surface_format.format;
+            color_desc.extent = m_render_extent;
+            color_desc.samples = m_msaa_samples;
+            color_desc.usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+            color_desc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+            m_graph_color = m_render_graph.addTransient("color", color_desc);
+            scene_uses.push_back({m_graph_color, RenderGraphUsage::ColorAttachment});
+        }
+        m_render_graph.addPass("scene", std::move(scene_uses), [this](VkCommandBuffer command_buffer) {
+            m_gpu_profiler.beginZone(command_buffer, m_current_frame, "render_pass");
+            beginDynamicRendering(command_buffer, useRecordWorkers() ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0u);
+            recordSceneDraws(command_buffer, VK_NULL_HANDLE);
+            m_pfnCmdEndRendering(command_buffer);
+            m_gpu_profiler.endZone(command_buffer, m_current_frame);
+        });
+        if(scaled) {
+            m_render_graph.addPass("upscale", {{m_graph_scene, RenderGraphUsage::TransferSrc}, {m_graph_backbuffer, RenderGraphUsage::TransferDst}}, [this](VkCommandBuffer command_buffer) {
+                m_gpu_profiler.beginZone(command_buffer, m_current_frame, "upscale");
+                recordUpscale(command_buffer);
+                m_gpu_profiler.endZone(command_buffer, m_current_frame);
+            });
+        }
+        if(m_options.headless) {
+            m_render_graph.addPass("readback", {{m_graph_backbuffer, RenderGraphUsage::TransferSrc}}, [this](VkCommandBuffer command_buffer) {
+                m_gpu_profiler.beginZone(command_buffer, m_current_frame, "readback");
+                recordReadbackCopy(command_buffer, m_render_graph.getImage(m_graph_backbuffer));
+                m_gpu_profiler.endZone(command_buffer, m_current_frame);
+            });
+        }
+        
+        m_render_graph.compile([this](uint32_t type_bits) { return findMemoryType(type_bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT); });
+    }
+    
+    // Linear blit of the scaled scene over the whole backbuffer.
+    void recordUpscale(VkCommandBuffer command_buffer) {
+        VkImageBlit region{};
+        region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.srcSubresource.mipLevel = 0u;
+        region.srcSubresource.baseArrayLayer = 0u;
+        region.srcSubresource.layerCount = 1u;
+        region.srcOffsets[0] = {0, 0, 0};
+        region.srcOffsets[1] = {static_cast<int32_t>(m_render_extent.width), static_cast<int32_t>(m_render_extent.height), 1};
+        region.dstSubresource = region.srcSubresource;
+        region.dstOffsets[0] = {0, 0, 0};
+        region.dstOffsets[1] = {static_cast<int32_t>(m_swapchain_params.extent.width), static_cast<int32_t>(m_swapchain_params.extent.height), 1};
+        vkCmdBlitImage(
+            command_buffer,
+            m_render_graph.getImage(m_graph_scene), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            m_render_graph.getImage(m_graph_backbuffer), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1u, &region, VK_FILTER_LINEAR
+        );
+    }
+    
+    // Dynamic resolution blits the scene into the backbuffer, both formats need linear blits and the swapchain transfer writes.
+    bool isUpscaleSupported() {
+        if(!m_dynamic_rendering_enabled) {
+            std::cout << "dynamic resolution: needs dynamic rendering, the scene renders at the swapchain extent" << std::endl;
+            return false;
+        }
+        VkFormatProperties format_props{};
+        vkGetPhysicalDeviceFormatProperties(m_physical_device, m_swapchain_params.surface_format.format, &format_props);
+        VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        bool usage_supported = m_options.headless || (m_swapchain_support_details.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        if((format_props.optimalTilingFeatures & required) != required || !usage_supported) {
+            std::cout << "dynamic resolution: the swapchain format can not be blitted to, the scene renders at the swapchain extent" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // Sample counts usable for both color and depth up to max_samples, ascending.
+    std::vector<uint32_t> getUsableSampleLevels(VkPhysicalDevice physical_device, VkSampleCountFlagBits max_samples) {
+        VkPhysicalDeviceProperties physical_device_properties;
+        vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+        VkSampleCountFlags counts = physical_device_properties.limits.framebufferColorSampleCounts & physical_device_properties.limits.framebufferDepthSampleCounts;
+        std::vector<uint32_t> levels;
+        for(uint32_t samples = VK_SAMPLE_COUNT_1_BIT; samples <= static_cast<uint32_t>(max_samples); samples <<= 1u) {
+            if(counts & samples) {
+                levels.push_back(samples);
+            }
+        }
+        return levels;
+    }
+    
+    // Applies what the resolution controller picked. Frames in flight keep their attachments until they finish,
+    // the pipelines of every sample level exist already.
+    void applyRenderSettings() {
+        m_render_settings_changed = false;
+        RetiredSwapchain retired{};
+        retired.frame_number = m_frame_number;
+        retired.transients = m_render_graph.takeTransients();
+        m_retired_swapchains.push_back(std::move(retired));
+        
+        m_msaa_samples = static_cast<VkSampleCountFlagBits>(m_resolution_controller.getSamples());
+        m_graphics_pipeline = m_msaa_pipelines.at(m_msaa_samples);
+        buildRenderGraph();
+        std::cout << "dynamic resolution: " << m_render_extent.width << "x" << m_render_extent.height << " with " << static_cast<uint32_t>(m_msaa_samples)
+                  << "x MSAA at " << m_resolution_controller.getAverageMs() << " ms" << std::endl;
+    }
+    
+    void startShaderWatcher() {
+        if(!ShaderCompiler::isAvailable()) {
+            std::cout << "shader hot reload: built without shaderc, nothing to compile the sources with" << std::endl;
+            return;
+        }
+        std::vector<std::string> file_names;
+        for(const ShaderFile& shader : m_shader_files) {
+            file_names.push_back(shader.glsl_path);
+        }
+        m_shader_watcher.init(std::move(file_names), [this](size_t file_index) { return rebuildShader(file_index); });
+        std::cout << "shader hot reload: watching " << m_shader_files.size() << " shaders" << std::endl;
+    }
+    
+    // Runs on the watcher thread. What it reads from the scene pipeline description only changes under m_shader_watcher.pause(),
+    // the running modules stay with the main thread and the other scene stage is made again from its latest code.
+    ShaderReload rebuildShader(size_t file_index) {
+        auto build_start = std::chrono::high_resolution_clock::now();
+        ShaderReload reload;
+        reload.file_index = file_index;
+        reload.scene_generation = m_scene_pipeline_generation;
+        reload.binary = m_shader_compiler.compile(m_shader_files[file_index].glsl_path);
+        if(reload.binary.code.empty()) {
+            reload.error = reload.binary.error;
+            return reload;
+        }
+        
+        ShaderTarget target = m_shader_files[file_index].target;
+        VkShaderModule other_module = VK_NULL_HANDLE;
+        try {
+            reload.module = CreateShaderModule(reload.binary.code);
+            if(target == ShaderTarget::Cull) {
+                reload.pipelines.push_back(createCullPipeline(reload.module));
+            }
+            else {
+                ShaderTarget other_target = target == ShaderTarget::SceneVertex ? ShaderTarget::SceneFragment : ShaderTarget::SceneVertex;
+                auto other = std::find_if(m_shader_files.begin(), m_shader_files.end(), [other_target](const ShaderFile& shader) { return shader.target == other_target; });
+                other_module = CreateShaderModule(m_shader_code[static_cast<size_t>(other - m_shader_files.begin())]);
+                bool is_vertex = target == ShaderTarget::SceneVertex;
+                reload.pipelines = createScenePipelines(m_scene_pipeline_desc, is_vertex ? reload.module : other_module, is_vertex ? other_module : reload.module);
+            }
+            m_shader_code[file_index] = reload.binary.code;
+        }
+        catch(const std::exception& e) {
+            reload.error = e.what();
+            vkDestroyShaderModule(m_device, reload.module, nullptr);
+            reload.module = VK_NULL_HANDLE;
+        }
+        vkDestroyShaderModule(m_device, other_module, nullptr);
+        reload.build_ms = elapsedMs(build_start, std::chrono::high_resolution_clock::now());
+        return reload;
+    }
+    
+    // Swaps in what the watcher rebuilt. The pipelines it replaces are retired until the frames in flight are done with them.
+    void applyShaderReloads() {
+        for(ShaderReload& reload : m_shader_watcher.takeFinished()) {
+            const ShaderFile& shader = m_shader_files[reload.file_index];
+            if(reload.module == VK_NULL_HANDLE) {
+                std::cout << "shader hot reload: " << shader.glsl_path << " failed, keeping the running pipelines\n" << reload.error << std::endl;
+                continue;
+            }
+            
+            // a pipeline does not need the module it was created from
+            VkShaderModule& shader_module = shader.target == ShaderTarget::Cull ? m_cull_shader_module : (shader.target == ShaderTarget::SceneVertex ? m_vert_shader_modeule : m_frag_shader_modeule);
+            vkDestroyShaderModule(m_device, shader_module, nullptr);
+            shader_module = reload.module;
+            
+            RetiredSwapchain retired{};
+            retired.frame_number = m_frame_number;
+            if(shader.target == ShaderTarget::Cull) {
+                recordPipelineCreation("culling pipeline", reload.pipelines.front());
+                retired.pipelines.push_back(m_cull_pipeline);
+                m_cull_pipeline = reload.pipelines.front().pipeline;
+            }
+            else if(reload.scene_generation != m_scene_pipeline_generation) {
+                // built for a render pass or color format that has been replaced since, nothing has used them
+                for(const PipelineCreation& creation : reload.pipelines) {
+                    vkDestroyPipeline(m_device, creation.pipeline, nullptr);
+                }
+                m_shader_watcher.requeue(reload.file_index);
+                continue;
+            }
+            else {
+                retired.pipelines = takeGraphicsPipelines();
+                installScenePipelines(reload.pipelines);
+            }
+            m_retired_swapchains.push_back(std::move(retired));
+            ++m_shader_reloads;
+            std::cout << "shader hot reload: " << shader.glsl_path << " (" << reload.binary.origin << ") swapped in, built in " << reload.build_ms << " ms" << std::endl;
+        }
     }
     
     VkSampleCountFlagBits getMaxUsableSampleCount(VkPhysicalDevice physical_device) {
@@ -1391,12 +7374,17 @@ private:
     void initVulkan() {
         m_vk_instance = createInstance();
         m_debug_messenger = setupDebugMessanger();
-        m_surface = createSurface();
+        if(!m_options.headless) {
+            m_surface = createSurface();
+        }
         m_physical_device = pickPhysicalDevice();
         m_msaa_samples = getMaxUsableSampleCount(m_physical_device);
         
-        QueueFamilyIndices queue_family_indices = findQueueFamilies(m_physical_device, m_surface);
+        m_queue_family_indices = findQueueFamilies(m_physical_device, m_surface);
+        const QueueFamilyIndices& queue_family_indices = m_queue_family_indices;
         m_device = createLogicalDevice(m_physical_device, queue_family_indices);
+        m_allocator.init(m_device, m_physical_device);
+        m_render_graph.init(m_device, m_allocator, m_pfnCmdPipelineBarrier2);
         
 #ifndef NDEBUG
         m_pfnDebugMarkerSetObjectNameEXT = (PFN_vkDebugMarkerSetObjectNameEXT)vkGetDeviceProcAddr(m_device, "vkDebugMarkerSetObjectNameEXT");
@@ -1409,12 +7397,14 @@ private:
             &m_graphics_queue
         );
         
-        vkGetDeviceQueue(
-            m_device,
-            queue_family_indices.present_family.value(),
-            0,
-            &m_present_queue
-        );
+        if(queue_family_indices.present_family.has_value()) {
+            vkGetDeviceQueue(
+                m_device,
+                queue_family_indices.present_family.value(),
+                0,
+                &m_present_queue
+            );
+        }
         
         vkGetDeviceQueue(
             m_device,
@@ -1423,35 +7413,86 @@ private:
             &m_transfer_queue
         );
         
-        createSwapchain();
+        if(m_options.headless) {
+            createOffscreenTargets();
+        }
+        else {
+            createSwapchain();
+        }
+        if(m_options.target_frame_ms > 0.0) {
+            m_dynamic_resolution_enabled = isUpscaleSupported();
+            if(m_dynamic_resolution_enabled) {
+                m_resolution_controller.init(m_options.target_frame_ms, m_options.min_render_scale, getUsableSampleLevels(m_physical_device, m_msaa_samples));
+            }
+        }
+        m_pipeline_cache.init(m_device, m_physical_device, m_options.pipeline_cache_path);
+        selectVertexFormat();
         loadShaders();
-        createRenderPass();
-        m_desc_set_layout = createDescSetLayout();
+        if(!m_dynamic_rendering_enabled) {
+            createRenderPass();
+        }
+        createDescSetLayouts();
         createPipeline(m_vert_shader_modeule, m_frag_shader_modeule, m_render_pass);
         createCommandPools();
-        createColorResources();
-        createDepthResources();
-        m_swapchain_framebuffers = createFramebuffers(m_swapchain_views, m_swapchain_params.extent, m_render_pass);
+        createSubmissionTimelines();
+        m_gpu_profiler.init(m_device, m_physical_device, queue_family_indices.graphics_family.value(), MAX_FRAMES_IN_FLIGHT);
+        createStagingRing();
+        m_worker_pool.init(m_options.worker_threads);
+        buildRenderGraph();
+        if(!m_dynamic_rendering_enabled) {
+            m_swapchain_framebuffers = createFramebuffers(m_swapchain_views, m_swapchain_params.extent, m_render_pass);
+        }
         
-        m_texture_image = createImage("textures/texture.jpg");
-        m_texture_view = createImageView(m_texture_image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, m_mip_levels);
+        loadTextures(m_options.texture_paths.empty() ? std::vector<std::string>{"textures/texture.jpg"} : m_options.texture_paths);
         createTextureSampler();
-        createAndTransferVertexBuffer(g_vertices);
-        createAndTransferIndexBuffer(g_indices);
+        if(m_options.mesh_path.empty()) {
+            m_mesh_box = computeBoundingBox(g_vertices);
+            createAndTransferVertexBuffer(g_vertices);
+            createAndTransferIndexBuffer(g_indices);
+        }
+        else {
+            loadMesh(m_options.mesh_path);
+        }
+        createAndTransferInstanceBuffer(m_options.instance_count);
+        flushUploads();
+        
+        createUniformArena();
+        createTextureDescriptorSet();
+        createDescWriters();
+        if(m_options.gpu_cull) {
+            createCullingResources();
+        }
+        // the per-frame pools are sized for the layouts the frames actually allocate, culling included
+        createDescAllocator();
+        // the CPU stage stands in when the compute pass is unavailable
+        if((m_options.cpu_cull || m_options.gpu_cull) && !m_gpu_cull_enabled) {
+            createCpuCulling();
+        }
         
-        createUniformBuffers();
-        m_desc_pool = createDescPool();
-        createDescSets();
+        if(m_options.headless) {
+            createReadbackBuffers();
+        }
         
         createCommandBuffers();
+        buildDrawList();
+        if(m_options.record_threads) {
+            m_record_workers.init(m_device, queue_family_indices.graphics_family.value(), m_options.record_threads, MAX_FRAMES_IN_FLIGHT);
+        }
         createSyncObjects();
+        if(m_options.watch_shaders) {
+            startShaderWatcher();
+        }
+        
+#ifndef NDEBUG
+        m_allocator.printStats(std::cout);
+#endif
     }
     
-    VkShaderModule CreateShaderModule(const std::vector<char>& buffer) {
+    VkShaderModule CreateShaderModule(const std::vector<uint32_t>& code) {
         VkShaderModuleCreateInfo shader_module_info{};
         shader_module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        shader_module_info.codeSize = buffer.size();
-        shader_module_info.pCode = reinterpret_cast<const u_int32_t*>(buffer.data());
+        shader_module_info.codeSize = code.size() * sizeof(uint32_t);
+        shader_module_info.pCode = code.data();
         VkShaderModule shader_module = VK_NULL_HANDLE;
         VkResult result = vkCreateShaderModule(m_device, &shader_module_info, nullptr, &shader_module);
         if(result != VK_SUCCESS) {
@@ -1497,7 +7538,7 @@ private:
         color_attachment_resolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         color_attachment_resolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         color_attachment_resolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        color_attachment_resolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        color_attachment_resolve.finalLayout = m_options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
         
         VkAttachmentReference color_attachment_resolve_ref{};
         color_attachment_resolve_ref.attachment = 2;
@@ -1531,8 +7572,28 @@ private:
     }
     
     void loadShaders() {
-        m_frag_shader_modeule = CreateShaderModule("shaders/frag.spv");    
-        m_vert_shader_modeule = CreateShaderModule("shaders/vert.spv");
+        m_shader_compiler.init(m_options.shader_cache_dir);
+        // shader_single.frag samples the first texture for every material
+        if(m_bindless_enabled) {
+            m_frag_shader_modeule = loadShader("shaders/shader.frag", "shaders/frag.spv", ShaderTarget::SceneFragment);
+        }
+        else {
+            m_frag_shader_modeule = loadShader("shaders/shader_single.frag", "shaders/frag_single.spv", ShaderTarget::SceneFragment);
+        }
+        m_vert_shader_modeule = loadShader("shaders/shader.vert", "shaders/vert.spv", ShaderTarget::SceneVertex);
+    }
+    
+    // spv_path is what shaders/compile.sh makes of glsl_path, loaded when the source cannot be compiled here.
+    VkShaderModule loadShader(const std::string& glsl_path, const std::string& spv_path, ShaderTarget target) {
+        ShaderBinary binary = m_shader_compiler.load(glsl_path, spv_path);
+        if(!binary.error.empty()) {
+            std::cout << "failed to compile " << glsl_path << ", loading " << spv_path << " instead:\n" << binary.error << std::endl;
+        }
+        std::cout << "shader " << glsl_path << ": " << binary.origin << " in " << binary.ms << " ms" << std::endl;
+        VkShaderModule shader_module = CreateShaderModule(binary.code);
+        m_shader_files.push_back({glsl_path, target, binary.origin, binary.ms});
+        m_shader_code.push_back(std::move(binary.code));
+        return shader_module;
     }
     
     void createRenderPass() {
@@ -1546,18 +7607,55 @@ private:
         m_render_pass = createRenderPass(pass_dependency);
     }
     
-    void createPipeline(VkShaderModule vert_shader_modeule, VkShaderModule frag_shader_modeule, VkRenderPass render_pass) {
+    void createPipeline(VkShaderModule vert_shader_modeule, VkShaderModule frag_shader_modeule, VkRenderPass render_pass) {
+        createPipelineLayout();
+        
+        m_scene_pipeline_desc.layout = m_pipeline_layout;
+        m_scene_pipeline_desc.render_pass = m_dynamic_rendering_enabled ? VK_NULL_HANDLE : render_pass;
+        m_scene_pipeline_desc.color_format = m_swapchain_params.surface_format.format;
+        m_scene_pipeline_desc.depth_format = findDepthFormat();
+        m_scene_pipeline_desc.vertex_format = m_vertex_format;
+        // dynamic resolution switches between the sample levels without creating pipelines in the frame loop
+        m_scene_pipeline_desc.sample_levels = {m_msaa_samples};
+        if(m_dynamic_resolution_enabled) {
+            m_scene_pipeline_desc.sample_levels.clear();
+            for(uint32_t samples : m_resolution_controller.getSampleLevels()) {
+                m_scene_pipeline_desc.sample_levels.push_back(static_cast<VkSampleCountFlagBits>(samples));
+            }
+        }
+        ++m_scene_pipeline_generation;
+        
+        installScenePipelines(createScenePipelines(m_scene_pipeline_desc, vert_shader_modeule, frag_shader_modeule));
+    }
+    
+    void createPipelineLayout() {
+        VkPipelineLayoutCreateInfo pipeline_layout_info{};
+        pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        std::array<VkDescriptorSetLayout, 2> set_layouts = {m_texture_set_layout, m_uniform_set_layout};
+        pipeline_layout_info.setLayoutCount = static_cast<uint32_t>(set_layouts.size());
+        pipeline_layout_info.pSetLayouts = set_layouts.data();
+        pipeline_layout_info.pushConstantRangeCount = 0u;
+        pipeline_layout_info.pPushConstantRanges = nullptr;
+        
+        VkResult result = vkCreatePipelineLayout(m_device, &pipeline_layout_info, nullptr, &m_pipeline_layout);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+    }
+    
+    // Only reads desc and members that are fixed after initVulkan(), the shader watcher calls it from its thread.
+    std::vector<PipelineCreation> createScenePipelines(const ScenePipelineDesc& desc, VkShaderModule vert_shader_modeule, VkShaderModule frag_shader_modeule) {
         VkPipelineShaderStageCreateInfo frag_shader_info{};
         frag_shader_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         frag_shader_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        frag_shader_info.module = m_frag_shader_modeule;
+        frag_shader_info.module = frag_shader_modeule;
         frag_shader_info.pName = "main";
         frag_shader_info.pSpecializationInfo = nullptr; 
     
         VkPipelineShaderStageCreateInfo vertex_shader_info{};
         vertex_shader_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         vertex_shader_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vertex_shader_info.module = m_vert_shader_modeule;
+        vertex_shader_info.module = vert_shader_modeule;
         vertex_shader_info.pName = "main";
         vertex_shader_info.pSpecializationInfo = nullptr;
         VkPipelineShaderStageCreateInfo shader_stages[] = {frag_shader_info, vertex_shader_info};
@@ -1572,8 +7670,9 @@ private:
         dynamic_state_info.dynamicStateCount = static_cast<uint32_t>(dynamic_states.size());
         dynamic_state_info.pDynamicStates = dynamic_states.data();
         
-        auto binding_desc = Vertex::getBindingDescription();
-        auto attribute_desc = Vertex::getAttributeDescritpions();
+        bool packed = desc.vertex_format == VertexFormat::Packed;
+        auto binding_desc = packed ? PackedVertex::getBindingDescriptions() : Vertex::getBindingDescriptions();
+        auto attribute_desc = packed ? PackedVertex::getAttributeDescritpions() : Vertex::getAttributeDescritpions();
         
         VkPipelineDepthStencilStateCreateInfo depth_stencil_info{};
         depth_stencil_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
@@ -1589,8 +7688,8 @@ private:
         
         VkPipelineVertexInputStateCreateInfo vertex_input_info{};
         vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertex_input_info.vertexBindingDescriptionCount = 1u;
-        vertex_input_info.pVertexBindingDescriptions = &binding_desc;
+        vertex_input_info.vertexBindingDescriptionCount = static_cast<uint32_t>(binding_desc.size());
+        vertex_input_info.pVertexBindingDescriptions = binding_desc.data();
         vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(attribute_desc.size());
         vertex_input_info.pVertexAttributeDescriptions = attribute_desc.data();
         
@@ -1599,24 +7698,13 @@ private:
         input_assembly_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         input_assembly_info.primitiveRestartEnable = VK_FALSE;
         
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = m_swapchain_params.extent;
-        
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float)m_swapchain_params.extent.width;
-        viewport.height = (float)m_swapchain_params.extent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        
+        // both are dynamic state and set when recording, the extent may change while the pipelines live
         VkPipelineViewportStateCreateInfo viewport_state_info{};
         viewport_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewport_state_info.viewportCount = 1u;
-        viewport_state_info.pViewports = &viewport;
+        viewport_state_info.pViewports = nullptr;
         viewport_state_info.scissorCount = 1u;
-        viewport_state_info.pScissors = &scissor;
+        viewport_state_info.pScissors = nullptr;
         
         VkPipelineRasterizationStateCreateInfo rasterizer_info{};
         rasterizer_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -1635,7 +7723,7 @@ private:
         VkPipelineMultisampleStateCreateInfo multisample_info{};
         multisample_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
         multisample_info.sampleShadingEnable = VK_FALSE;
-        multisample_info.rasterizationSamples = m_msaa_samples;
+        multisample_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT; // set per sample level below
         //multisample_info.minSampleShading = 1.0f;
         //multisample_info.pSampleMask = nullptr;
         //multisample_info.alphaToCoverageEnable = VK_FALSE;
@@ -1662,18 +7750,6 @@ private:
         color_blend_info.blendConstants[2] = 0.0f;
         color_blend_info.blendConstants[3] = 0.0f;
          
-        VkPipelineLayoutCreateInfo pipeline_layout_info{};
-        pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipeline_layout_info.setLayoutCount = 1u;
-        pipeline_layout_info.pSetLayouts = &m_desc_set_layout;
-        pipeline_layout_info.pushConstantRangeCount = 0u;
-        pipeline_layout_info.pPushConstantRanges = nullptr;
-        
-        VkResult result = vkCreatePipelineLayout(m_device, &pipeline_layout_info, nullptr, &m_pipeline_layout);
-        if (result != VK_SUCCESS) {
-            throw std::runtime_error("failed to create pipeline layout!");
-        }
-        
         VkGraphicsPipelineCreateInfo pipeline_info{};
         pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
         pipeline_info.stageCount = 2;
@@ -1686,16 +7762,100 @@ private:
         pipeline_info.pDepthStencilState = &depth_stencil_info;
         pipeline_info.pColorBlendState = &color_blend_info;
         pipeline_info.pDynamicState = &dynamic_state_info;
-        pipeline_info.layout = m_pipeline_layout;
-        pipeline_info.renderPass = render_pass;
+        pipeline_info.layout = desc.layout;
+        pipeline_info.renderPass = desc.render_pass;
         pipeline_info.subpass = 0u;
         pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
         pipeline_info.basePipelineIndex = -1;
         
-        result = vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &m_graphics_pipeline);
+        VkPipelineCreationFeedback pipeline_feedback{};
+        std::array<VkPipelineCreationFeedback, 2> stage_feedbacks{};
+        VkPipelineCreationFeedbackCreateInfo feedback_info{};
+        feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+        feedback_info.pPipelineCreationFeedback = &pipeline_feedback;
+        feedback_info.pipelineStageCreationFeedbackCount = pipeline_info.stageCount;
+        feedback_info.pPipelineStageCreationFeedbacks = stage_feedbacks.data();
+        if(m_creation_feedback_supported) {
+            pipeline_info.pNext = &feedback_info;
+        }
         
-        if (result != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
+        // without a render pass the attachment formats are given to the pipeline directly
+        VkPipelineRenderingCreateInfo rendering_info{};
+        rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+        rendering_info.colorAttachmentCount = 1u;
+        rendering_info.pColorAttachmentFormats = &desc.color_format;
+        rendering_info.depthAttachmentFormat = desc.depth_format;
+        rendering_info.stencilAttachmentFormat = hasStencilComponent(desc.depth_format) ? desc.depth_format : VK_FORMAT_UNDEFINED;
+        if(desc.render_pass == VK_NULL_HANDLE) {
+            rendering_info.pNext = pipeline_info.pNext;
+            pipeline_info.pNext = &rendering_info;
+            pipeline_info.renderPass = VK_NULL_HANDLE;
+        }
+        
+        std::vector<PipelineCreation> creations;
+        for(VkSampleCountFlagBits samples : desc.sample_levels) {
+            multisample_info.rasterizationSamples = samples;
+            pipeline_feedback = VkPipelineCreationFeedback{};
+            stage_feedbacks = {};
+            PipelineCreation creation;
+            auto create_start = std::chrono::high_resolution_clock::now();
+            VkResult result = vkCreateGraphicsPipelines(m_device, m_pipeline_cache.get(), 1, &pipeline_info, nullptr, &creation.pipeline);
+            creation.ms = elapsedMs(create_start, std::chrono::high_resolution_clock::now());
+            
+            if (result != VK_SUCCESS) {
+                for(const PipelineCreation& created : creations) {
+                    vkDestroyPipeline(m_device, created.pipeline, nullptr);
+                }
+                throw std::runtime_error("failed to create graphics pipeline!");
+            }
+            
+            if(m_creation_feedback_supported && (pipeline_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT)) {
+                creation.cache_hit = (pipeline_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) != 0u;
+            }
+            creations.push_back(creation);
+        }
+        return creations;
+    }
+    
+    // Takes over pipelines createScenePipelines() made from m_scene_pipeline_desc, the ones they replace are taken out first.
+    void installScenePipelines(const std::vector<PipelineCreation>& creations) {
+        for(size_t i = 0u; i < creations.size(); ++i) {
+            VkSampleCountFlagBits samples = m_scene_pipeline_desc.sample_levels[i];
+            recordPipelineCreation("graphics pipeline (" + std::to_string(static_cast<uint32_t>(samples)) + "x MSAA)", creations[i]);
+            if(m_dynamic_resolution_enabled) {
+                m_msaa_pipelines[samples] = creations[i].pipeline;
+            }
+            if(samples == m_msaa_samples) {
+                m_graphics_pipeline = creations[i].pipeline;
+            }
+        }
+    }
+    
+    void recordPipelineCreation(const std::string& name, const PipelineCreation& creation) {
+        m_pipeline_cache.recordCreation(creation.ms, creation.cache_hit);
+        std::cout << name << " created in " << creation.ms << " ms";
+        if(creation.cache_hit.has_value()) {
+            std::cout << (creation.cache_hit.value() ? " (cache hit)" : " (cache miss)");
+        }
+        std::cout << std::endl;
+    }
+    
+    std::vector<VkPipeline> takeGraphicsPipelines() {
+        std::vector<VkPipeline> pipelines;
+        if(m_msaa_pipelines.empty() && m_graphics_pipeline != VK_NULL_HANDLE) {
+            pipelines.push_back(m_graphics_pipeline);
+        }
+        for(const auto& [samples, pipeline] : m_msaa_pipelines) {
+            pipelines.push_back(pipeline);
+        }
+        m_msaa_pipelines.clear();
+        m_graphics_pipeline = VK_NULL_HANDLE;
+        return pipelines;
+    }
+    
+    void destroyGraphicsPipelines() {
+        for(VkPipeline pipeline : takeGraphicsPipelines()) {
+            vkDestroyPipeline(m_device, pipeline, nullptr);
         }
     }
     
@@ -1706,18 +7866,54 @@ private:
         m_swapchain_params.present_mode = chooseSwapPresentMode(m_swapchain_support_details.present_modes);
         m_swapchain_params.extent = chooseSwapExtent(m_swapchain_support_details.capabilities);
         
-        m_swapchain = createSwapchain(m_physical_device, m_device, m_swapchain_params);
+        m_swapchain = createSwapchain(m_physical_device, m_device, m_swapchain_params, m_swapchain);
         m_swapchain_images = getSwapchainImages(m_device, m_swapchain);
         
         m_swapchain_views = getImageViews(m_device, m_swapchain_images, m_swapchain_params.surface_format);
     }
     
-    VkShaderModule CreateShaderModule(const std::string& path) {
-        auto shader_buff = readFile(path);
-        VkShaderModule shader_modeule = CreateShaderModule(shader_buff);
-        return shader_modeule;
+    void createOffscreenTargets() {
+        m_swapchain_params.surface_format.format = findSupportedFormat(
+            {
+                VK_FORMAT_R8G8B8A8_SRGB,
+                VK_FORMAT_B8G8R8A8_SRGB
+            },
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT
+        );
+        m_swapchain_params.surface_format.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+        m_swapchain_params.present_mode = VK_PRESENT_MODE_FIFO_KHR;
+        m_swapchain_params.extent = {m_options.width, m_options.height};
+        
+        // one target per frame in flight, image_index always equals m_current_frame
+        m_swapchain_images.resize(MAX_FRAMES_IN_FLIGHT);
+        m_offscreen_memory.resize(MAX_FRAMES_IN_FLIGHT);
+        for(size_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+            VkImageCreateInfo image_info{};
+            image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            image_info.imageType = VK_IMAGE_TYPE_2D;
+            image_info.extent.width = m_swapchain_params.extent.width;
+            image_info.extent.height = m_swapchain_params.extent.height;
+            image_info.extent.depth = 1u;
+            image_info.mipLevels = 1u;
+            image_info.arrayLayers = 1u;
+            image_info.format = m_swapchain_params.surface_format.format;
+            image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+            image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            if(m_options.target_frame_ms > 0.0) {
+                image_info.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            }
+            image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+            image_info.flags = 0u;
+            createImage(image_info, m_swapchain_images[i], m_offscreen_memory[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        }
+        
+        m_swapchain_views = getImageViews(m_device, m_swapchain_images, m_swapchain_params.surface_format);
     }
     
+    
     uint64_t getDeviceMaxMemoryLimit(VkPhysicalDevice device) {
         uint64_t max_memory_limit = 0;
         VkPhysicalDeviceMemoryProperties phys_device_mem_prop;
@@ -1749,7 +7945,7 @@ private:
         if(!device_features.geometryShader) {
             score += 1000;
         }
-        if(isDeviceSuitable(device, m_surface)){
+        if(!isDeviceSuitable(device, m_surface)){
             return 0;
         }
         
@@ -1758,31 +7954,51 @@ private:
     
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface) {
         QueueFamilyIndices indices;
+        indices.present_required = surface != VK_NULL_HANDLE;
         
         uint32_t queue_family_count = 0u;
         vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, nullptr);
         std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
         vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, queue_families.data());
         
-        for (int i = 0; const auto& queue_family : queue_families) {
-            if(queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        // uploads prefer a transfer-only family (usually backed by DMA engines), then any family without graphics
+        std::optional<uint32_t> transfer_only_family;
+        std::optional<uint32_t> non_graphics_transfer_family;
+        for (uint32_t i = 0u; const auto& queue_family : queue_families) {
+            bool is_graphics = queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT;
+            bool is_compute = queue_family.queueFlags & VK_QUEUE_COMPUTE_BIT;
+            bool is_transfer = queue_family.queueFlags & VK_QUEUE_TRANSFER_BIT;
+            if(is_graphics && !indices.graphics_family.has_value()) {
                 indices.graphics_family = i;
             }
-            if(queue_family.queueFlags & VK_QUEUE_TRANSFER_BIT) {
-                indices.transfer_family = i;
+            if(is_transfer && !is_graphics && !is_compute && !transfer_only_family.has_value()) {
+                transfer_only_family = i;
             }
-            VkBool32 present_support = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
-            if(present_support) {
-                indices.present_family = i;
+            if(is_transfer && !is_graphics && !non_graphics_transfer_family.has_value()) {
+                non_graphics_transfer_family = i;
             }
-            
-            if (indices.isComplete()) {
-                break;
+            if(indices.present_required) {
+                VkBool32 present_support = false;
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
+                // presenting from the graphics family avoids sharing the swapchain images
+                if(present_support && (!indices.present_family.has_value() || indices.graphics_family == i)) {
+                    indices.present_family = i;
+                }
             }
             ++i;
         }
         
+        if(transfer_only_family.has_value()) {
+            indices.transfer_family = transfer_only_family;
+        }
+        else if(non_graphics_transfer_family.has_value()) {
+            indices.transfer_family = non_graphics_transfer_family;
+        }
+        else {
+            // graphics queues always support transfer operations
+            indices.transfer_family = indices.graphics_family;
+        }
+        
         return indices;
     }
     
@@ -1837,7 +8053,7 @@ private:
         }
     }
     
-    VkSwapchainKHR createSwapchain(VkPhysicalDevice physical_device, VkDevice logical_device, SwapchainParams swapchain_params) {
+    VkSwapchainKHR createSwapchain(VkPhysicalDevice physical_device, VkDevice logical_device, SwapchainParams swapchain_params, VkSwapchainKHR old_swapchain) {
         uint32_t image_count = m_swapchain_support_details.capabilities.minImageCount + 1u;
         if(   m_swapchain_support_details.capabilities.maxImageCount > 0
            && image_count > m_swapchain_support_details.capabilities.maxImageCount
@@ -1854,9 +8070,13 @@ private:
         swapchain_create_info.imageExtent = m_swapchain_params.extent;
         swapchain_create_info.imageArrayLayers = 1u;
         swapchain_create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        // the upscale blit of dynamic resolution writes the swapchain image
+        if(m_options.target_frame_ms > 0.0 && (m_swapchain_support_details.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+            swapchain_create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
         
         QueueFamilyIndices queue_family_indices = findQueueFamilies(physical_device, m_surface);
-        std::vector<uint32_t> family_indices = queue_family_indices.getIndices();
+        std::array<uint32_t, 2> family_indices = {queue_family_indices.graphics_family.value(), queue_family_indices.present_family.value()};
         if(queue_family_indices.graphics_family != queue_family_indices.present_family) {
             swapchain_create_info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
             swapchain_create_info.queueFamilyIndexCount = 2u;
@@ -1872,7 +8092,7 @@ private:
         swapchain_create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         swapchain_create_info.presentMode = m_swapchain_params.present_mode;
         swapchain_create_info.clipped = VK_TRUE;
-        swapchain_create_info.oldSwapchain = VK_NULL_HANDLE;
+        swapchain_create_info.oldSwapchain = old_swapchain; // lets the presentation engine hand its resources over
         
         VkSwapchainKHR swap_chain = VK_NULL_HANDLE;
         VkResult result = vkCreateSwapchainKHR(logical_device, &swapchain_create_info, nullptr, &swap_chain);
@@ -1896,8 +8116,8 @@ private:
         bool all_queue_families_supported = queue_family_indices.isComplete(); 
         bool all_device_ext_supported = checkNamesSupported(extension_supported, req_ext);
         
-        bool swap_chain_adequate = false;
-        if(all_device_ext_supported) {
+        bool swap_chain_adequate = surface == VK_NULL_HANDLE;
+        if(all_device_ext_supported && surface != VK_NULL_HANDLE) {
             SwapchainSupportDetails swap_chain_details = querySwapChainSupport(device);
             swap_chain_adequate = !swap_chain_details.formats.empty() && !swap_chain_details.present_modes.empty();
         }
@@ -1988,6 +8208,23 @@ private:
         return details;
     }
     
+    // Size of the bindless texture array within the update-after-bind limits of the device.
+    uint32_t getBindlessCapacity(VkPhysicalDevice physical_device) {
+        VkPhysicalDeviceDescriptorIndexingProperties indexing_props{};
+        indexing_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+        VkPhysicalDeviceProperties2 props2{};
+        props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        props2.pNext = &indexing_props;
+        vkGetPhysicalDeviceProperties2(physical_device, &props2);
+        return std::min({
+            BINDLESS_TEXTURE_CAPACITY,
+            indexing_props.maxPerStageDescriptorUpdateAfterBindSampledImages,
+            indexing_props.maxPerStageDescriptorUpdateAfterBindSamplers,
+            indexing_props.maxDescriptorSetUpdateAfterBindSampledImages,
+            indexing_props.maxDescriptorSetUpdateAfterBindSamplers
+        });
+    }
+    
     VkDevice createLogicalDevice(VkPhysicalDevice physical_device, QueueFamilyIndices queue_family_indices) {
         std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
         const auto& family_indices = queue_family_indices.getFamilies();
@@ -2012,6 +8249,169 @@ private:
         
         std::vector<const char*> device_ext = getRequiredDeviceExtensions();
         
+        // 1.2 features are queried and enabled through VkPhysicalDeviceVulkan12Features, older devices use the extensions.
+        // Without timeline semaphores uploads wait for the queue to idle, without draw indirect count there is no GPU culling,
+        // without descriptor indexing every material samples the first texture.
+        VkPhysicalDeviceProperties device_props{};
+        vkGetPhysicalDeviceProperties(physical_device, &device_props);
+        uint32_t api_version = std::min(getVkApiVersion(), device_props.apiVersion);
+        bool is_vulkan13 = api_version >= VK_API_VERSION_1_3;
+        bool is_vulkan12 = api_version >= VK_API_VERSION_1_2;
+        bool has_features2 = api_version >= VK_API_VERSION_1_1;
+        bool timeline_is_ext = !is_vulkan12 && has_features2 && m_available_device_ext.contains(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+        bool indexing_is_ext = !is_vulkan12 && has_features2 && m_options.bindless && m_available_device_ext.contains(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)
+                            && m_available_device_ext.contains(VK_KHR_MAINTENANCE_3_EXTENSION_NAME);
+        // before 1.2 dynamic rendering also needs the extensions it depends on
+        bool rendering_is_ext = !is_vulkan13 && has_features2 && m_options.dynamic_rendering && m_available_device_ext.contains(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)
+                             && (is_vulkan12 || (m_available_device_ext.contains(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME) && m_available_device_ext.contains(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME)));
+        // the render graph records its barriers with synchronization2 when there is one, it only runs with dynamic rendering
+        bool sync2_is_ext = rendering_is_ext && m_available_device_ext.contains(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+        
+        VkPhysicalDeviceVulkan12Features supported_vulkan12{};
+        supported_vulkan12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceTimelineSemaphoreFeatures supported_timeline{};
+        supported_timeline.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        VkPhysicalDeviceDescriptorIndexingFeatures supported_indexing{};
+        supported_indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+        VkPhysicalDeviceVulkan13Features supported_vulkan13{};
+        supported_vulkan13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+        VkPhysicalDeviceDynamicRenderingFeatures supported_rendering{};
+        supported_rendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+        VkPhysicalDeviceSynchronization2Features supported_sync2{};
+        supported_sync2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+        void* query_chain = nullptr;
+        if(is_vulkan12) {
+            query_chain = &supported_vulkan12;
+        }
+        if(is_vulkan13) {
+            supported_vulkan13.pNext = query_chain;
+            query_chain = &supported_vulkan13;
+        }
+        if(rendering_is_ext) {
+            supported_rendering.pNext = query_chain;
+            query_chain = &supported_rendering;
+        }
+        if(sync2_is_ext) {
+            supported_sync2.pNext = query_chain;
+            query_chain = &supported_sync2;
+        }
+        if(timeline_is_ext) {
+            supported_timeline.pNext = query_chain;
+            query_chain = &supported_timeline;
+        }
+        if(indexing_is_ext) {
+            supported_indexing.pNext = query_chain;
+            query_chain = &supported_indexing;
+        }
+        if(query_chain != nullptr) {
+            VkPhysicalDeviceFeatures2 features2{};
+            features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features2.pNext = query_chain;
+            vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+        }
+        
+        VkPhysicalDeviceVulkan12Features enabled_vulkan12{};
+        enabled_vulkan12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceTimelineSemaphoreFeatures enabled_timeline{};
+        enabled_timeline.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        VkPhysicalDeviceDescriptorIndexingFeatures enabled_indexing{};
+        enabled_indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+        VkPhysicalDeviceVulkan13Features enabled_vulkan13{};
+        enabled_vulkan13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+        VkPhysicalDeviceDynamicRenderingFeatures enabled_rendering{};
+        enabled_rendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+        VkPhysicalDeviceSynchronization2Features enabled_sync2{};
+        enabled_sync2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+        bool sync2_enabled = false;
+        if(is_vulkan12) {
+            m_timeline_supported = supported_vulkan12.timelineSemaphore == VK_TRUE;
+            m_draw_indirect_count_supported = supported_vulkan12.drawIndirectCount == VK_TRUE;
+            m_bindless_enabled = m_options.bindless && supported_vulkan12.runtimeDescriptorArray && supported_vulkan12.descriptorBindingPartiallyBound
+                              && supported_vulkan12.descriptorBindingSampledImageUpdateAfterBind && supported_vulkan12.shaderSampledImageArrayNonUniformIndexing;
+            enabled_vulkan12.timelineSemaphore = supported_vulkan12.timelineSemaphore;
+            enabled_vulkan12.drawIndirectCount = supported_vulkan12.drawIndirectCount;
+            if(m_bindless_enabled) {
+                enabled_vulkan12.descriptorIndexing = supported_vulkan12.descriptorIndexing;
+                enabled_vulkan12.runtimeDescriptorArray = VK_TRUE;
+                enabled_vulkan12.descriptorBindingPartiallyBound = VK_TRUE;
+                enabled_vulkan12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+                enabled_vulkan12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+            }
+            device_create_info.pNext = &enabled_vulkan12;
+        }
+        else {
+            m_timeline_supported = supported_timeline.timelineSemaphore == VK_TRUE;
+            m_draw_indirect_count_supported = m_available_device_ext.contains(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+            m_bindless_enabled = indexing_is_ext && supported_indexing.runtimeDescriptorArray && supported_indexing.descriptorBindingPartiallyBound
+                              && supported_indexing.descriptorBindingSampledImageUpdateAfterBind && supported_indexing.shaderSampledImageArrayNonUniformIndexing;
+            void* enable_chain = nullptr;
+            if(m_timeline_supported) {
+                enabled_timeline.timelineSemaphore = VK_TRUE;
+                enabled_timeline.pNext = enable_chain;
+                enable_chain = &enabled_timeline;
+                device_ext.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+            }
+            if(m_draw_indirect_count_supported) {
+                device_ext.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+            }
+            if(m_bindless_enabled) {
+                enabled_indexing.runtimeDescriptorArray = VK_TRUE;
+                enabled_indexing.descriptorBindingPartiallyBound = VK_TRUE;
+                enabled_indexing.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+                enabled_indexing.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+                enabled_indexing.pNext = enable_chain;
+                enable_chain = &enabled_indexing;
+                device_ext.push_back(VK_KHR_MAINTENANCE_3_EXTENSION_NAME);
+                device_ext.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+            }
+            device_create_info.pNext = enable_chain;
+        }
+        if(is_vulkan13) {
+            m_dynamic_rendering_enabled = m_options.dynamic_rendering && supported_vulkan13.dynamicRendering == VK_TRUE;
+            enabled_vulkan13.dynamicRendering = m_dynamic_rendering_enabled ? VK_TRUE : VK_FALSE;
+            sync2_enabled = m_dynamic_rendering_enabled && supported_vulkan13.synchronization2 == VK_TRUE;
+            enabled_vulkan13.synchronization2 = sync2_enabled ? VK_TRUE : VK_FALSE;
+            enabled_vulkan13.pNext = const_cast<void*>(device_create_info.pNext);
+            device_create_info.pNext = &enabled_vulkan13;
+        }
+        else if(rendering_is_ext && supported_rendering.dynamicRendering == VK_TRUE) {
+            m_dynamic_rendering_enabled = true;
+            enabled_rendering.dynamicRendering = VK_TRUE;
+            enabled_rendering.pNext = const_cast<void*>(device_create_info.pNext);
+            device_create_info.pNext = &enabled_rendering;
+            if(!is_vulkan12) {
+                device_ext.push_back(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+                device_ext.push_back(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME);
+            }
+            device_ext.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+            if(sync2_is_ext && supported_sync2.synchronization2 == VK_TRUE) {
+                sync2_enabled = true;
+                enabled_sync2.synchronization2 = VK_TRUE;
+                enabled_sync2.pNext = const_cast<void*>(device_create_info.pNext);
+                device_create_info.pNext = &enabled_sync2;
+                device_ext.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+            }
+        }
+        if(m_bindless_enabled) {
+            m_bindless_capacity = getBindlessCapacity(physical_device);
+        }
+        else if(m_options.bindless) {
+            std::cout << "bindless textures: descriptor indexing is not supported, every material samples the first texture" << std::endl;
+        }
+        
+        // descriptor update templates are core since 1.1, the descriptor writers fall back to plain writes without them
+        bool template_is_ext = !has_features2 && m_available_device_ext.contains(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+        if(template_is_ext) {
+            device_ext.push_back(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+        }
+        
+        // creation feedback tells pipeline cache hits from misses, it needs no feature bit
+        bool feedback_is_core = api_version >= VK_API_VERSION_1_3;
+        m_creation_feedback_supported = feedback_is_core || m_available_device_ext.contains(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+        if(m_creation_feedback_supported && !feedback_is_core) {
+            device_ext.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+        }
+        
         bool is_all_ext_supported = checkNamesSupported(m_available_device_ext, device_ext);
         if(!is_all_ext_supported) {
             throw std::runtime_error("device not support some extensions!");
@@ -2035,28 +8435,51 @@ private:
             throw std::runtime_error("failed to create logical device!");
         }
         
+        if(m_timeline_supported) {
+            m_pfnWaitSemaphores = (PFN_vkWaitSemaphores)vkGetDeviceProcAddr(device, is_vulkan12 ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR");
+            m_pfnGetSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValue)vkGetDeviceProcAddr(device, is_vulkan12 ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR");
+        }
+        if(m_draw_indirect_count_supported) {
+            m_pfnCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCount)vkGetDeviceProcAddr(device, is_vulkan12 ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndexedIndirectCountKHR");
+        }
+        if(m_dynamic_rendering_enabled) {
+            m_pfnCmdBeginRendering = (PFN_vkCmdBeginRendering)vkGetDeviceProcAddr(device, is_vulkan13 ? "vkCmdBeginRendering" : "vkCmdBeginRenderingKHR");
+            m_pfnCmdEndRendering = (PFN_vkCmdEndRendering)vkGetDeviceProcAddr(device, is_vulkan13 ? "vkCmdEndRendering" : "vkCmdEndRenderingKHR");
+        }
+        if(sync2_enabled) {
+            m_pfnCmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2)vkGetDeviceProcAddr(device, is_vulkan13 ? "vkCmdPipelineBarrier2" : "vkCmdPipelineBarrier2KHR");
+        }
+        if(has_features2 || template_is_ext) {
+            m_desc_template_functions.create = (PFN_vkCreateDescriptorUpdateTemplate)vkGetDeviceProcAddr(device, template_is_ext ? "vkCreateDescriptorUpdateTemplateKHR" : "vkCreateDescriptorUpdateTemplate");
+            m_desc_template_functions.destroy = (PFN_vkDestroyDescriptorUpdateTemplate)vkGetDeviceProcAddr(device, template_is_ext ? "vkDestroyDescriptorUpdateTemplateKHR" : "vkDestroyDescriptorUpdateTemplate");
+            m_desc_template_functions.update = (PFN_vkUpdateDescriptorSetWithTemplate)vkGetDeviceProcAddr(device, template_is_ext ? "vkUpdateDescriptorSetWithTemplateKHR" : "vkUpdateDescriptorSetWithTemplate");
+        }
+        
         return device;
     }
     
     void cleanupSwapchain() {
-        vkDestroyImageView(m_device, m_color_image_view, nullptr);
-        vkDestroyImage(m_device, m_color_image, nullptr);
-        vkFreeMemory(m_device, m_color_image_memory, nullptr);
-    
-        vkDestroyImageView(m_device, m_depth_view, nullptr);
-        vkDestroyImage(m_device, m_depth_image, nullptr);
-        vkFreeMemory(m_device, m_depth_memory, nullptr);
+        m_render_graph.destroy();
     
-        size_t sz = m_swapchain_framebuffers.size();
-        for(size_t i = 0u; i < sz; ++i) {
+        for(size_t i = 0u; i < m_swapchain_framebuffers.size(); ++i) {
             vkDestroyFramebuffer(m_device, m_swapchain_framebuffers[i], nullptr);
         }
-        for(size_t i = 0u; i < sz; ++i) {
+        for(size_t i = 0u; i < m_swapchain_views.size(); ++i) {
             vkDestroyImageView(m_device, m_swapchain_views[i], nullptr);
         }
-        vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
+        if(m_options.headless) {
+            for(size_t i = 0u; i < m_swapchain_images.size(); ++i) {
+                vkDestroyImage(m_device, m_swapchain_images[i], nullptr);
+                m_allocator.free(m_offscreen_memory[i]);
+            }
+        }
+        else {
+            vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
+        }
     }
     
+    // Only the extent-dependent objects are replaced. Viewport and scissor are dynamic state, so the pipeline, the
+    // render pass and the sync objects stay, and the old objects are retired instead of waiting for the device.
     void recreateSwapchain() {
         int width = 0;
         int height = 0;
@@ -2065,27 +8488,58 @@ private:
             glfwGetFramebufferSize(m_window, &width, &height);
             glfwWaitEvents();
         }
-    
-        vkDeviceWaitIdle(m_device);
         
-        cleanupSwapchain();
-        vkDestroyRenderPass(m_device, m_render_pass, nullptr);
-        vkDestroyPipeline(m_device, m_graphics_pipeline, nullptr);
-        vkDestroyPipelineLayout(m_device, m_pipeline_layout, nullptr);
-        for(size_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-            vkDestroySemaphore(m_device, m_image_available[i], nullptr);
-            vkDestroySemaphore(m_device, m_render_finished[i], nullptr);
-            vkDestroyFence(m_device, m_in_flight_frame[i], nullptr);
-        }
+        auto recreate_start = std::chrono::high_resolution_clock::now();
+        VkFormat old_format = m_swapchain_params.surface_format.format;
+        RetiredSwapchain retired{};
+        retired.frame_number = m_frame_number;
+        retired.swapchain = m_swapchain;
+        retired.views = std::move(m_swapchain_views);
+        retired.framebuffers = std::move(m_swapchain_framebuffers);
+        retired.transients = m_render_graph.takeTransients();
+        m_retired_swapchains.push_back(std::move(retired));
         
         createSwapchain();
-        createColorResources();      
-        createDepthResources();
-        //m_swapchain_views = getImageViews(m_device, m_swapchain_images, m_swapchain_params.surface_format);
-        createRenderPass();
-        createPipeline(m_vert_shader_modeule, m_frag_shader_modeule, m_render_pass);
-        createFramebuffers(m_swapchain_views, m_swapchain_params.extent, m_render_pass);
-        createSyncObjects();
+        if(m_swapchain_params.surface_format.format != old_format) {
+            // the render pass and the pipeline depend on the format, they are still in use by the frames in flight
+            // and a shader rebuild may be creating pipelines against them
+            std::unique_lock<std::mutex> shader_lock = m_shader_watcher.pause();
+            vkDeviceWaitIdle(m_device);
+            destroyGraphicsPipelines();
+            vkDestroyPipelineLayout(m_device, m_pipeline_layout, nullptr);
+            vkDestroyRenderPass(m_device, m_render_pass, nullptr);
+            if(!m_dynamic_rendering_enabled) {
+                createRenderPass();
+            }
+            createPipeline(m_vert_shader_modeule, m_frag_shader_modeule, m_render_pass);
+        }
+        buildRenderGraph();
+        if(!m_dynamic_rendering_enabled) {
+            m_swapchain_framebuffers = createFramebuffers(m_swapchain_views, m_swapchain_params.extent, m_render_pass);
+        }
+        
+        ++m_swapchain_recreations;
+        std::cout << "swapchain recreated at " << m_swapchain_params.extent.width << "x" << m_swapchain_params.extent.height << " in "
+                  << elapsedMs(recreate_start, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+    }
+    
+    // all - at shutdown, once the device is idle
+    void destroyRetiredSwapchains(bool all) {
+        while(!m_retired_swapchains.empty() && (all || m_retired_swapchains.front().frame_number + MAX_FRAMES_IN_FLIGHT <= m_frame_number)) {
+            RetiredSwapchain& retired = m_retired_swapchains.front();
+            for(VkPipeline pipeline : retired.pipelines) {
+                vkDestroyPipeline(m_device, pipeline, nullptr);
+            }
+            for(VkFramebuffer framebuffer : retired.framebuffers) {
+                vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+            }
+            for(VkImageView view : retired.views) {
+                vkDestroyImageView(m_device, view, nullptr);
+            }
+            retired.transients.destroy(m_device, m_allocator);
+            vkDestroySwapchainKHR(m_device, retired.swapchain, nullptr);
+            m_retired_swapchains.pop_front();
+        }
     }
     
     void update_frame(uint32_t current_image) {
@@ -2097,111 +8551,422 @@ private:
         glm::vec3 rotation_axis = glm::vec3(0.0f, 0.0f, 1.0f);
         float aspect = (float)m_swapchain_params.extent.width / (float)m_swapchain_params.extent.height;
         
-        UniformBufferObject ubo{};
-        ubo.model = glm::rotate(glm::mat4(1.0f), angle, rotation_axis);
-        ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        ubo.proj = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 10.0f);
-        ubo.proj[1][1] *= -1.0f;
-        
-        memcpy(m_uniform_mapped[current_image], &ubo, sizeof(ubo));
-        
+        FrameUniforms frame{};
+        // the camera backs off as the instance grid grows
+        float eye_distance = 2.0f * m_scene_radius;
+        frame.view = glm::lookAt(glm::vec3(eye_distance, eye_distance, eye_distance), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        frame.proj = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 5.0f * eye_distance);
+        frame.proj[1][1] *= -1.0f;
+        if(m_vertex_format == VertexFormat::Packed) {
+            frame.position_offset = glm::vec4(m_mesh_box.min_pos, 0.0f);
+            frame.position_scale = glm::vec4(m_mesh_box.max_pos - m_mesh_box.min_pos, 0.0f);
+        }
+        else {
+            frame.position_offset = glm::vec4(0.0f);
+            frame.position_scale = glm::vec4(1.0f);
+        }
         
+        // the region of this frame slot is free again, its fence has signaled
+        m_uniform_arena.beginFrame(current_image);
+        m_frame_uniform_offset = m_uniform_arena.push(frame);
+        
+        // every draw gets a block of its own, they all share the rotation so culling stays valid for each
+        ObjectUniforms object{};
+        object.model = glm::rotate(glm::mat4(1.0f), angle, rotation_axis);
+        m_cull_matrix = frame.proj * frame.view * object.model;
+        m_object_uniform_offsets.resize(std::max<size_t>(m_draw_list.size(), 1u)); // the indirect draw uses the first block
+        for(uint32_t& offset : m_object_uniform_offsets) {
+            offset = m_uniform_arena.push(object);
+        }
     }
     
     void drawFrame() {
-        vkWaitForFences(m_device, 1u, &m_in_flight_frame[m_current_frame], VK_TRUE, UINT64_MAX);
+        using clock = std::chrono::high_resolution_clock;
+        m_frame_timings = FrameTimings{};
         
-        uint32_t image_index;
-        VkResult result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, m_image_available[m_current_frame], VK_NULL_HANDLE, &image_index);
+        auto frame_start = clock::now();
+        vkWaitForFences(m_device, 1u, &m_in_flight_frame[m_current_frame], VK_TRUE, UINT64_MAX);
+        m_frame_timings.wait_fence_ms = elapsedMs(frame_start, clock::now());
+        collectGpuTimings(m_current_frame);
+        m_staging_ring.release(m_current_frame);
+        destroyRetiredSwapchains(false);
+        if(m_shader_watcher.isRunning()) {
+            applyShaderReloads();
+        }
+        if(m_render_settings_changed) {
+            applyRenderSettings();
+        }
         
-        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-            recreateSwapchain();
-            return;
+        uint32_t image_index = m_current_frame;
+        VkResult result = VK_SUCCESS;
+        if(m_options.headless) {
+            deliverReadback(m_current_frame);
         }
-        else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-            throw std::runtime_error("failed to acquire swap chain image!");
+        else {
+            auto acquire_start = clock::now();
+            result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, m_image_available[m_current_frame], VK_NULL_HANDLE, &image_index);
+            m_frame_timings.acquire_ms = elapsedMs(acquire_start, clock::now());
+            
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapchain();
+                return;
+            }
+            else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+                throw std::runtime_error("failed to acquire swap chain image!");
+            }
         }
     
         // Only reset the fence if we are submitting work
         vkResetFences(m_device, 1u, &m_in_flight_frame[m_current_frame]);
         
+        allocateFrameDescriptors();
         update_frame(m_current_frame);
+        if(m_cpu_cull_enabled) {
+            cullInstances();
+        }
+        
+        if(m_timeline_supported) {
+            // copies staged since the last frame run on the transfer queue while this frame records
+            submitUploads();
+        }
         
+        auto record_start = clock::now();
         vkResetCommandBuffer(m_command_buffers[m_current_frame], 0u);
         recordCommandBuffer(m_command_buffers[m_current_frame], image_index);
+        m_frame_timings.record_ms = elapsedMs(record_start, clock::now());
         
         VkSemaphore render_end_semaphores[] = {m_render_finished[m_current_frame]};
-        VkSemaphore wait_semaphores[] = {m_image_available[m_current_frame]};
-        VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+        std::array<VkSemaphore, 2> wait_semaphores{};
+        std::array<uint64_t, 2> wait_values{}; // ignored for the binary acquire semaphore
+        std::array<VkPipelineStageFlags, 2> wait_stages{};
+        uint32_t wait_count = 0u;
+        if(!m_options.headless) {
+            wait_semaphores[wait_count] = m_image_available[m_current_frame];
+            wait_stages[wait_count] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            ++wait_count;
+        }
+        if(m_upload_wait_ticket.semaphore != VK_NULL_HANDLE) {
+            wait_semaphores[wait_count] = m_upload_wait_ticket.semaphore;
+            wait_values[wait_count] = m_upload_wait_ticket.value;
+            wait_stages[wait_count] = VK_PIPELINE_STAGE_TRANSFER_BIT | UPLOAD_CONSUMER_STAGES;
+            ++wait_count;
+            m_upload_wait_ticket = UploadTicket{};
+        }
+        
+        VkTimelineSemaphoreSubmitInfo timeline_info{};
+        timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timeline_info.waitSemaphoreValueCount = wait_count;
+        timeline_info.pWaitSemaphoreValues = wait_values.data();
+        
         VkSubmitInfo submit_info{};
         submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submit_info.waitSemaphoreCount = 1u;
-        submit_info.pWaitSemaphores = wait_semaphores;
-        submit_info.pWaitDstStageMask = wait_stages;
+        submit_info.pNext = m_timeline_supported ? &timeline_info : nullptr;
+        submit_info.waitSemaphoreCount = wait_count;
+        submit_info.pWaitSemaphores = wait_semaphores.data();
+        submit_info.pWaitDstStageMask = wait_stages.data();
         submit_info.commandBufferCount = 1u;
         submit_info.pCommandBuffers = &m_command_buffers[m_current_frame];
-        submit_info.signalSemaphoreCount = 1u;
+        submit_info.signalSemaphoreCount = m_options.headless ? 0u : 1u;
         submit_info.pSignalSemaphores = render_end_semaphores;
         
+        auto submit_start = clock::now();
         result = vkQueueSubmit(m_graphics_queue, 1u, &submit_info, m_in_flight_frame[m_current_frame]);
+        m_frame_timings.submit_ms = elapsedMs(submit_start, clock::now());
         if (result != VK_SUCCESS) {
             throw std::runtime_error("failed to submit draw command buffer!");
         }
+        m_staging_ring.markSubmitted(m_current_frame);
         
-        VkSwapchainKHR swapchains[] = {m_swapchain};
-        VkPresentInfoKHR present_info{};
-        present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        present_info.waitSemaphoreCount = 1u;
-        present_info.pWaitSemaphores = render_end_semaphores;
-        present_info.swapchainCount = 1u;
-        present_info.pSwapchains = swapchains;
-        present_info.pImageIndices = &image_index;
-        present_info.pResults = nullptr;
-        result = vkQueuePresentKHR(m_present_queue, &present_info);
-        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_framebuffer_resized) {
-            m_framebuffer_resized = false;
-            //recreateSwapchain();
+        if(m_options.headless) {
+            m_readback_pending[m_current_frame] = m_frame_number;
         }
-        else if (result != VK_SUCCESS) {
-            throw std::runtime_error("failed to present swap chain image!");
+        else {
+            VkSwapchainKHR swapchains[] = {m_swapchain};
+            VkPresentInfoKHR present_info{};
+            present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            present_info.waitSemaphoreCount = 1u;
+            present_info.pWaitSemaphores = render_end_semaphores;
+            present_info.swapchainCount = 1u;
+            present_info.pSwapchains = swapchains;
+            present_info.pImageIndices = &image_index;
+            present_info.pResults = nullptr;
+            
+            auto present_start = clock::now();
+            result = vkQueuePresentKHR(m_present_queue, &present_info);
+            m_frame_timings.present_ms = elapsedMs(present_start, clock::now());
+            if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_framebuffer_resized) {
+                m_framebuffer_resized = false;
+                recreateSwapchain();
+            }
+            else if (result != VK_SUCCESS) {
+                throw std::runtime_error("failed to present swap chain image!");
+            }
         }
         
+        m_frame_timings.frame_ms = elapsedMs(frame_start, clock::now());
+        ++m_frame_number;
         m_current_frame = (m_current_frame + 1u) % MAX_FRAMES_IN_FLIGHT;
     }
+    
+    void writeBenchmarkReport(const std::string& file_name) {
+        VkPhysicalDeviceProperties device_props{};
+        vkGetPhysicalDeviceProperties(m_physical_device, &device_props);
+        
+        size_t frames = m_benchmark.frameCount();
+        double total_seconds = frames ? elapsedMs(m_benchmark_start, m_benchmark_end) / 1000.0 : 0.0;
+        double fps = total_seconds > 0.0 ? static_cast<double>(frames) / total_seconds : 0.0;
+        
+        std::ofstream file(file_name);
+        if(!file.is_open()) {
+            throw std::runtime_error("failed to open file: " + file_name + "\n");
+        }
+        
+        file << "{\n";
+        file << "  \"device\": \"" << jsonEscape(device_props.deviceName) << "\",\n";
+        file << "  \"headless\": " << (m_options.headless ? "true" : "false") << ",\n";
+        file << "  \"extent\": [" << m_swapchain_params.extent.width << ", " << m_swapchain_params.extent.height << "],\n";
+        file << "  \"msaa_samples\": " << static_cast<uint32_t>(m_msaa_samples) << ",\n";
+        file << "  \"draws\": " << m_draw_list.size() << ",\n";
+        file << "  \"instances\": " << m_instances.size() << ",\n";
+        file << "  \"vertex_format\": \"" << (m_vertex_format == VertexFormat::Packed ? "packed" : "float") << "\",\n";
+        file << "  \"vertex_stride\": " << getVertexStride() << ",\n";
+        if(m_mesh_stats.has_value()) {
+            const MeshLoadStats& mesh = m_mesh_stats.value();
+            file << "  \"mesh\": {\"file\": \"" << jsonEscape(mesh.file_name) << "\", \"bytes\": " << mesh.file_bytes
+                 << ", \"vertices\": " << mesh.vertex_count << ", \"indices\": " << mesh.index_count << ", \"index_bits\": " << mesh.index_bits
+                 << ", \"parse_ms\": " << mesh.parse_ms << ", \"load_ms\": " << mesh.load_ms << ", \"mb_per_s\": " << mesh.megabytesPerSecond()
+                 << ", \"optimize\": [";
+            for(size_t i = 0u; i < mesh.optimize_steps.size(); ++i) {
+                const MeshOptimizeStep& step = mesh.optimize_steps[i];
+                file << (i ? ", " : "") << "{\"step\": \"" << step.name << "\", \"acmr_before\": " << step.acmr_before
+                     << ", \"acmr_after\": " << step.acmr_after << ", \"ms\": " << step.ms << "}";
+            }
+            file << "]},\n";
+        }
+        file << "  \"texture_load_ms\": " << m_texture_load_ms << ",\n";
+        file << "  \"textures\": [";
+        for(size_t i = 0u; i < m_texture_stats.size(); ++i) {
+            const TextureLoadStats& texture = m_texture_stats[i];
+            file << (i ? ",\n    " : "\n    ") << "{\"file\": \"" << jsonEscape(texture.file_name) << "\", \"file_format\": \"" << getTextureFormatName(texture.file_format)
+                 << "\", \"image_format\": \"" << getTextureFormatName(texture.image_format) << "\", \"extent\": [" << texture.width << ", " << texture.height
+                 << "], \"mip_levels\": " << texture.mip_levels << ", \"bytes\": " << texture.image_bytes << ", \"rgba8_bytes\": " << texture.rgba8_bytes
+                 << ", \"decoder\": \"" << (texture.decode_kernel ? texture.decode_kernel : "none") << "\", \"decode_ms\": " << texture.decode_ms
+                 << ", \"wait_ms\": " << texture.wait_ms << ", \"load_ms\": " << texture.load_ms << "}";
+        }
+        file << "\n  ],\n";
+        file << "  \"descriptors\": {\"update_template\": " << (m_uniform_writer.usesTemplate() ? "true" : "false") << ", \"pools\": " << m_desc_allocator.poolCount()
+             << ", \"cached_layouts\": " << m_desc_layout_cache.size() << "},\n";
+        file << "  \"uniform_arena\": {\"region_bytes\": " << m_uniform_arena.regionSize() << ", \"used_bytes\": " << m_uniform_arena.usedBytes()
+             << ", \"object_blocks\": " << m_object_uniform_offsets.size() << "},\n";
+        file << "  \"bindless\": {\"enabled\": " << (m_bindless_enabled ? "true" : "false") << ", \"capacity\": " << m_bindless_capacity << ", \"textures\": " << m_textures.size() << "},\n";
+        file << "  \"dynamic_rendering\": " << (m_dynamic_rendering_enabled ? "true" : "false") << ",\n";
+        file << "  \"dynamic_resolution\": {\"enabled\": " << (m_dynamic_resolution_enabled ? "true" : "false") << ", \"target_ms\": " << m_options.target_frame_ms
+             << ", \"render_extent\": [" << m_render_extent.width << ", " << m_render_extent.height << "], \"msaa_samples\": " << static_cast<uint32_t>(m_msaa_samples)
+             << ", \"changes\": " << m_resolution_controller.getChangeCount() << "},\n";
+        file << "  \"shaders\": {\"runtime_compiler\": " << (ShaderCompiler::isAvailable() ? "true" : "false") << ", \"hot_reload\": " << (m_shader_watcher.isRunning() ? "true" : "false")
+             << ", \"reloads\": " << m_shader_reloads << ", \"files\": [";
+        for(size_t i = 0u; i < m_shader_files.size(); ++i) {
+            const ShaderFile& shader = m_shader_files[i];
+            file << (i ? ", " : "") << "{\"file\": \"" << jsonEscape(shader.glsl_path) << "\", \"origin\": \"" << shader.origin << "\", \"ms\": " << shader.load_ms << "}";
+        }
+        file << "]},\n";
+        file << "  \"swapchain_recreations\": " << m_swapchain_recreations << ",\n";
+        const RenderGraph::Stats& graph_stats = m_render_graph.getStats();
+        file << "  \"render_graph\": {\"synchronization2\": " << (m_pfnCmdPipelineBarrier2 ? "true" : "false") << ", \"transients\": " << graph_stats.transient_count
+             << ", \"alias_slots\": " << graph_stats.alias_slot_count << ", \"transient_bytes\": " << graph_stats.transient_bytes
+             << ", \"unaliased_bytes\": " << graph_stats.unaliased_bytes << ", \"barrier_batches\": " << graph_stats.barrier_batches
+             << ", \"barriers\": " << graph_stats.barrier_count << "},\n";
+        file << "  \"gpu_cull\": " << (m_gpu_cull_enabled ? "true" : "false") << ",\n";
+        file << "  \"record_threads\": " << m_record_workers.threadCount() << ",\n";
+        if(m_cpu_cull_enabled) {
+            file << "  \"cpu_cull\": {\n";
+            file << "    \"kernel\": \"" << m_cpu_culler.kernelName() << "\",\n";
+            file << "    \"threads\": " << m_worker_pool.threadCount() + 1u << ",\n";
+            file << "    \"visible\": ";
+            writeJsonSummary(file, m_benchmark.summarize(&FrameTimings::visible_instances));
+            file << ",\n    \"culled\": ";
+            writeJsonSummary(file, m_benchmark.summarize(&FrameTimings::culled_instances));
+            file << "\n  },\n";
+        }
+        file << "  \"warmup_frames\": " << m_options.warmup_frames << ",\n";
+        file << "  \"frames\": " << frames << ",\n";
+        file << "  \"total_seconds\": " << total_seconds << ",\n";
+        file << "  \"fps\": " << fps << ",\n";
+        file << "  \"cpu_ms\": {\n";
+        const std::array<std::pair<const char*, double FrameTimings::*>, 7u> metrics = {{
+            {"frame", &FrameTimings::frame_ms},
+            {"wait_fences", &FrameTimings::wait_fence_ms},
+            {"acquire", &FrameTimings::acquire_ms},
+            {"cull", &FrameTimings::cull_ms},
+            {"record", &FrameTimings::record_ms},
+            {"submit", &FrameTimings::submit_ms},
+            {"present", &FrameTimings::present_ms}
+        }};
+        for(size_t i = 0u; i < metrics.size(); ++i) {
+            file << "    \"" << metrics[i].first << "\": ";
+            writeJsonSummary(file, m_benchmark.summarize(metrics[i].second));
+            file << (i + 1u < metrics.size() ? ",\n" : "\n");
+        }
+        file << "  },\n";
+        
+        std::vector<std::pair<std::string, TimingSummary>> gpu_zones = m_benchmark.summarizeGpuZones();
+        file << "  \"gpu_frames\": " << m_benchmark.gpuFrameCount() << ",\n";
+        
+        MemoryStats memory_stats = m_allocator.getStats();
+        file << "  \"memory\": {\n";
+        file << "    \"device_memory_objects\": " << memory_stats.device_memory_count << ",\n";
+        file << "    \"live_allocations\": " << memory_stats.allocation_count << ",\n";
+        file << "    \"heaps\": [";
+        for(size_t i = 0u; i < memory_stats.heaps.size(); ++i) {
+            const MemoryHeapStats& heap = memory_stats.heaps[i];
+            file << (i ? ", " : "") << "{\"heap\": " << heap.heap_index
+                 << ", \"blocks\": " << heap.block_count
+                 << ", \"allocations\": " << heap.allocation_count
+                 << ", \"block_bytes\": " << heap.block_bytes
+                 << ", \"used_bytes\": " << heap.used_bytes
+                 << ", \"fragmentation\": " << heap.fragmentation() << "}";
+        }
+        file << "]\n";
+        file << "  },\n";
+        
+        const PipelineCacheStats& cache_stats = m_pipeline_cache.getStats();
+        file << "  \"pipeline_cache\": {\n";
+        file << "    \"loaded_bytes\": " << m_pipeline_cache.loadedBytes() << ",\n";
+        file << "    \"hits\": " << cache_stats.hits << ",\n";
+        file << "    \"misses\": " << cache_stats.misses << ",\n";
+        file << "    \"unclassified\": " << cache_stats.unclassified << ",\n";
+        file << "    \"hit_ms\": " << cache_stats.hit_ms << ",\n";
+        file << "    \"miss_ms\": " << cache_stats.miss_ms << ",\n";
+        file << "    \"unclassified_ms\": " << cache_stats.unclassified_ms << "\n";
+        file << "  },\n";
+        file << "  \"gpu_ms\": {\n";
+        for(size_t i = 0u; i < gpu_zones.size(); ++i) {
+            file << "    \"" << jsonEscape(gpu_zones[i].first) << "\": ";
+            writeJsonSummary(file, gpu_zones[i].second);
+            file << (i + 1u < gpu_zones.size() ? ",\n" : "\n");
+        }
+        file << "  }\n";
+        file << "}\n";
+        
+        TimingSummary frame_summary = m_benchmark.summarize(&FrameTimings::frame_ms);
+        std::cout << "benchmark: " << frames << " frames, " << fps << " fps, frame ms p50 " << frame_summary.p50 << " p99 " << frame_summary.p99;
+        if(!gpu_zones.empty()) {
+            std::cout << ", gpu " << gpu_zones.front().first << " ms p50 " << gpu_zones.front().second.p50;
+        }
+        std::cout << " -> " << file_name << std::endl;
+    }
+    
+    bool shouldStop() {
+        if(m_options.frame_count && m_frame_number >= m_options.frame_count) {
+            return true;
+        }
+        return !m_options.headless && glfwWindowShouldClose(m_window);
+    }
 
+    // Frame slot results become available a full MAX_FRAMES_IN_FLIGHT frames after recording.
+    void collectGpuTimings(uint32_t frame) {
+        std::optional<GpuFrameTimings> gpu_timings = m_gpu_profiler.collect(m_device, frame);
+        if(gpu_timings.has_value() && isBenchmarkFrame(gpu_timings->frame_number)) {
+            m_benchmark.addGpuFrame(gpu_timings.value());
+        }
+        if(gpu_timings.has_value() && m_dynamic_resolution_enabled) {
+            const auto& zones = gpu_timings->zones_ms;
+            auto frame_zone = std::find_if(zones.cbegin(), zones.cend(), [](const auto& zone) { return zone.first == "frame"; });
+            if(frame_zone != zones.cend() && m_resolution_controller.update(frame_zone->second)) {
+                m_render_settings_changed = true;
+            }
+        }
+    }
+    
+    bool isBenchmarkFrame(uint64_t frame_number) {
+        return m_options.benchmark_frames && frame_number >= m_options.warmup_frames;
+    }
+    
     void mainLoop() {
-        while(!glfwWindowShouldClose(m_window)) {
-            glfwPollEvents();
+        while(!shouldStop()) {
+            if(!m_options.headless) {
+                glfwPollEvents();
+            }
+            
+            uint64_t frame_number = m_frame_number;
+            if(isBenchmarkFrame(frame_number) && m_benchmark.frameCount() == 0u) {
+                m_benchmark_start = std::chrono::high_resolution_clock::now();
+            }
             drawFrame();
+            if(m_frame_number != frame_number && isBenchmarkFrame(frame_number)) {
+                m_benchmark.addFrame(m_frame_timings);
+                m_benchmark_end = std::chrono::high_resolution_clock::now();
+            }
         }
         
         vkDeviceWaitIdle(m_device);
+        
+        for(uint32_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+            collectGpuTimings((m_current_frame + i) % MAX_FRAMES_IN_FLIGHT);
+        }
+        
+        if(m_options.benchmark_frames) {
+            writeBenchmarkReport(m_options.report_path);
+        }
+        
+        if(m_options.headless) {
+            // oldest pending readback sits in the slot that would be reused next
+            for(uint32_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+                deliverReadback((m_current_frame + i) % MAX_FRAMES_IN_FLIGHT);
+            }
+        }
     }
 
     void cleanup() {
+        m_shader_watcher.destroy();
+        for(ShaderReload& reload : m_shader_watcher.takeFinished()) {
+            vkDestroyShaderModule(m_device, reload.module, nullptr);
+            for(const PipelineCreation& creation : reload.pipelines) {
+                vkDestroyPipeline(m_device, creation.pipeline, nullptr);
+            }
+        }
+        m_record_workers.destroy();
+        m_worker_pool.destroy();
+        destroyRetiredSwapchains(true);
         cleanupSwapchain();
         
         vkDestroySampler(m_device, m_texture_sampler, nullptr);
-        vkDestroyImageView(m_device, m_texture_view, nullptr);
-        vkDestroyImage(m_device, m_texture_image, nullptr);
-        vkFreeMemory(m_device, m_texture_memory, nullptr);
+        for(Texture& texture : m_textures) {
+            vkDestroyImageView(m_device, texture.view, nullptr);
+            vkDestroyImage(m_device, texture.image, nullptr);
+            m_allocator.free(texture.memory);
+        }
+        
+        vkDestroyBuffer(m_device, m_uniform_buffer, nullptr);
+        m_allocator.free(m_uniform_memory);
         
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vkDestroyBuffer(m_device, m_uniform_buffers[i], nullptr);
-            vkFreeMemory(m_device, m_uniform_memory[i], nullptr);
+        vkDestroyBuffer(m_device, m_staging_buffer, nullptr);
+        m_allocator.free(m_staging_memory);
+        
+        for (size_t i = 0; i < m_readback_buffers.size(); i++) {
+            vkDestroyBuffer(m_device, m_readback_buffers[i], nullptr);
+            m_allocator.free(m_readback_memory[i]);
         }
         
-        vkDestroyDescriptorPool(m_device, m_desc_pool, nullptr);
-        vkDestroyDescriptorSetLayout(m_device, m_desc_set_layout, nullptr);
+        destroyCullingResources();
+        destroyCpuCulling();
+        m_uniform_writer.destroy(m_device);
+        m_desc_allocator.destroy();
+        vkDestroyDescriptorPool(m_device, m_texture_desc_pool, nullptr);
+        m_desc_layout_cache.destroy(m_device);
         
         vkDestroyBuffer(m_device, m_vertex_buffer, nullptr);
-        vkFreeMemory(m_device, m_vertex_memory, nullptr);
+        m_allocator.free(m_vertex_memory);
         vkDestroyBuffer(m_device, m_index_buffer, nullptr);
-        vkFreeMemory(m_device, m_index_memory, nullptr);
+        m_allocator.free(m_index_memory);
+        vkDestroyBuffer(m_device, m_instance_buffer, nullptr);
+        m_allocator.free(m_instance_memory);
         
         vkDestroyRenderPass(m_device, m_render_pass, nullptr);
-        vkDestroyPipeline(m_device, m_graphics_pipeline, nullptr);
+        destroyGraphicsPipelines();
         vkDestroyPipelineLayout(m_device, m_pipeline_layout, nullptr);
+        m_pipeline_cache.save(m_device);
+        m_pipeline_cache.destroy(m_device);
         for(size_t i = 0u; i < MAX_FRAMES_IN_FLIGHT; ++i) {
             vkDestroySemaphore(m_device, m_image_available[i], nullptr);
             vkDestroySemaphore(m_device, m_render_finished[i], nullptr);
@@ -2214,24 +8979,219 @@ private:
         else {
             vkDestroyCommandPool(m_device, m_grapics_cmd_pool, nullptr);
         }
+        // destroying the pools also frees the single-time command buffers that were never recycled
+        vkDestroySemaphore(m_device, m_graphics_timeline.semaphore, nullptr);
+        vkDestroySemaphore(m_device, m_transfer_timeline.semaphore, nullptr);
         vkDestroyShaderModule(m_device, m_frag_shader_modeule, nullptr);
         vkDestroyShaderModule(m_device, m_vert_shader_modeule, nullptr);
+        m_gpu_profiler.destroy(m_device);
+        m_allocator.destroy();
         vkDestroyDevice(m_device, nullptr);
         if (ENABLE_VALIDATION_LAYERS) {
             DestroyDebugUtilsMessengerEXT(m_vk_instance, m_debug_messenger, nullptr);
         }
-        vkDestroySurfaceKHR(m_vk_instance, m_surface, nullptr);
+        if (m_surface != VK_NULL_HANDLE) {
+            vkDestroySurfaceKHR(m_vk_instance, m_surface, nullptr);
+        }
         vkDestroyInstance(m_vk_instance, nullptr);
         
-        glfwDestroyWindow(m_window);
-        glfwTerminate();
+        if (m_window) {
+            glfwDestroyWindow(m_window);
+            glfwTerminate();
+        }
     }
 };
 
-int main() {
-    HelloTriangleApplication app;
+static AppOptions parseCommandLine(int argc, char** argv) {
+    AppOptions options;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next_value = [&]() -> std::string {
+            if(i + 1 >= argc) {
+                throw std::invalid_argument("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        
+        if(arg == "--headless") {
+            options.headless = true;
+        }
+        else if(arg == "--frames") {
+            options.frame_count = std::stoull(next_value());
+        }
+        else if(arg == "--width") {
+            options.width = static_cast<uint32_t>(std::stoul(next_value()));
+        }
+        else if(arg == "--height") {
+            options.height = static_cast<uint32_t>(std::stoul(next_value()));
+        }
+        else if(arg == "--dump-frames") {
+            options.dump_frames_dir = next_value();
+        }
+        else if(arg == "--benchmark") {
+            options.benchmark_frames = std::stoull(next_value());
+        }
+        else if(arg == "--warmup") {
+            options.warmup_frames = std::stoull(next_value());
+        }
+        else if(arg == "--report") {
+            options.report_path = next_value();
+        }
+        else if(arg == "--pipeline-cache") {
+            options.pipeline_cache_path = next_value();
+        }
+        else if(arg == "--no-pipeline-cache") {
+            options.pipeline_cache_path.clear();
+        }
+        else if(arg == "--record-threads") {
+            std::string value = next_value();
+            options.record_threads = value == "auto" ? std::max(2u, std::thread::hardware_concurrency()) - 1u : static_cast<uint32_t>(std::stoul(value));
+        }
+        else if(arg == "--draws") {
+            options.draw_count = static_cast<uint32_t>(std::stoul(next_value()));
+        }
+        else if(arg == "--instances") {
+            options.instance_count = static_cast<uint32_t>(std::stoul(next_value()));
+        }
+        else if(arg == "--mesh") {
+            options.mesh_path = next_value();
+        }
+        else if(arg == "--texture") {
+            options.texture_paths.push_back(next_value());
+        }
+        else if(arg == "--texture-list") {
+            // one path per line
+            std::string list_path = next_value();
+            std::ifstream list(list_path);
+            if(!list) {
+                throw std::invalid_argument("failed to open texture list: " + list_path);
+            }
+            for(std::string line; std::getline(list, line);) {
+                if(!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if(!line.empty()) {
+                    options.texture_paths.push_back(line);
+                }
+            }
+        }
+        else if(arg == "--cook-texture") {
+            options.cook_input = next_value();
+            options.cook_output = next_value();
+        }
+        else if(arg == "--no-mesh-optimize") {
+            options.optimize_mesh = false;
+        }
+        else if(arg == "--no-bindless") {
+            options.bindless = false;
+        }
+        else if(arg == "--no-dynamic-rendering") {
+            options.dynamic_rendering = false;
+        }
+        else if(arg == "--target-frame-ms") {
+            options.target_frame_ms = std::stod(next_value());
+        }
+        else if(arg == "--min-render-scale") {
+            options.min_render_scale = std::stof(next_value());
+        }
+        else if(arg == "--shader-cache") {
+            options.shader_cache_dir = next_value();
+        }
+        else if(arg == "--no-shader-cache") {
+            options.shader_cache_dir.clear();
+        }
+        else if(arg == "--watch-shaders") {
+            options.watch_shaders = true;
+        }
+        else if(arg == "--vertex-format") {
+            std::string value = next_value();
+            if(value == "float") {
+                options.vertex_format = VertexFormat::Float;
+            }
+            else if(value == "packed") {
+                options.vertex_format = VertexFormat::Packed;
+            }
+            else {
+                throw std::invalid_argument("unknown vertex format: " + value);
+            }
+        }
+        else if(arg == "--gpu-cull") {
+            options.gpu_cull = true;
+        }
+        else if(arg == "--cpu-cull") {
+            options.cpu_cull = true;
+        }
+        else if(arg == "--worker-threads") {
+            std::string value = next_value();
+            options.worker_threads = value == "auto" ? std::max(2u, std::thread::hardware_concurrency()) - 1u : static_cast<uint32_t>(std::stoul(value));
+        }
+        else {
+            throw std::invalid_argument("unknown argument: " + arg);
+        }
+    }
+    
+    if(options.benchmark_frames) {
+        options.frame_count = options.warmup_frames + options.benchmark_frames;
+    }
+    if(options.headless && options.frame_count == 0u) {
+        options.frame_count = 1u;
+    }
+    if(options.width == 0u || options.height == 0u) {
+        throw std::invalid_argument("frame size must be non-zero!");
+    }
+    if(options.instance_count == 0u) {
+        throw std::invalid_argument("instance count must be non-zero!");
+    }
+    return options;
+}
+
+static void writePpm(const std::string& file_name, const HeadlessFrame& frame) {
+    std::ofstream file(file_name, std::ios::binary);
+    if(!file.is_open()) {
+        throw std::runtime_error("failed to open file: " + file_name + "\n");
+    }
+    file << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+    
+    bool is_bgra = frame.format == VK_FORMAT_B8G8R8A8_SRGB || frame.format == VK_FORMAT_B8G8R8A8_UNORM;
+    std::vector<char> row(frame.width * 3u);
+    for(uint32_t y = 0u; y < frame.height; ++y) {
+        const uint8_t* src = static_cast<const uint8_t*>(frame.pixels) + y * frame.row_pitch;
+        for(uint32_t x = 0u; x < frame.width; ++x) {
+            row[x * 3u + 0u] = src[x * 4u + (is_bgra ? 2u : 0u)];
+            row[x * 3u + 1u] = src[x * 4u + 1u];
+            row[x * 3u + 2u] = src[x * 4u + (is_bgra ? 0u : 2u)];
+        }
+        file.write(row.data(), row.size());
+    }
+}
 
+int main(int argc, char** argv) {
     try {
+        AppOptions options = parseCommandLine(argc, argv);
+        if(!options.cook_input.empty()) {
+            WorkerPool pool;
+            pool.init(options.worker_threads);
+            try {
+                TextureCooker(pool).cook(options.cook_input, options.cook_output);
+            }
+            catch(...) {
+                pool.destroy();
+                throw;
+            }
+            pool.destroy();
+            return EXIT_SUCCESS;
+        }
+        
+        HelloTriangleApplication app(options);
+        
+        if(!options.dump_frames_dir.empty()) {
+            std::filesystem::create_directories(options.dump_frames_dir);
+            app.setFrameConsumer([dir = options.dump_frames_dir](const HeadlessFrame& frame) {
+                std::filesystem::path file_path = std::filesystem::path(dir) / ("frame_" + std::to_string(frame.frame_number) + ".ppm");
+                writePpm(file_path.string(), frame);
+            });
+        }
+        
         app.run();
     }
     catch (const std::exception& e) {
@@ -1,2 +1,8 @@
-/Users/o.arkhangelsky/VulkanSDK/1.3.250.1/macOS/bin/glslc shader.vert -o vert.spv
-/Users/o.arkhangelsky/VulkanSDK/1.3.250.1/macOS/bin/glslc shader.frag -o frag.spv
+#!/bin/sh
+# Prebuilt SPIR-V for builds without shaderc. GLSLC overrides the compiler, otherwise glslc is taken from PATH or the Vulkan SDK.
+GLSLC=${GLSLC:-$(command -v glslc || echo "$VULKAN_SDK/bin/glslc")}
+cd "$(dirname "$0")" || exit 1
+"$GLSLC" shader.vert -o vert.spv
+"$GLSLC" shader.frag -o frag.spv
+"$GLSLC" shader_single.frag -o frag_single.spv
+"$GLSLC" cull.comp -o cull.spv
@@ -1,13 +1,16 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(binding = 1) uniform sampler2D texSampler;
+// bindless texture array, only the first loaded textures are written (partially bound)
+layout(binding = 1) uniform sampler2D texSamplers[];
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoords;
+layout(location = 2) flat in uint fragMaterialIndex;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    //outColor = vec4(fragTexCoords, 0.0f, 1.0f);
-    outColor = texture(texSampler, fragTexCoords);
+    // instances of one draw may use different materials, so the index is not uniform
+    outColor = texture(texSamplers[nonuniformEXT(fragMaterialIndex)], fragTexCoords);
 }
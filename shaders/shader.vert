@@ -1,20 +1,34 @@
 #version 450
 
-layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
+// set 1, both blocks are bound with dynamic offsets into the per-frame uniform arena
+layout(set = 1, binding = 0) uniform FrameUniforms {
     mat4 view;
     mat4 proj;
-} ubo;
+    vec4 positionOffset;
+    vec4 positionScale;
+} frame;
+
+layout(set = 1, binding = 1) uniform ObjectUniforms {
+    mat4 model;
+} object;
 
+// float or packed vertices, packed positions arrive as unorm inside the mesh bounding box
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoords;
 
+// per-instance stream, binding 1
+layout(location = 3) in mat4 inInstanceModel;
+layout(location = 7) in uint inMaterialIndex;
+
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoords;
+layout(location = 2) flat out uint fragMaterialIndex;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0f);
+    vec3 position = frame.positionOffset.xyz + inPosition * frame.positionScale.xyz;
+    gl_Position = frame.proj * frame.view * object.model * inInstanceModel * vec4(position, 1.0f);
     fragColor = inColor;
     fragTexCoords = inTexCoords;
+    fragMaterialIndex = inMaterialIndex;
 }
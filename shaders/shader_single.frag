@@ -0,0 +1,16 @@
+#version 450
+
+// for devices without descriptor indexing: every material samples the first texture
+
+layout(binding = 1) uniform sampler2D texSampler;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoords;
+layout(location = 2) flat in uint fragMaterialIndex;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    //outColor = vec4(fragTexCoords, 0.0f, 1.0f);
+    outColor = texture(texSampler, fragTexCoords);
+}